@@ -0,0 +1,395 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include "state_machine.h"
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace helper {
+
+#define BATCH_EVENT_ID(FuncType) \
+        helper::BatchEngine::EventId<FuncType>(#FuncType)
+
+#define BATCH_APPLY(engine, instances, event_ids, count) \
+        (engine).Apply(HELPER_FROM_HERE, instances, event_ids, count)
+
+/*
+    批量执行引擎使用的图，在派生类的构造函数中像 StateMachine 一样描述状态和匹配，EVENT_TO 等宏可以直接使用：
+        struct FlowChart : BatchChart {
+            FlowChart() :BatchChart("idle") {
+                match + EVENT_TO(Open, "open");
+                (*this)["open"].match + EVENT_TO(Close, "idle");
+            }
+        };
+*/
+class BatchChart : public StateMachine::State {
+  public:
+    explicit BatchChart(const std::string& id) :StateMachine::State(id) {}
+  protected:
+    using Matching = StateMachine::Matching;
+    using MessageType = StateMachine::MessageType;
+};
+
+/*
+    大量平面小状态机的批量执行引擎：所有实例共用一张图，每个实例只占一个字节（状态序号）。
+    图用 StateMachine::State 描述：chart 本身是初始状态，它的直接子状态是其他状态，不能再有子状态或 parallel。
+    状态的 match 中只能是没有条件的 EVENT，处理函数类型为 BatchEngine::Handler，用 To() 或 EVENT_TO 指定目标状态。
+    子状态没有匹配时使用 chart 的 match，与 StateMachine 从当前状态向根状态匹配的顺序相同。
+
+    构造时把图编译成 状态 x 事件 的转移表，Apply 按表查找下一个状态，支持 AVX2 的 CPU 上每次用 gather 处理 8 个事件。
+    只有需要调用处理函数、onentry/onexit，或者 8 个事件中有相同实例时才逐个处理。
+    没有线程和队列，所有函数都必须在同一个线程调用，多核使用时按实例分片，每个线程一个引擎。
+*/
+class BatchEngine {
+  public:
+    using Handler = std::function<void(const Location&, uint32_t)>; //参数为实例编号
+
+    static constexpr uint32_t kMaxStates = 256;
+
+    // 事件ID，与 StateMachine 中同一函数类型的签名ID相同
+    template<typename FuncType>
+    static uint32_t EventId(const char* signature) {
+        return EventIdRegistry::Intern(typeid(FuncType).name() + std::string(signature));
+    }
+
+    BatchEngine(const StateMachine::State& chart, size_t instances) {
+        compile(chart);
+        Resize(instances);
+    }
+    virtual ~BatchEngine() {}
+
+    BatchEngine(const BatchEngine&) = delete;
+    BatchEngine& operator=(const BatchEngine&) = delete;
+
+    // 改变实例数量，新增的实例处于初始状态
+    void Resize(size_t instances) {
+        if (instances > static_cast<size_t>(INT32_MAX) - kPadding) {
+            throw std::invalid_argument("Too many batch instances.");
+        }
+        states_.resize(instances + kPadding, 0);
+        size_ = instances;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // 实例状态的连续数组，长度为 Size()，值为状态序号
+    const uint8_t* States() const {
+        return states_.data();
+    }
+
+    uint32_t GetState(uint32_t instance) const {
+        return states_.at(checkInstance(instance));
+    }
+
+    const std::string& GetStateId(uint32_t instance) const {
+        return state_ids_[GetState(instance)];
+    }
+
+    // 状态ID对应的序号，初始状态为 0
+    uint32_t GetStateIndex(const std::string& id) const {
+        auto it = std::find(state_ids_.begin(), state_ids_.end(), id);
+        if (it == state_ids_.end()) {
+            throw std::invalid_argument("Unknown batch state: " + id);
+        }
+        return static_cast<uint32_t>(it - state_ids_.begin());
+    }
+
+    size_t GetStateCount() const {
+        return state_ids_.size();
+    }
+
+    // 直接设置实例的状态，不执行 onentry/onexit
+    void SetState(uint32_t instance, uint32_t state) {
+        if (state >= state_ids_.size()) {
+            throw std::out_of_range("Batch state index out of range.");
+        }
+        states_[checkInstance(instance)] = static_cast<uint8_t>(state);
+    }
+
+    /*
+        依次处理 count 个（实例，事件ID），同一实例的多个事件按顺序生效，返回匹配的事件数。
+        处理函数抛出异常或实例编号越界时抛出异常，之前的事件已经处理。
+    */
+    size_t Apply(const Location& loc, const uint32_t* instances, const uint32_t* event_ids, size_t count) {
+        size_t i = 0;
+        size_t matched = 0;
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+        if (hasAvx2()) {
+            i = applyAvx2(loc, instances, event_ids, count, matched);
+        }
+#endif
+        for (; i < count; ++i) {
+            matched += step(loc, instances[i], event_ids[i]);
+        }
+        unmatched_ += count - matched;
+        return matched;
+    }
+
+    // 累计没有匹配的事件数
+    uint64_t GetUnmatchedCount() const {
+        return unmatched_;
+    }
+
+  private:
+    // 转移表的项：低 8 位是下一个状态
+    static constexpr int32_t kMatched = 1 << 8;   //有匹配
+    static constexpr int32_t kSlow = 1 << 9;      //需要调用处理函数或 onentry/onexit
+    static constexpr size_t kPadding = 3;         //gather 按 4 字节读取状态数组，末尾多留 3 个字节
+
+    struct Action {
+        int32_t handler_ = -1;  //handlers_ 的下标，-1 表示没有处理函数
+        bool transition_ = false;
+    };
+
+    void compile(const StateMachine::State& chart) {
+        std::vector<const StateMachine::State*> states;
+        states.push_back(&chart);
+        state_ids_.push_back(chart.GetId());
+        for (const auto& child : chart.children) {
+            if (!child.second.children.empty() || !child.second.parallel.empty()) {
+                throw std::invalid_argument("Batch chart must be flat: " + child.first);
+            }
+            states.push_back(&child.second);
+            state_ids_.push_back(child.first);
+        }
+        if (!chart.parallel.empty()) {
+            throw std::invalid_argument("Batch chart cannot contain parallel states.");
+        }
+        if (states.size() > kMaxStates) {
+            throw std::invalid_argument("Batch chart has too many states.");
+        }
+
+        //事件ID到列号，0 列表示图中没有的事件
+        std::vector<uint32_t> events;
+        for (auto state : states) {
+            if (!state->defer.empty()) {
+                throw std::invalid_argument("Batch chart cannot defer events.");
+            }
+            for (const auto& c : state->match) {
+                if (c.type_ != StateMachine::MessageType::EVENT || c.cond_.has_value() || c.keyed_) {
+                    throw std::invalid_argument("Batch chart only supports unconditional events: " + c.signature_);
+                }
+                if (c.func_.has_value() && c.func_.type() != typeid(Handler)) {
+                    throw std::invalid_argument("Batch handler must be BatchEngine::Handler: " + c.signature_);
+                }
+                if (std::find(events.begin(), events.end(), c.event_id_) == events.end()) {
+                    events.push_back(c.event_id_);
+                }
+            }
+        }
+        uint32_t max_id = 0;
+        for (auto id : events) {
+            max_id = std::max(max_id, id);
+        }
+        column_of_.assign(max_id + 2, 0); //最后一项为 0，越界的事件ID截到这里
+        for (size_t i = 0; i < events.size(); ++i) {
+            column_of_[events[i]] = static_cast<int32_t>(i + 1);
+        }
+        column_shift_ = 0;
+        while ((static_cast<size_t>(1) << column_shift_) < events.size() + 1) {
+            ++column_shift_;
+        }
+
+        entry_.resize(states.size());
+        exit_.resize(states.size());
+        for (size_t s = 0; s < states.size(); ++s) {
+            entry_[s].assign(states[s]->onentry.begin(), states[s]->onentry.end());
+            exit_[s].assign(states[s]->onexit.begin(), states[s]->onexit.end());
+        }
+
+        size_t columns = static_cast<size_t>(1) << column_shift_;
+        table_.assign(states.size() * columns, 0);
+        actions_.assign(table_.size(), Action());
+        for (size_t s = 0; s < states.size(); ++s) {
+            for (size_t col = 0; col < columns; ++col) {
+                table_[(s << column_shift_) + col] = static_cast<int32_t>(s); //没有匹配时状态不变
+            }
+            for (size_t e = 0; e < events.size(); ++e) {
+                const StateMachine::Matching* found = findMatching(*states[s], events[e]);
+                if (found == nullptr && s != 0) {
+                    found = findMatching(chart, events[e]);
+                }
+                if (found == nullptr) {
+                    continue;
+                }
+                size_t index = (s << column_shift_) + e + 1;
+                size_t target = s;
+                Action action;
+                if (!found->target_.empty()) {
+                    target = GetStateIndex(found->target_);
+                    action.transition_ = true;
+                }
+                if (found->func_.has_value()) {
+                    action.handler_ = static_cast<int32_t>(handlers_.size());
+                    handlers_.push_back(std::any_cast<Handler>(found->func_));
+                }
+                //转移到当前状态或根状态时不离开也不进入，与 StateMachine::Transition 的最短路径一致
+                bool leave = target != s && s != 0 && !exit_[s].empty();
+                bool enter = target != s && target != 0 && !entry_[target].empty();
+                table_[index] = static_cast<int32_t>(target) | kMatched;
+                if (action.handler_ >= 0 || leave || enter) {
+                    table_[index] |= kSlow;
+                }
+                actions_[index] = action;
+            }
+        }
+    }
+
+    static const StateMachine::Matching* findMatching(const StateMachine::State& state, uint32_t event_id) {
+        for (const auto& c : state.match) {
+            if (c.event_id_ == event_id) {
+                return &c;
+            }
+        }
+        return nullptr;
+    }
+
+    size_t checkInstance(uint32_t instance) const {
+        if (instance >= size_) {
+            throw std::out_of_range("Batch instance out of range.");
+        }
+        return instance;
+    }
+
+    uint32_t columnOf(uint32_t event_id) const {
+        return event_id < column_of_.size() ? static_cast<uint32_t>(column_of_[event_id]) : 0;
+    }
+
+    // 处理一个事件，匹配时返回 1
+    size_t step(const Location& loc, uint32_t instance, uint32_t event_id) {
+        uint8_t& state = states_[checkInstance(instance)];
+        size_t index = (static_cast<size_t>(state) << column_shift_) + columnOf(event_id);
+        int32_t entry = table_[index];
+        if ((entry & kSlow) == 0) {
+            state = static_cast<uint8_t>(entry);
+            return (entry & kMatched) ? 1 : 0;
+        }
+        const Action& action = actions_[index];
+        if (action.handler_ >= 0) {
+            handlers_[action.handler_](loc, instance);
+        }
+        if (action.transition_) {
+            size_t from = state;
+            size_t to = static_cast<uint8_t>(entry);
+            if (from != to && from != 0) {
+                runActions(exit_[from]);
+            }
+            state = static_cast<uint8_t>(to);
+            if (from != to && to != 0) {
+                runActions(entry_[to]);
+            }
+        }
+        return 1;
+    }
+
+    static void runActions(const std::vector<StateMachine::Action>& actions) {
+        for (const auto& action : actions) {
+            if (action) {
+                action();
+            }
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+    static bool hasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+        //MSVC 没有 __builtin_cpu_supports，只在编译选项开启 AVX2 时使用
+#if defined(__AVX2__)
+        return true;
+#else
+        return false;
+#endif
+#else
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+#endif
+    }
+
+    /*
+        每次处理 8 个事件：gather 出实例的状态和事件的列号，再 gather 转移表，8 个都不需要逐个处理时一起写回，
+        否则这 8 个逐个处理。返回处理到的位置，不足 8 个的尾部由调用者逐个处理。
+    */
+#if !defined(_MSC_VER) || defined(__clang__)
+    __attribute__((target("avx2")))
+#endif
+    size_t applyAvx2(const Location& loc, const uint32_t* instances, const uint32_t* event_ids, size_t count, size_t& matched) {
+        if (size_ == 0) {
+            return 0; //max_instance 无法表示“没有实例”，全部交给逐个处理抛出异常
+        }
+        const __m256i max_instance = _mm256_set1_epi32(static_cast<int>(size_ == 0 ? 0 : size_ - 1));
+        const __m256i max_event = _mm256_set1_epi32(static_cast<int>(column_of_.size() - 1));
+        const __m256i state_mask = _mm256_set1_epi32(0xFF);
+        const __m128i shift = _mm_cvtsi32_si128(static_cast<int>(column_shift_));
+        const __m256i rotate1 = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+        const __m256i rotate2 = _mm256_setr_epi32(2, 3, 4, 5, 6, 7, 0, 1);
+        const __m256i rotate3 = _mm256_setr_epi32(3, 4, 5, 6, 7, 0, 1, 2);
+        const __m256i rotate4 = _mm256_setr_epi32(4, 5, 6, 7, 0, 1, 2, 3);
+        const int* state_base = reinterpret_cast<const int*>(states_.data());
+        alignas(32) int32_t next[8];
+        alignas(32) uint32_t lanes[8];
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i instance = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(instances + i));
+            __m256i event = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(event_ids + i));
+            //越界的实例交给逐个处理抛出异常
+            __m256i in_range = _mm256_cmpeq_epi32(_mm256_min_epu32(instance, max_instance), instance);
+            //相同实例的事件必须按顺序生效，任意两个通道相同时逐个处理，循环移位 1-4 覆盖所有通道对
+            __m256i conflict = _mm256_cmpeq_epi32(instance, _mm256_permutevar8x32_epi32(instance, rotate1));
+            conflict = _mm256_or_si256(conflict, _mm256_cmpeq_epi32(instance, _mm256_permutevar8x32_epi32(instance, rotate2)));
+            conflict = _mm256_or_si256(conflict, _mm256_cmpeq_epi32(instance, _mm256_permutevar8x32_epi32(instance, rotate3)));
+            conflict = _mm256_or_si256(conflict, _mm256_cmpeq_epi32(instance, _mm256_permutevar8x32_epi32(instance, rotate4)));
+            if (_mm256_movemask_epi8(in_range) != -1 || !_mm256_testz_si256(conflict, conflict)) {
+                matched += stepEach(loc, instances + i, event_ids + i);
+                continue;
+            }
+            __m256i column = _mm256_i32gather_epi32(column_of_.data(), _mm256_min_epu32(event, max_event), 4);
+            __m256i state = _mm256_and_si256(_mm256_i32gather_epi32(state_base, instance, 1), state_mask);
+            __m256i index = _mm256_add_epi32(_mm256_sll_epi32(state, shift), column);
+            __m256i entry = _mm256_i32gather_epi32(table_.data(), index, 4);
+            //kSlow 移到符号位取出
+            if (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(entry, 22))) != 0) {
+                matched += stepEach(loc, instances + i, event_ids + i);
+                continue;
+            }
+            _mm256_store_si256(reinterpret_cast<__m256i*>(next), entry);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), instance);
+            for (int lane = 0; lane < 8; ++lane) {
+                states_[lanes[lane]] = static_cast<uint8_t>(next[lane]);
+                matched += (next[lane] & kMatched) ? 1 : 0;
+            }
+        }
+        return i;
+    }
+
+    size_t stepEach(const Location& loc, const uint32_t* instances, const uint32_t* event_ids) {
+        size_t matched = 0;
+        for (int lane = 0; lane < 8; ++lane) {
+            matched += step(loc, instances[lane], event_ids[lane]);
+        }
+        return matched;
+    }
+#endif
+
+    std::vector<std::string> state_ids_;          //按状态序号
+    std::vector<int32_t> column_of_;              //事件ID到列号
+    uint32_t column_shift_ = 0;                   //每个状态的列数为 2 的 column_shift_ 次方
+    std::vector<int32_t> table_;                  //转移表，下标为 (状态 << column_shift_) + 列号
+    std::vector<Action> actions_;                 //与转移表对应
+    std::vector<Handler> handlers_;
+    std::vector<std::vector<StateMachine::Action>> entry_;
+    std::vector<std::vector<StateMachine::Action>> exit_;
+    std::vector<uint8_t> states_;                 //实例状态
+    size_t size_ = 0;
+    uint64_t unmatched_ = 0;
+};
+
+}//end namespace helper
@@ -0,0 +1,81 @@
+#pragma once
+#include <any>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace helper {
+
+/*
+    事件合并：按事件ID设置合并策略，队列中每个事件ID和合并键只登记一个可以被合并的待处理任务，
+    之后的同键任务把参数替换到它里面，不再排队。Task 需要有 coalesced_、event_id_ 和 coalesce_key_ 成员。
+*/
+template<typename Task>
+class Coalescer {
+  public:
+    using TaskPtr = std::shared_ptr<Task>;
+
+    explicit Coalescer(const std::pmr::polymorphic_allocator<std::byte>& alloc) :pending_(alloc) {}
+
+    //key 为合并键函数，为空时同一事件ID的任务都合并，在启动之前调用
+    void SetPolicy(uint32_t event_id, std::any key) {
+        policies_[event_id] = std::move(key);
+    }
+
+    //事件ID的合并键函数，没有设置合并策略时返回 nullptr
+    const std::any* FindPolicy(uint32_t event_id) const {
+        if (policies_.empty()) {
+            return nullptr;
+        }
+        auto policy = policies_.find(event_id);
+        return policy == policies_.end() ? nullptr : &policy->second;
+    }
+
+    /*
+        有同键且 mergeable 的待处理任务时调用 merge(pending, task) 把新任务合并进去，返回 true；
+        否则把新任务登记为待处理任务（替换不能再合并的旧任务），返回 false
+    */
+    template<typename Mergeable, typename MergeInto>
+    bool Merge(const TaskPtr& task, Mergeable&& mergeable, MergeInto&& merge) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        auto& pending = pending_[{ task->event_id_, task->coalesce_key_ }];
+        if (!pending || !mergeable(*pending)) {
+            pending = task;
+            return false;
+        }
+        merge(*pending, *task);
+        merged_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    //任务出队、取消、过期或停止时丢弃后不再接受合并
+    void Release(const Task& task) {
+        if (!task.coalesced_) {
+            return;
+        }
+        std::unique_lock<std::mutex> lck(mtx_);
+        auto pending = pending_.find({ task.event_id_, task.coalesce_key_ });
+        if (pending != pending_.end() && pending->second.get() == &task) {
+            pending_.erase(pending);
+        }
+    }
+
+    //被合并的任务数量，可以在任意线程读取
+    uint64_t GetMergedCount() const {
+        return merged_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::unordered_map<uint32_t, std::any> policies_; //事件ID到合并键函数，启动后不再变化
+    std::mutex mtx_;
+    std::pmr::map<std::pair<uint32_t, uint64_t>, TaskPtr> pending_; //队列中可以被合并的任务
+    std::atomic<uint64_t> merged_{ 0 };
+};
+
+}//end namespace helper
@@ -0,0 +1,293 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#if defined(__LINUX__) || defined(__ANDROID__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#elif defined(WIN32)
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+#include "thread_helper.h"
+
+namespace helper {
+
+/*
+    一次性完成槽：一个生产者写入一次结果（值、异常或没有匹配），一个消费者等待并取出。
+    状态、结果和异常都放在槽内，不另外分配共享状态；消费者先自旋一小段时间，
+    结果还没有到达时在状态字上等待（Linux 为 futex），生产者只在消费者等待时才唤醒。
+*/
+template<typename T>
+class OneShot {
+  public:
+    OneShot() = default;
+    OneShot(const OneShot&) = delete;
+    OneShot& operator=(const OneShot&) = delete;
+
+    template<typename U>
+    void SetValue(U&& value) {
+        value_.emplace(std::forward<U>(value));
+        publish(kValue);
+    }
+
+    void SetException(std::exception_ptr error) {
+        error_ = error;
+        publish(kException);
+    }
+
+    //请求没有匹配的处理函数，Get 返回默认构造的值
+    void SetUnmatched() {
+        publish(kUnmatched);
+    }
+
+    bool Ready() const {
+        return (state_.load(std::memory_order_acquire) & kResultMask) != kEmpty;
+    }
+
+    //结果到达后有效
+    bool IsUnmatched() const {
+        return (state_.load(std::memory_order_acquire) & kResultMask) == kUnmatched;
+    }
+
+    void Wait() {
+        while (!waitUntil(nullptr)) {
+        }
+    }
+
+    //超时返回 false
+    bool WaitFor(std::chrono::nanoseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        return waitUntil(&deadline);
+    }
+
+    /*
+        结果到达时在生产者线程调用 continuation，代替等待；结果已经到达时返回 false，不会调用。
+        与 Wait 只能二选一，只能设置一次。
+    */
+    bool SetContinuation(std::function<void()> continuation) {
+        continuation_ = std::move(continuation);
+        uint32_t expected = state_.load(std::memory_order_acquire);
+        while ((expected & kResultMask) == kEmpty) {
+            if (state_.compare_exchange_weak(expected, expected | kContinuation, std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+        continuation_ = nullptr;
+        return false;
+    }
+
+    //等待并取出结果，只能调用一次；异常结果重新抛出
+    T Get() {
+        Wait();
+        if ((state_.load(std::memory_order_acquire) & kResultMask) == kException) {
+            std::exception_ptr error = std::move(error_); //异常对象只由调用者持有，不在生产者线程随任务记录释放
+            std::rethrow_exception(error);
+        }
+        if (!value_) {
+            return T();
+        }
+        return std::move(*value_);
+    }
+
+  private:
+    enum : uint32_t { kEmpty = 0, kValue = 1, kException = 2, kUnmatched = 3, kResultMask = 3, kWaiting = 4, kContinuation = 8 };
+    static constexpr int kSpinCount = 1000;
+
+    void publish(uint32_t result) {
+        uint32_t prev = state_.exchange(result, std::memory_order_acq_rel);
+        if ((prev & kResultMask) != kEmpty) {
+            throw std::logic_error("OneShot result set twice.");
+        }
+        if (prev & kWaiting) {
+            wake();
+        }
+        if (prev & kContinuation) {
+            auto continuation = std::move(continuation_);
+            continuation();
+        }
+    }
+
+    bool waitUntil(const std::chrono::steady_clock::time_point* deadline) {
+        //单核时自旋只会占用生产者需要的时间片
+        static const int spin_count = std::thread::hardware_concurrency() > 1 ? kSpinCount : 0;
+        for (int i = 0; i < spin_count; ++i) {
+            if (Ready()) {
+                return true;
+            }
+            CpuRelax();
+        }
+        uint32_t expected = kEmpty;
+        if (!state_.compare_exchange_strong(expected, kWaiting, std::memory_order_acq_rel)
+            && (expected & kResultMask) != kEmpty) {
+            return true;
+        }
+        while (!Ready()) {
+            std::chrono::nanoseconds remain = std::chrono::nanoseconds::max();
+            if (deadline) {
+                remain = *deadline - std::chrono::steady_clock::now();
+                if (remain.count() <= 0) {
+                    return false;
+                }
+            }
+            sleep(remain);
+        }
+        return true;
+    }
+
+#if defined(__LINUX__) || defined(__ANDROID__)
+    void sleep(std::chrono::nanoseconds remain) {
+        struct timespec timeout;
+        struct timespec* ptimeout = nullptr;
+        if (remain != std::chrono::nanoseconds::max()) {
+            timeout.tv_sec = static_cast<time_t>(remain.count() / 1000000000);
+            timeout.tv_nsec = static_cast<long>(remain.count() % 1000000000);
+            ptimeout = &timeout;
+        }
+        syscall(SYS_futex, &state_, FUTEX_WAIT_PRIVATE, kWaiting, ptimeout, nullptr, 0);
+    }
+
+    void wake() {
+        syscall(SYS_futex, &state_, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+#elif defined(WIN32)
+    void sleep(std::chrono::nanoseconds remain) {
+        uint32_t waiting = kWaiting;
+        DWORD ms = remain == std::chrono::nanoseconds::max() ? INFINITE
+            : static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(remain).count() + 1);
+        WaitOnAddress(&state_, &waiting, sizeof(waiting), ms);
+    }
+
+    void wake() {
+        WakeByAddressAll(&state_);
+    }
+#else
+    void sleep(std::chrono::nanoseconds remain) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (Ready()) {
+            return;
+        }
+        if (remain == std::chrono::nanoseconds::max()) {
+            cv_.wait(lck);
+        }
+        else {
+            cv_.wait_for(lck, remain);
+        }
+    }
+
+    void wake() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        cv_.notify_all();
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+#endif
+
+    std::atomic<uint32_t> state_{ kEmpty }; //低两位是结果，kWaiting 表示消费者可能在等待，kContinuation 表示设置了回调
+    std::optional<T> value_;
+    std::exception_ptr error_;
+    std::function<void()> continuation_;
+};
+
+template<>
+class OneShot<void> {
+  public:
+    void SetValue() {
+        slot_.SetValue(true);
+    }
+    void SetException(std::exception_ptr error) {
+        slot_.SetException(error);
+    }
+    void SetUnmatched() {
+        slot_.SetUnmatched();
+    }
+    bool Ready() const {
+        return slot_.Ready();
+    }
+    bool IsUnmatched() const {
+        return slot_.IsUnmatched();
+    }
+    void Wait() {
+        slot_.Wait();
+    }
+    bool WaitFor(std::chrono::nanoseconds timeout) {
+        return slot_.WaitFor(timeout);
+    }
+    bool SetContinuation(std::function<void()> continuation) {
+        return slot_.SetContinuation(std::move(continuation));
+    }
+    void Get() {
+        slot_.Get();
+    }
+
+  private:
+    OneShot<bool> slot_;
+};
+
+/*
+    异步请求的结果句柄，槽嵌在任务记录中，句柄持有任务记录。
+    不能在处理该请求的状态机的 worker 线程中等待。
+*/
+template<typename T>
+class Completion {
+  public:
+    Completion() = default;
+    explicit Completion(std::shared_ptr<OneShot<T>> slot) :slot_(std::move(slot)) {}
+
+    bool Valid() const {
+        return slot_ != nullptr;
+    }
+
+    bool Ready() const {
+        return slot_->Ready();
+    }
+
+    bool IsUnmatched() const {
+        return slot_->IsUnmatched();
+    }
+
+    void Wait() const {
+        slot_->Wait();
+    }
+
+    bool WaitFor(std::chrono::nanoseconds timeout) const {
+        return slot_->WaitFor(timeout);
+    }
+
+    //结果到达时在生产者线程调用 continuation，结果已经到达时返回 false
+    bool OnReady(std::function<void()> continuation) const {
+        return slot_->SetContinuation(std::move(continuation));
+    }
+
+    //只能调用一次
+    T Get() {
+        auto slot = std::move(slot_);
+        return slot->Get();
+    }
+
+  private:
+    std::shared_ptr<OneShot<T>> slot_;
+};
+
+//由其他线程或后端完成的结果：生产者持有 OneShot，消费者持有 Completion
+template<typename T>
+std::pair<std::shared_ptr<OneShot<T>>, Completion<T>> MakeCompletion() {
+    auto slot = std::make_shared<OneShot<T>>();
+    return { slot, Completion<T>(slot) };
+}
+
+}//end namespace helper
@@ -0,0 +1,201 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace helper {
+
+/*
+    发出的请求的关联表：按关联ID查找等待响应的请求，开放寻址（线性探测），删除时把后面的元素前移，不留墓碑。
+    超时时间放在最小堆中，已经完成的请求留在堆中，到堆顶时跳过；堆中的无效项过多时重建。
+    关联ID由表分配：高 24 位是表的标记（进程启动时随机，之后每个表加一），低 40 位从 1 开始递增。
+    同一个表中不会重复；不同的表（不同的状态机、重启后的进程）的ID通常不同，响应投递到错误的状态机时找不到等待的请求，
+    而不会被当作那个状态机的请求完成。只在一个线程中使用。
+*/
+template<typename Value>
+class CorrelationTable {
+  public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    explicit CorrelationTable(size_t capacity = 16) {
+        size_t size = 8;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        resize(size);
+    }
+
+    //登记一个等待响应的请求，返回关联ID
+    uint64_t Insert(Value value, TimePoint deadline) {
+        if ((size_ + 1) * 4 > slots_.size() * 3) {
+            resize(slots_.size() * 2);
+        }
+        uint64_t id = next_id_++;
+        place(Slot{ id, deadline, std::move(value) });
+        ++size_;
+        if (deadline != TimePoint::max()) {
+            deadlines_.push_back({ deadline, id });
+            std::push_heap(deadlines_.begin(), deadlines_.end(), Later());
+        }
+        return id;
+    }
+
+    //等待中的请求，已经完成、超时或不存在时返回 nullptr
+    Value* Find(uint64_t id) {
+        size_t index = find(id);
+        return index == kNone ? nullptr : &slots_[index].value_;
+    }
+
+    //取出等待中的请求，不存在时返回 false
+    bool Take(uint64_t id, Value& value) {
+        size_t index = find(id);
+        if (index == kNone) {
+            return false;
+        }
+        value = std::move(slots_[index].value_);
+        erase(index);
+        return true;
+    }
+
+    //最早的超时时间，没有会超时的请求时返回 time_point::max()
+    TimePoint NextDeadline() {
+        skipDone();
+        return deadlines_.empty() ? TimePoint::max() : deadlines_.front().first;
+    }
+
+    //取出一个在 now 之前超时的请求，没有时返回 false
+    bool TakeExpired(TimePoint now, uint64_t& id, Value& value) {
+        skipDone();
+        if (deadlines_.empty() || deadlines_.front().first > now) {
+            return false;
+        }
+        id = deadlines_.front().second;
+        std::pop_heap(deadlines_.begin(), deadlines_.end(), Later());
+        deadlines_.pop_back();
+        return Take(id, value);
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    //丢弃所有等待中的请求，关联ID继续递增
+    void Clear() {
+        for (auto& slot : slots_) {
+            slot = Slot();
+        }
+        size_ = 0;
+        deadlines_.clear();
+    }
+
+  private:
+    struct Slot {
+        uint64_t id_ = 0; //0 表示空位
+        TimePoint deadline_;
+        Value value_;
+    };
+
+    struct Later {
+        bool operator()(const std::pair<TimePoint, uint64_t>& a, const std::pair<TimePoint, uint64_t>& b) const {
+            return a.first > b.first;
+        }
+    };
+
+    static constexpr size_t kNone = SIZE_MAX;
+
+    //斐波那契散列，连续的ID分散到不同的位置
+    size_t homeOf(uint64_t id) const {
+        return static_cast<size_t>((id * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    size_t find(uint64_t id) const {
+        if (id == 0) {
+            return kNone;
+        }
+        size_t mask = slots_.size() - 1;
+        for (size_t index = homeOf(id); slots_[index].id_ != 0; index = (index + 1) & mask) {
+            if (slots_[index].id_ == id) {
+                return index;
+            }
+        }
+        return kNone;
+    }
+
+    void place(Slot&& slot) {
+        size_t mask = slots_.size() - 1;
+        size_t index = homeOf(slot.id_);
+        while (slots_[index].id_ != 0) {
+            index = (index + 1) & mask;
+        }
+        slots_[index] = std::move(slot);
+    }
+
+    //删除后把同一探测序列中后面的元素前移到空位，保证查找遇到空位即可停止
+    void erase(size_t hole) {
+        size_t mask = slots_.size() - 1;
+        for (size_t next = (hole + 1) & mask; slots_[next].id_ != 0; next = (next + 1) & mask) {
+            size_t home = homeOf(slots_[next].id_);
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                slots_[hole] = std::move(slots_[next]);
+                hole = next;
+            }
+        }
+        slots_[hole] = Slot();
+        --size_;
+    }
+
+    void resize(size_t size) {
+        std::vector<Slot> slots(size);
+        slots.swap(slots_);
+        shift_ = 64;
+        for (size_t s = size; s > 1; s >>= 1) {
+            --shift_;
+        }
+        for (auto& slot : slots) {
+            if (slot.id_ != 0) {
+                place(std::move(slot));
+            }
+        }
+    }
+
+    //弹出堆顶已经完成的项；无效项超过有效项很多时按表中的请求重建堆
+    void skipDone() {
+        if (deadlines_.size() > size_ * 2 + 64) {
+            deadlines_.clear();
+            for (auto& slot : slots_) {
+                if (slot.id_ != 0 && slot.deadline_ != TimePoint::max()) {
+                    deadlines_.push_back({ slot.deadline_, slot.id_ });
+                }
+            }
+            std::make_heap(deadlines_.begin(), deadlines_.end(), Later());
+        }
+        while (!deadlines_.empty() && find(deadlines_.front().second) == kNone) {
+            std::pop_heap(deadlines_.begin(), deadlines_.end(), Later());
+            deadlines_.pop_back();
+        }
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<std::pair<TimePoint, uint64_t>> deadlines_; //最小堆
+    size_t size_ = 0;
+    unsigned shift_ = 64;
+    uint64_t next_id_ = (nextTag() << kTagShift) | 1;
+
+    static constexpr unsigned kTagShift = 40;
+
+    static uint64_t nextTag() {
+        static std::atomic<uint64_t> next{ std::random_device()() };
+        return next.fetch_add(1, std::memory_order_relaxed) & ((1ull << (64 - kTagShift)) - 1);
+    }
+};
+
+}//end namespace helper
@@ -37,5 +37,29 @@ namespace helper {
     std::mutex mtx_;
     std::condition_variable cv_;
   };
+
+  // 计数归零时唤醒等待者，用于等待一组任务全部完成
+  class CountDownLatch {
+  public:
+    explicit CountDownLatch(size_t count) :count_(count) {}
+    ~CountDownLatch() {}
+
+    void CountDown() {
+      std::unique_lock<std::mutex> locker(mtx_);
+      if (count_ > 0 && --count_ == 0) {
+        cv_.notify_all();
+      }
+    }
+
+    void Wait() {
+      std::unique_lock<std::mutex> locker(mtx_);
+      cv_.wait(locker, [this]() { return count_ == 0; });
+    }
+
+  private:
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    size_t count_;
+  };
 }//end namespace helper
 
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <cstdint>
+
+namespace helper {
+
+// 任务签名驻留表：把签名字符串映射为进程内唯一的整数ID，ID从1开始，0表示无效。
+// 驻留后的字符串地址在进程生命周期内不变，可以长期引用。
+class EventIdRegistry {
+  public:
+    static constexpr uint32_t kInvalidId = 0;
+
+    static uint32_t Intern(const std::string& signature) {
+        auto& registry = Instance();
+        {
+            std::shared_lock<std::shared_mutex> lck(registry.m_mtx);
+            auto it = registry.m_ids.find(signature);
+            if (it != registry.m_ids.end()) {
+                return it->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lck(registry.m_mtx);
+        auto it = registry.m_ids.find(signature);
+        if (it != registry.m_ids.end()) {
+            return it->second;
+        }
+        registry.m_names.push_back(signature);
+        uint32_t id = static_cast<uint32_t>(registry.m_names.size());
+        registry.m_ids.emplace(signature, id);
+        return id;
+    }
+
+    static const std::string& Name(uint32_t id) {
+        auto& registry = Instance();
+        std::shared_lock<std::shared_mutex> lck(registry.m_mtx);
+        if (id == kInvalidId || id > registry.m_names.size()) {
+            return registry.m_empty;
+        }
+        return registry.m_names[id - 1];
+    }
+
+    static size_t Size() {
+        auto& registry = Instance();
+        std::shared_lock<std::shared_mutex> lck(registry.m_mtx);
+        return registry.m_names.size();
+    }
+
+  private:
+    EventIdRegistry() = default;
+    static EventIdRegistry& Instance() {
+        static EventIdRegistry registry;
+        return registry;
+    }
+
+    std::shared_mutex m_mtx;
+    std::unordered_map<std::string, uint32_t> m_ids;
+    std::deque<std::string> m_names; //deque 追加元素不移动已有元素，名字的引用一直有效
+    const std::string m_empty;
+};
+
+}//end namespace helper
@@ -0,0 +1,161 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "thread_helper.h"
+
+namespace helper {
+
+//休眠统计
+struct HibernationStats {
+    bool hibernating_ = false;
+    uint64_t hibernations_ = 0;       //进入休眠的次数
+    uint64_t wakeups_ = 0;            //被任务唤醒的次数
+    size_t stack_reserved_bytes_ = 0; //最近一次休眠退出的线程的栈预留地址空间，不是释放的内存
+    size_t buffer_bytes_ = 0;         //最近一次休眠收缩的队列存储，估计值
+};
+
+/*
+    可以休眠的 worker 线程：空闲的 worker 线程调用 Enter 后直接退出，放入任务的线程调用 Wake 重新创建它。
+    线程对象只在内部的锁内访问，休眠后生产者线程会在 Wake 中替换它。
+*/
+class HibernatingWorker {
+  public:
+    //worker 线程记录空闲开始的时间
+    class IdleTimer {
+      public:
+        void MarkBusy() {
+            busy_ = true;
+        }
+
+        //等待超时时调用，上次超时以来没有处理过任务且空闲超过 idle 时返回 true
+        bool Elapsed(std::chrono::milliseconds idle) {
+            auto now = std::chrono::steady_clock::now();
+            if (busy_) {
+                since_ = now;
+                busy_ = false;
+                return false;
+            }
+            return now - since_ >= idle;
+        }
+
+      private:
+        bool busy_ = false; //上次等待超时以来处理过任务
+        std::chrono::steady_clock::time_point since_ = std::chrono::steady_clock::now();
+    };
+
+    //0 表示不休眠，在启动之前调用
+    void SetIdle(std::chrono::milliseconds idle) {
+        idle_ = idle;
+    }
+
+    std::chrono::milliseconds Idle() const {
+        return idle_;
+    }
+
+    bool Enabled() const {
+        return idle_.count() > 0;
+    }
+
+    template<typename F>
+    void Start(F&& run) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        thread_ = std::thread(std::forward<F>(run));
+    }
+
+    bool Started() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        return thread_.joinable();
+    }
+
+    /*
+        在 worker 线程调用，has_data 在公开休眠后再检查一次队列，与 Wake 中先放入任务再检查休眠配对。
+        没有任务时用 shrink 收缩队列的存储并返回 true，之后 worker 线程直接退出，放入任务的线程负责唤醒。
+    */
+    template<typename HasData, typename Shrink>
+    bool Enter(HasData&& has_data, Shrink&& shrink) {
+        size_t stack_reserved = CurrentThreadStackSize();
+        std::unique_lock<std::mutex> lck(mtx_);
+        hibernating_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (has_data()) {
+            hibernating_.store(false, std::memory_order_relaxed);
+            return false;
+        }
+        ++hibernations_;
+        stack_reserved_ = stack_reserved;
+        buffer_bytes_ = shrink();
+        return true;
+    }
+
+    //任务放入队列后调用，休眠时回收退出的线程，再用 restart 创建新的 worker 线程
+    template<typename F>
+    void Wake(F&& restart) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!hibernating_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (!hibernating_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        thread_.join(); //休眠的线程已经退出或正在退出
+        hibernating_.store(false, std::memory_order_relaxed);
+        ++wakeups_;
+        thread_ = restart();
+    }
+
+    //停止休眠中的 worker：线程已经退出，只需要回收，然后在锁内调用 on_stop；不是休眠状态时返回 false
+    template<typename F>
+    bool StopHibernated(F&& on_stop) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (!hibernating_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        hibernating_.store(false, std::memory_order_relaxed);
+        thread_.join();
+        on_stop();
+        return true;
+    }
+
+    /*
+        停止时取出线程由调用者等待，之后不再唤醒：停止信号之后才休眠的线程已经退出，join 直接返回。
+        在 worker 线程自己调用时不能等待，分离线程后返回空的线程对象。
+    */
+    std::thread Take() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (thread_.get_id() == std::this_thread::get_id()) {
+            thread_.detach();
+            return std::thread();
+        }
+        hibernating_.store(false, std::memory_order_relaxed);
+        return std::move(thread_);
+    }
+
+    //可以在任意线程读取
+    HibernationStats GetStats() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        HibernationStats stats;
+        stats.hibernating_ = hibernating_.load(std::memory_order_relaxed);
+        stats.hibernations_ = hibernations_;
+        stats.wakeups_ = wakeups_;
+        stats.stack_reserved_bytes_ = stack_reserved_;
+        stats.buffer_bytes_ = buffer_bytes_;
+        return stats;
+    }
+
+  private:
+    std::chrono::milliseconds idle_{ 0 };
+    std::mutex mtx_;
+    std::thread thread_;
+    std::atomic<bool> hibernating_{ false }; //worker 线程已经退出，等待任务唤醒
+    uint64_t hibernations_ = 0; //以下在 mtx_ 内访问
+    uint64_t wakeups_ = 0;
+    size_t stack_reserved_ = 0;
+    size_t buffer_bytes_ = 0;
+};
+
+}//end namespace helper
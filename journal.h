@@ -0,0 +1,388 @@
+#pragma once
+#if defined(__LINUX__) || defined(__ANDROID__)
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "thread_helper.h"
+
+namespace helper {
+
+/*
+    预写日志：多个状态机共享一个日志文件和一个写线程，每个状态机用自己的流编号。
+    追加的记录先放在内存缓冲区，写线程把一个提交窗口内所有状态机的记录一次写入，只调用一次 fdatasync，
+    然后在写线程回调每条记录的提交结果。任务处理完后追加"已应用"标记，标记不单独同步，随下一次提交写入。
+    打开时读出还没有应用的记录，由状态机启动时重新处理；文件末尾写了一半的记录被截掉。
+    标记没有落盘时崩溃，对应的任务会再处理一次（至少一次）。所有记录都已应用且文件超过 compact_bytes 时清空文件。
+    写入或同步失败时截掉这次写入的部分，之后的记录接在已经落盘的记录后面；截断也失败时日志不再接受追加。
+*/
+class Journal {
+  public:
+    struct Record {
+        uint64_t lsn_ = 0; //日志序号，从 1 开始递增
+        uint32_t stream_ = 0;
+        uint16_t type_ = 0;
+        uint32_t wire_id_ = 0;
+        std::string payload_;
+    };
+
+    //提交后在写线程调用，error 为空表示已经落盘
+    using OnCommit = std::function<void(uint64_t lsn, std::exception_ptr error)>;
+
+    static std::shared_ptr<Journal> Open(const std::string& path, std::chrono::microseconds window = std::chrono::microseconds(0),
+                                         size_t compact_bytes = 64 << 20) {
+        return std::shared_ptr<Journal>(new Journal(path, window, compact_bytes));
+    }
+
+    ~Journal() {
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        writer_.join();
+        ::close(fd_);
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    //一个流只能被一个状态机使用
+    void AttachStream(uint32_t stream) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (!streams_.insert(stream).second) {
+            throw std::logic_error("Journal stream " + std::to_string(stream) + " is already attached.");
+        }
+    }
+
+    void DetachStream(uint32_t stream) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        streams_.erase(stream);
+    }
+
+    //追加一条记录，提交后在写线程调用 on_commit
+    void Append(uint32_t stream, uint16_t type, uint32_t wire_id, const void* data, size_t size, OnCommit on_commit) {
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            if (failed_) {
+                throw std::runtime_error("Journal failed: a failed write could not be rolled back.");
+            }
+            uint64_t lsn = next_lsn_++;
+            size_t body = kAppendBody + size;
+            size_t offset = beginRecord(body, kAppend, lsn, stream);
+            putValue(offset, type);
+            putValue(offset, wire_id);
+            std::memcpy(&buffer_[offset], data, size);
+            endRecord(body);
+            committing_.push_back({ lsn, std::move(on_commit) });
+            ++unapplied_;
+        }
+        cv_.notify_one();
+    }
+
+    //记录对应的任务已经处理，不等待提交
+    void MarkApplied(uint32_t stream, uint64_t lsn) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (failed_) {
+            return;
+        }
+        beginRecord(kMarkerBody, kApplied, lsn, stream);
+        endRecord(kMarkerBody);
+        if (unapplied_ > 0) {
+            --unapplied_;
+        }
+    }
+
+    //打开日志时读到的还没有应用的记录，按 LSN 排序，只能取一次
+    std::vector<Record> TakeRecovered(uint32_t stream) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        auto recovered = recovered_.find(stream);
+        if (recovered == recovered_.end()) {
+            return {};
+        }
+        auto records = std::move(recovered->second);
+        recovered_.erase(recovered);
+        return records;
+    }
+
+    //等待调用前追加的记录都已提交并完成回调，不能在写线程调用
+    void Sync() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        uint64_t target = next_lsn_ - 1;
+        cv_.notify_one();
+        synced_cv_.wait(lck, [this, target]() { return committed_lsn_ >= target; });
+    }
+
+    //fdatasync 的次数
+    uint64_t GetCommitCount() const {
+        std::unique_lock<std::mutex> lck(mtx_);
+        return commit_count_;
+    }
+
+    //已追加（包括打开时恢复的）但还没有应用的记录数
+    uint64_t GetUnappliedCount() const {
+        std::unique_lock<std::mutex> lck(mtx_);
+        return unapplied_;
+    }
+
+  private:
+    enum : uint8_t { kAppend = 1, kApplied = 2 };
+    //记录：长度（4 字节）、校验（4 字节）、记录体；记录体：类型、LSN、流编号，追加记录还有消息类型、事件编号和负载
+    static constexpr size_t kHeader = 8;
+    static constexpr size_t kMarkerBody = 1 + 8 + 4;
+    static constexpr size_t kAppendBody = kMarkerBody + 2 + 4;
+    static constexpr auto kMarkerFlush = std::chrono::milliseconds(10); //只有标记时写入（不同步）的间隔
+
+    struct Committing {
+        uint64_t lsn_;
+        OnCommit on_commit_;
+    };
+
+    Journal(const std::string& path, std::chrono::microseconds window, size_t compact_bytes)
+        :window_(window), compact_bytes_(compact_bytes) {
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (fd_ < 0) {
+            throwError("open");
+        }
+        try {
+            recover();
+        }
+        catch (...) {
+            ::close(fd_);
+            throw;
+        }
+        writer_ = std::thread(&Journal::run, this);
+    }
+
+    [[noreturn]] static void throwError(const char* what) {
+        throw std::runtime_error(std::string("Journal ") + what + " failed: " + std::strerror(errno));
+    }
+
+    static uint32_t crc32(const char* data, size_t size) {
+        static const auto table = []() {
+            std::vector<uint32_t> table(256);
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                table[i] = c;
+            }
+            return table;
+        }();
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; ++i) {
+            crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    template<typename T>
+    void putValue(size_t& offset, T value) {
+        std::memcpy(&buffer_[offset], &value, sizeof(value));
+        offset += sizeof(value);
+    }
+
+    template<typename T>
+    static T getValue(const char*& data) {
+        T value;
+        std::memcpy(&value, data, sizeof(value));
+        data += sizeof(value);
+        return value;
+    }
+
+    //在缓冲区末尾预留一条记录，写入记录体的公共部分，返回之后的写入位置
+    size_t beginRecord(size_t body, uint8_t kind, uint64_t lsn, uint32_t stream) {
+        record_start_ = buffer_.size();
+        buffer_.resize(record_start_ + kHeader + body);
+        size_t offset = record_start_ + kHeader;
+        putValue(offset, kind);
+        putValue(offset, lsn);
+        putValue(offset, stream);
+        return offset;
+    }
+
+    void endRecord(size_t body) {
+        size_t offset = record_start_;
+        putValue(offset, static_cast<uint32_t>(body));
+        putValue(offset, crc32(&buffer_[record_start_ + kHeader], body));
+    }
+
+    //读出文件中的记录，截掉末尾不完整或校验失败的部分
+    void recover() {
+        std::string content;
+        char chunk[65536];
+        while (true) {
+            ssize_t n = ::pread(fd_, chunk, sizeof(chunk), static_cast<off_t>(content.size()));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throwError("read");
+            }
+            if (n == 0) {
+                break;
+            }
+            content.append(chunk, static_cast<size_t>(n));
+        }
+        std::map<uint64_t, Record> pending;
+        uint64_t max_lsn = 0;
+        size_t offset = 0;
+        while (content.size() - offset >= kHeader) {
+            const char* header = content.data() + offset;
+            uint32_t body = getValue<uint32_t>(header);
+            uint32_t crc = getValue<uint32_t>(header);
+            if (body < kMarkerBody || content.size() - offset - kHeader < body || crc32(header, body) != crc) {
+                break;
+            }
+            const char* data = header;
+            uint8_t kind = getValue<uint8_t>(data);
+            uint64_t lsn = getValue<uint64_t>(data);
+            uint32_t stream = getValue<uint32_t>(data);
+            if (kind == kAppend && body >= kAppendBody) {
+                Record record;
+                record.lsn_ = lsn;
+                record.stream_ = stream;
+                record.type_ = getValue<uint16_t>(data);
+                record.wire_id_ = getValue<uint32_t>(data);
+                record.payload_.assign(data, body - kAppendBody);
+                pending[lsn] = std::move(record);
+            }
+            else if (kind == kApplied) {
+                pending.erase(lsn);
+            }
+            max_lsn = std::max(max_lsn, lsn);
+            offset += kHeader + body;
+        }
+        if (offset != content.size()) {
+            if (::ftruncate(fd_, static_cast<off_t>(offset)) != 0 || ::fdatasync(fd_) != 0) {
+                throwError("truncate");
+            }
+        }
+        for (auto& record : pending) {
+            recovered_[record.second.stream_].push_back(std::move(record.second));
+        }
+        unapplied_ = pending.size();
+        next_lsn_ = max_lsn + 1;
+        committed_lsn_ = max_lsn;
+        file_bytes_ = offset;
+    }
+
+    //写线程：一个提交窗口内追加的记录一次写入并同步；只有标记时定期写入，不同步
+    void run() {
+        SetCurrentThreadName("journal");
+        std::unique_lock<std::mutex> lck(mtx_);
+        while (true) {
+            cv_.wait_for(lck, kMarkerFlush, [this]() { return stop_ || !committing_.empty(); });
+            if (window_.count() > 0 && !stop_ && !committing_.empty()) {
+                cv_.wait_for(lck, window_, [this]() { return stop_; }); //等待更多记录加入这次提交
+            }
+            if (buffer_.empty()) {
+                if (stop_) {
+                    break;
+                }
+                continue;
+            }
+            std::string buffer;
+            buffer.swap(buffer_);
+            std::vector<Committing> committing;
+            committing.swap(committing_);
+            bool failed = failed_;
+            lck.unlock();
+
+            //文件末尾有写了一半的记录时，之后写入的记录恢复时读不到，不再写入
+            std::exception_ptr error = failed
+                ? std::make_exception_ptr(std::runtime_error("Journal failed: a failed write could not be rolled back."))
+                : write(buffer, !committing.empty());
+            //file_bytes_ 只在写线程修改，是已经完整写入的长度
+            bool rolled_back = error && !failed && ::ftruncate(fd_, static_cast<off_t>(file_bytes_)) == 0;
+            for (auto& commit : committing) {
+                commit.on_commit_(commit.lsn_, error);
+            }
+
+            lck.lock();
+            if (!error) {
+                file_bytes_ += buffer.size();
+            }
+            else {
+                //没有提交的追加记录不会被应用；丢失的标记对应的任务重启后再处理一次
+                unapplied_ -= std::min<uint64_t>(unapplied_, committing.size());
+                failed_ = failed_ || !rolled_back;
+            }
+            if (!committing.empty()) {
+                ++commit_count_;
+                committed_lsn_ = std::max(committed_lsn_, committing.back().lsn_);
+                synced_cv_.notify_all();
+            }
+            compact();
+        }
+    }
+
+    std::exception_ptr write(const std::string& buffer, bool sync) {
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t n = ::write(fd_, buffer.data() + written, buffer.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return std::make_exception_ptr(std::runtime_error(std::string("Journal write failed: ") + std::strerror(errno)));
+            }
+            written += static_cast<size_t>(n);
+        }
+        if (sync && ::fdatasync(fd_) != 0) {
+            return std::make_exception_ptr(std::runtime_error(std::string("Journal fdatasync failed: ") + std::strerror(errno)));
+        }
+        return nullptr;
+    }
+
+    //所有记录都已应用且没有待写入的数据时清空文件，持有锁调用
+    void compact() {
+        if (failed_ || compact_bytes_ == 0 || file_bytes_ < compact_bytes_ || unapplied_ != 0 || !buffer_.empty()) {
+            return;
+        }
+        if (::ftruncate(fd_, 0) == 0) {
+            file_bytes_ = 0;
+            ::fdatasync(fd_);
+        }
+    }
+
+    int fd_ = -1;
+    std::chrono::microseconds window_;
+    size_t compact_bytes_;
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable synced_cv_;
+    bool stop_ = false;
+    bool failed_ = false; //写入失败后没能截断，文件末尾可能有写了一半的记录
+    std::string buffer_; //等待写入的记录
+    size_t record_start_ = 0;
+    std::vector<Committing> committing_; //等待提交的追加记录
+    std::set<uint32_t> streams_;
+    std::unordered_map<uint32_t, std::vector<Record>> recovered_;
+    uint64_t next_lsn_ = 1;
+    uint64_t committed_lsn_ = 0;
+    uint64_t commit_count_ = 0;
+    uint64_t unapplied_ = 0;
+    size_t file_bytes_ = 0;
+    std::thread writer_;
+};
+
+}//end namespace helper
+#endif
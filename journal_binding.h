@@ -0,0 +1,222 @@
+#pragma once
+#include <any>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include "journal.h"
+
+namespace helper {
+
+/*
+    日志写线程投递的任务在队列满时放入的溢出列表，worker 线程把它作为一个来源取走。
+*/
+template<typename TaskPtr>
+class CommittedOverflow {
+  public:
+    //在日志写线程调用：列表为空时先用 put 放入队列，put 抛出异常（队列满）或列表不为空（保持日志事件的顺序）时放入列表，
+    //放入列表时返回 false
+    template<typename Put>
+    bool Offer(const TaskPtr& task, Put&& put) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (overflow_.empty()) {
+            try {
+                put(task);
+                return true;
+            }
+            catch (const std::exception&) {
+            }
+        }
+        overflow_.push_back(task);
+        pending_.store(true, std::memory_order_release);
+        return false;
+    }
+
+    bool Pending() const {
+        return pending_.load(std::memory_order_acquire);
+    }
+
+    //取出一个任务
+    bool TryTake(TaskPtr& task) {
+        if (!Pending()) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (overflow_.empty()) {
+            return false;
+        }
+        task = std::move(overflow_.front());
+        overflow_.pop_front();
+        pending_.store(!overflow_.empty(), std::memory_order_relaxed);
+        return true;
+    }
+
+    //停止时取出所有任务
+    std::deque<TaskPtr> TakeAll() {
+        std::deque<TaskPtr> overflow;
+        std::unique_lock<std::mutex> lck(mtx_);
+        overflow.swap(overflow_);
+        pending_.store(false, std::memory_order_relaxed);
+        return overflow;
+    }
+
+  private:
+    std::mutex mtx_;
+    std::deque<TaskPtr> overflow_;
+    std::atomic<bool> pending_{ false };
+};
+
+#if defined(__LINUX__) || defined(__ANDROID__)
+/*
+    状态机和预写日志的连接：流编号、事件的编码和解码函数，以及提交回调使用的投递链接。
+    Task 需要有 journal_lsn_ 成员，提交后写入日志序号，处理完后用它标记为已应用。
+*/
+template<typename Task>
+class JournalBinding {
+  public:
+    using TaskPtr = std::shared_ptr<Task>;
+    using Deliver = std::function<void(const TaskPtr&)>;
+    using Decoder = std::function<TaskPtr(uint16_t type, const void* data, size_t size)>;
+
+    struct Codec {
+        uint32_t wire_id_;
+        std::any encoder_;
+    };
+
+    JournalBinding() = default;
+    JournalBinding(const JournalBinding&) = delete;
+    JournalBinding& operator=(const JournalBinding&) = delete;
+
+    ~JournalBinding() {
+        Detach();
+    }
+
+    bool Attached() const {
+        return journal_ != nullptr;
+    }
+
+    //提交的任务在日志写线程通过 deliver 投递，替换之前连接的日志
+    void Attach(std::shared_ptr<Journal> journal, uint32_t stream, Deliver deliver) {
+        journal->AttachStream(stream);
+        Detach();
+        journal_ = journal;
+        stream_ = stream;
+        link_ = std::make_shared<Link>(std::move(deliver));
+    }
+
+    //等待正在投递的提交回调结束，之后提交的记录不再投递，留到重启后处理
+    void Detach() {
+        if (!journal_) {
+            return;
+        }
+        link_->Detach();
+        journal_->DetachStream(stream_);
+        journal_ = nullptr;
+        link_ = nullptr;
+    }
+
+    void AddCodec(uint32_t event_id, uint32_t wire_id, std::any encoder, Decoder decoder) {
+        codecs_[event_id] = { wire_id, std::move(encoder) };
+        decoders_[wire_id] = std::move(decoder);
+    }
+
+    //没有注册编码函数时抛出 std::logic_error
+    const Codec& GetCodec(uint32_t event_id, const char* signature) const {
+        auto codec = codecs_.find(event_id);
+        if (codec == codecs_.end()) {
+            throw std::logic_error("Event " + std::string(signature) + " has no journal codec.");
+        }
+        return codec->second;
+    }
+
+    //写入日志，落盘后投递任务再调用 done，写入失败时只调用 done
+    void Append(uint16_t type, uint32_t wire_id, const std::string& payload, const TaskPtr& task,
+                std::function<void(std::exception_ptr error)> done) {
+        journal_->Append(stream_, type, wire_id, payload.data(), payload.size(),
+            [link = link_, task, done](uint64_t lsn, std::exception_ptr error) {
+                if (error) {
+                    done(error);
+                    return;
+                }
+                task->journal_lsn_ = lsn;
+                link->Send(task);
+                done(nullptr);
+            });
+    }
+
+    //已经写入日志的事件先投递
+    void Sync() {
+        journal_->Sync();
+    }
+
+    void MarkApplied(const Task& task) {
+        if (task.journal_lsn_ != 0) {
+            journal_->MarkApplied(stream_, task.journal_lsn_);
+        }
+    }
+
+    //按 LSN 顺序用 process 处理还没有应用的记录，running 变为 false 时停止；
+    //无法解码的记录交给 on_error 并标记为已应用
+    template<typename Process, typename OnError>
+    void Replay(const bool* running, Process&& process, OnError&& on_error) {
+        if (!journal_) {
+            return;
+        }
+        for (auto& record : journal_->TakeRecovered(stream_)) {
+            if (running != nullptr && !*running) {
+                return;
+            }
+            TaskPtr task;
+            try {
+                auto decoder = decoders_.find(record.wire_id_);
+                if (decoder == decoders_.end()) {
+                    throw std::runtime_error("No journal codec for wire id " + std::to_string(record.wire_id_) + ".");
+                }
+                task = decoder->second(record.type_, record.payload_.data(), record.payload_.size());
+            }
+            catch (const std::exception& e) {
+                on_error(e);
+                journal_->MarkApplied(stream_, record.lsn_);
+                continue;
+            }
+            task->journal_lsn_ = record.lsn_;
+            process(task);
+        }
+    }
+
+  private:
+    //日志写线程的提交回调通过它投递，断开后回调不再访问状态机
+    class Link {
+      public:
+        explicit Link(JournalBinding::Deliver deliver) :deliver_(std::move(deliver)) {}
+        void Send(const TaskPtr& task) {
+            std::unique_lock<std::mutex> lck(mtx_);
+            if (deliver_) {
+                deliver_(task);
+            }
+        }
+        //等待正在投递的回调结束
+        void Detach() {
+            std::unique_lock<std::mutex> lck(mtx_);
+            deliver_ = nullptr;
+        }
+      private:
+        std::mutex mtx_;
+        JournalBinding::Deliver deliver_;
+    };
+
+    std::shared_ptr<Journal> journal_;
+    std::shared_ptr<Link> link_;
+    uint32_t stream_ = 0;
+    std::unordered_map<uint32_t, Codec> codecs_;      //事件ID到日志编码函数，启动后不再变化
+    std::unordered_map<uint32_t, Decoder> decoders_; //日志中的事件编号到解码函数
+};
+#endif
+
+}//end namespace helper
@@ -0,0 +1,217 @@
+#pragma once
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace helper {
+
+/*
+    存活状态机的注册表，按 ID（状态机名称）和分组标签查找。
+    查找在不可变快照上进行，不持有注册表的互斥锁遍历，但不是无锁的：快照指针用 std::atomic_load 读取
+    （标准库通常用内部的锁实现），访问每个状态机时还要持有它的条目的共享锁。
+    注册和注销只标记快照过期，下一次查找时在锁内重建整个快照（与状态机数量成正比），
+    大量状态机批量创建时只重建一次，不会每次注册都复制。
+*/
+template<class Machine>
+class BasicMachineRegistry {
+  public:
+    // 注册表中的条目，状态机注销时在独占锁下清空指针，访问者持有共享锁期间状态机不会被释放
+    class Handle {
+      public:
+        Handle(Machine* machine, const std::string& id, const std::string& group)
+            :machine_(machine), id_(id), group_(group) {}
+
+        const std::string& GetId() const { return id_; }
+        const std::string& GetGroup() const { return group_; }
+
+        template<typename F>
+        bool Visit(F&& func) {
+            std::shared_lock<std::shared_mutex> lck(mtx_);
+            if (machine_ == nullptr) {
+                return false;
+            }
+            func(*machine_);
+            return true;
+        }
+
+      private:
+        std::shared_mutex mtx_;
+        Machine* machine_;
+        std::string id_;
+        std::string group_;
+        friend class BasicMachineRegistry;
+    };
+    using HandlePtr = std::shared_ptr<Handle>;
+
+    static BasicMachineRegistry& Instance() {
+        static BasicMachineRegistry registry;
+        return registry;
+    }
+
+    HandlePtr Add(Machine* machine, const std::string& id, const std::string& group) {
+        auto handle = std::make_shared<Handle>(machine, id, group);
+        std::unique_lock<std::mutex> lck(mtx_);
+        handles_.emplace(handle.get(), handle);
+        dirty_.store(true, std::memory_order_release);
+        return handle;
+    }
+
+    // 注销后等待正在访问此状态机的调用结束
+    void Remove(const HandlePtr& handle) {
+        if (!handle) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            handles_.erase(handle.get());
+            dirty_.store(true, std::memory_order_release);
+        }
+        std::unique_lock<std::shared_mutex> lck(handle->mtx_);
+        handle->machine_ = nullptr;
+    }
+
+    // 按 ID 查找并访问状态机，找到返回 true
+    template<typename F>
+    bool Visit(const std::string& id, F&& func) {
+        auto snapshot = GetSnapshot();
+        auto it = snapshot->by_id_.find(id);
+        if (it == snapshot->by_id_.end()) {
+            return false;
+        }
+        return it->second->Visit(std::forward<F>(func));
+    }
+
+    // 访问分组中的所有状态机，返回访问的数量
+    template<typename F>
+    size_t VisitGroup(const std::string& group, F&& func) {
+        auto snapshot = GetSnapshot();
+        auto it = snapshot->by_group_.find(group);
+        if (it == snapshot->by_group_.end()) {
+            return 0;
+        }
+        size_t count = 0;
+        for (const auto& handle : it->second) {
+            if (handle->Visit(func)) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    // 访问所有状态机，返回访问的数量
+    template<typename F>
+    size_t VisitAll(F&& func) {
+        auto snapshot = GetSnapshot();
+        size_t count = 0;
+        for (const auto& handle : snapshot->all_) {
+            if (handle->Visit(func)) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    // 访问分组中第一个满足 pred 的状态机，找到返回 true
+    template<typename P, typename F>
+    bool VisitGroupIf(const std::string& group, P&& pred, F&& func) {
+        auto snapshot = GetSnapshot();
+        auto it = snapshot->by_group_.find(group);
+        if (it == snapshot->by_group_.end()) {
+            return false;
+        }
+        for (const auto& handle : it->second) {
+            bool visited = false;
+            handle->Visit([&](Machine& machine) {
+                if (pred(machine)) {
+                    func(machine);
+                    visited = true;
+                }
+            });
+            if (visited) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 按顺序用 prefs 中的条件查找分组中的状态机，访问第一个满足条件的，找到返回 true
+    template<typename F, typename... Prefs>
+    bool VisitPreferred(const std::string& group, F&& func, Prefs&&... prefs) {
+        return (VisitGroupIf(group, prefs, func) || ...);
+    }
+
+    // 广播的投递结果
+    struct BroadcastResult {
+        size_t targets_ = 0;   //分组中存活的状态机数量
+        size_t delivered_ = 0; //成功投递的数量
+    };
+
+    // 对分组中的每个状态机调用 deliver，deliver 抛出异常（例如队列已满）时这个目标计为没有投递
+    template<typename F>
+    BroadcastResult Broadcast(const std::string& group, F&& deliver) {
+        BroadcastResult result;
+        VisitGroup(group, [&result, &deliver](Machine& machine) {
+            ++result.targets_;
+            try {
+                deliver(machine);
+                ++result.delivered_;
+            }
+            catch (const std::exception&) {
+            }
+        });
+        return result;
+    }
+
+    // 分组中状态机的数量
+    size_t GroupSize(const std::string& group) {
+        auto snapshot = GetSnapshot();
+        auto it = snapshot->by_group_.find(group);
+        return it == snapshot->by_group_.end() ? 0 : it->second.size();
+    }
+
+    size_t Size() {
+        return GetSnapshot()->all_.size();
+    }
+
+  private:
+    struct Snapshot {
+        std::unordered_map<std::string, HandlePtr> by_id_;
+        std::unordered_map<std::string, std::vector<HandlePtr>> by_group_;
+        std::vector<HandlePtr> all_; //名称可能重复，按 ID 的索引中只保留一个
+    };
+
+    BasicMachineRegistry() :snapshot_(std::make_shared<const Snapshot>()) {}
+
+    std::shared_ptr<const Snapshot> GetSnapshot() {
+        if (dirty_.load(std::memory_order_acquire)) {
+            std::unique_lock<std::mutex> lck(mtx_);
+            if (dirty_.load(std::memory_order_relaxed)) {
+                auto snapshot = std::make_shared<Snapshot>();
+                snapshot->by_id_.reserve(handles_.size());
+                snapshot->all_.reserve(handles_.size());
+                for (const auto& item : handles_) {
+                    snapshot->all_.push_back(item.second);
+                    snapshot->by_id_[item.second->id_] = item.second;
+                    if (!item.second->group_.empty()) {
+                        snapshot->by_group_[item.second->group_].push_back(item.second);
+                    }
+                }
+                std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(snapshot)));
+                dirty_.store(false, std::memory_order_release);
+            }
+        }
+        return std::atomic_load(&snapshot_);
+    }
+
+    std::mutex mtx_;
+    std::unordered_map<Handle*, HandlePtr> handles_;
+    std::atomic<bool> dirty_{ false };
+    std::shared_ptr<const Snapshot> snapshot_;
+};
+
+}//end namespace helper
@@ -1,8 +1,20 @@
 #pragma once
 #include <queue>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include <stdexcept>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include "thread_helper.h"
+#if defined(__LINUX__) || defined(__ANDROID__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
 #ifndef INFINITE
 #define INFINITE 0xFFFFFFFF
@@ -10,12 +22,66 @@
 
 namespace helper {
 
-template<class T>
+// 消费者等待数据的方式
+enum class WaitStrategy {
+    BLOCK,            // 直接在条件变量上等待
+    SPIN_YIELD_PARK,  // 先忙等，再让出CPU，最后在条件变量上等待
+    ADAPTIVE,         // 同上，忙等时间根据最近的数据到达间隔调整
+};
+
+template<class T, class Alloc = std::allocator<T>>
 class MessageBuffer {
   public:
     explicit MessageBuffer(unsigned long maxBuffer = 1024*1024*1024):MAXBUFFER(maxBuffer) {
     }
-    virtual ~MessageBuffer(void) {}
+    // 队列的存储从 alloc 分配，生产者和消费者都会使用 alloc，它必须是线程安全的
+    explicit MessageBuffer(const Alloc& alloc, unsigned long maxBuffer = 1024*1024*1024)
+        :m_dataBuffer(alloc), MAXBUFFER(maxBuffer) {
+    }
+    virtual ~MessageBuffer(void) {
+#if defined(__LINUX__) || defined(__ANDROID__)
+        int fd = m_pollFd.load(std::memory_order_relaxed);
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    // 创建可以被 epoll/poll 监听的 eventfd，队列非空时可读，不支持的平台返回-1
+    int EnablePollFd() {
+        std::unique_lock<std::mutex> lck(m_mtx);
+#if defined(__LINUX__) || defined(__ANDROID__)
+        if (m_pollFd.load(std::memory_order_relaxed) < 0) {
+            int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            m_pollFd.store(fd, std::memory_order_release);
+            if (fd >= 0 && !m_dataBuffer.empty()) {
+                signalPollFd();
+            }
+        }
+#endif
+        return m_pollFd.load(std::memory_order_relaxed);
+    }
+
+    int GetPollFd() const {
+        return m_pollFd.load(std::memory_order_acquire);
+    }
+
+    /*
+        设置消费者的等待方式，spin 为忙等的最长时间，yield 为让出CPU阶段的最长时间，两者都不超过 Get 的超时时间。
+        消费者等待时也可以调用，下一次等待开始生效。
+    */
+    void SetWaitStrategy(WaitStrategy strategy,
+                         std::chrono::microseconds spin = std::chrono::microseconds(50),
+                         std::chrono::microseconds yield = std::chrono::microseconds(50)) {
+        std::unique_lock<std::mutex> lck(m_mtx);
+        m_spin.store(spin.count(), std::memory_order_relaxed);
+        m_yield.store(yield.count(), std::memory_order_relaxed);
+        // 还没有到达间隔时按忙等上限的一半估计，开始时忙等整个上限
+        auto seed = std::chrono::duration_cast<std::chrono::steady_clock::duration>(spin) / 2;
+        m_avgInterval.store(seed.count(), std::memory_order_relaxed);
+        m_lastArrival = 0;
+        m_strategy.store(strategy, std::memory_order_relaxed);
+    }
 
     bool Put(const T& data) {
         return Add(data);
@@ -31,7 +97,7 @@ class MessageBuffer {
             throw  std::exception(ex);
         }
         this->m_dataBuffer.emplace_back(data);
-        this->m_cv.notify_one();
+        pushed();
         return true;
     }
 
@@ -42,7 +108,7 @@ class MessageBuffer {
             throw  std::exception(ex);
         }
         this->m_dataBuffer.emplace_back(std::forward<T>(data));
-        this->m_cv.notify_one();
+        pushed();
         return true;
     }
 
@@ -60,7 +126,7 @@ class MessageBuffer {
             throw  std::exception(ex);
         }
         this->m_dataBuffer.emplace_front(std::forward<T>(data));
-        this->m_cv.notify_one();
+        pushed();
         return true;
     }
 
@@ -71,38 +137,116 @@ class MessageBuffer {
             throw  std::exception(ex);
         }
         this->m_dataBuffer.emplace_front(data);
-        this->m_cv.notify_one();
+        pushed();
         return true;
     }
 
     bool Get(T& data, uint64_t dwMilliseconeds = INT32_MAX) {
+        return Get(data, dwMilliseconeds, []() { return false; });
+    }
+
+    // 同时等待队列之外的数据源：ready 返回 true 或者被 Wakeup 唤醒时返回 false，由调用者去取外部数据
+    template<typename Ready>
+    bool Get(T& data, uint64_t dwMilliseconeds, Ready&& ready) {
+        dwMilliseconeds -= spinWait(ready, dwMilliseconeds);
         std::unique_lock<std::mutex> lck(m_mtx);
 
-        bool result = this->m_cv.wait_for(lck, std::chrono::milliseconds(dwMilliseconeds), [&]()->bool{ return !this->m_dataBuffer.empty(); });
+        bool result = waitData(lck, dwMilliseconeds, ready);
 
         if (result) {
             data = m_dataBuffer.front();
             m_dataBuffer.pop_front();
+            popped();
         }
 
         return result;
     }
 
     bool Get(std::queue<T> & data, uint64_t dwMilliseconeds = INT32_MAX) {
+        auto ready = []() { return false; };
+        dwMilliseconeds -= spinWait(ready, dwMilliseconeds);
         std::unique_lock<std::mutex> lck(m_mtx);
 
-        bool result = this->m_cv.wait_for(lck, std::chrono::milliseconds(dwMilliseconeds), [&]()->bool { return !this->m_dataBuffer.empty(); });
+        bool result = waitData(lck, dwMilliseconeds, ready);
 
         if (result) {
             while (!m_dataBuffer.empty()) {
                 data.push(m_dataBuffer.front());
                 m_dataBuffer.pop_front();
             }
+            popped();
         }
 
         return result;
     }
 
+    // 数据从队列之外到达时（例如无锁通道）唤醒等待中的消费者，消费者没在等待时只有一次原子读
+    void Wakeup() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        signalPollFd();
+        if (m_parked.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        if (m_wakeHook) {
+            m_wakeHook();
+            return;
+        }
+        std::unique_lock<std::mutex> lck(m_mtx);
+        m_woken = true;
+        this->m_cv.notify_one();
+    }
+
+    /*
+        消费者不在条件变量上等待，而是在外部等待（例如共享内存中的 futex）时设置，
+        放入数据时如果消费者在外部等待，调用 hook 唤醒。在消费者开始等待之前调用。
+    */
+    void SetWakeHook(std::function<void()> hook) {
+        std::unique_lock<std::mutex> lck(m_mtx);
+        m_wakeHook = std::move(hook);
+    }
+
+    // 消费者进入外部等待前调用，之后还需要再检查一次 HasData 才能开始等待
+    void BeginExternalWait() {
+        m_parked.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void EndExternalWait() {
+        m_parked.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // 不加锁读取队列是否有数据，结果只是一个瞬时值
+    bool HasData() const {
+        return m_size.load(std::memory_order_acquire) > 0;
+    }
+
+    // 不等待，取出一条数据
+    bool TryGet(T& data) {
+        std::unique_lock<std::mutex> lck(m_mtx);
+        if (m_dataBuffer.empty()) {
+            return false;
+        }
+        data = m_dataBuffer.front();
+        m_dataBuffer.pop_front();
+        popped();
+        return true;
+    }
+
+    // 不等待，一次最多取出 maxCount 条数据追加到 data，返回取出的条数
+    size_t TryGet(std::vector<T>& data, size_t maxCount) {
+        std::unique_lock<std::mutex> lck(m_mtx);
+        size_t count = 0;
+        while (count < maxCount && !m_dataBuffer.empty()) {
+            data.push_back(m_dataBuffer.front());
+            m_dataBuffer.pop_front();
+            ++count;
+        }
+        if (count > 0) {
+            popped();
+        }
+        return count;
+    }
+
     size_t Size() {
         std::unique_lock<std::mutex> lck(m_mtx);
         return m_dataBuffer.size();
@@ -115,13 +259,161 @@ class MessageBuffer {
     virtual void Clear() {
         std::unique_lock<std::mutex> lck(m_mtx);
         auto tmp = std::move(m_dataBuffer);
+        popped();
+    }
+
+    /*
+        队列为空时重新创建 deque，释放高峰时扩大的存储，队列不为空时不做任何事，返回0。
+        deque 取出数据时已经释放了数据块，剩下的主要是索引表，返回值是按高峰长度估计的释放字节数。
+    */
+    size_t Shrink() {
+        std::unique_lock<std::mutex> lck(m_mtx);
+        if (!m_dataBuffer.empty()) {
+            return 0;
+        }
+        std::deque<T, Alloc>(m_dataBuffer.get_allocator()).swap(m_dataBuffer);
+        size_t blocks = m_peak * sizeof(T) / 512 + 1;
+        m_peak = 0;
+        return blocks + 2 > 8 ? (blocks + 2 - 8) * sizeof(T*) : 0;
     }
 
   private:
-    std::deque<T> m_dataBuffer;
+    // 在锁内调用：有消费者在条件变量上等待时才通知，避免多余的唤醒系统调用
+    void pushed() {
+        m_size.store(m_dataBuffer.size(), std::memory_order_release);
+        if (m_dataBuffer.size() > m_peak) {
+            m_peak = m_dataBuffer.size();
+        }
+        if (m_dataBuffer.size() == 1) {
+            signalPollFd();
+        }
+        if (m_strategy.load(std::memory_order_relaxed) == WaitStrategy::ADAPTIVE) {
+            // 到达间隔的指数滑动平均，权重 1/8
+            auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+            if (m_lastArrival != 0) {
+                int64_t interval = now - m_lastArrival;
+                int64_t avg = m_avgInterval.load(std::memory_order_relaxed);
+                m_avgInterval.store(avg + (interval - avg) / 8, std::memory_order_relaxed);
+            }
+            m_lastArrival = now;
+        }
+        if (m_waiters > 0) {
+            this->m_cv.notify_one();
+        }
+        if (m_wakeHook) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_parked.load(std::memory_order_relaxed) > 0) {
+                m_wakeHook();
+            }
+        }
+    }
+
+    // 在锁内调用
+    void popped() {
+        m_size.store(m_dataBuffer.size(), std::memory_order_release);
+        if (m_dataBuffer.empty()) {
+            clearPollFd();
+        }
+    }
+
+    // 在锁内调用，等待到有数据或超时
+    template<typename Ready>
+    bool waitData(std::unique_lock<std::mutex>& lck, uint64_t dwMilliseconeds, Ready& ready) {
+        if (!m_dataBuffer.empty()) {
+            return true;
+        }
+        ++m_waiters;
+        // 先公开等待状态再检查外部数据源，与 Wakeup 中先写数据再读等待状态配对，不会丢失唤醒
+        m_parked.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        this->m_cv.wait_for(lck, std::chrono::milliseconds(dwMilliseconeds), [&]()->bool { return !this->m_dataBuffer.empty() || m_woken || ready(); });
+        --m_waiters;
+        m_parked.fetch_sub(1, std::memory_order_relaxed);
+        m_woken = false;
+        return !m_dataBuffer.empty();
+    }
+
+    /*
+        不加锁等待数据到达：先忙等再让出CPU，超过时间后返回，由调用者在条件变量上等待。
+        忙等和让出CPU的总时间不超过 timeout，返回已经用掉的毫秒数（不超过 timeout）。
+    */
+    template<typename Ready>
+    uint64_t spinWait(Ready& ready, uint64_t timeout) {
+        auto strategy = m_strategy.load(std::memory_order_relaxed);
+        if (strategy == WaitStrategy::BLOCK || timeout == 0 || m_size.load(std::memory_order_acquire) > 0) {
+            return 0;
+        }
+        using Duration = std::chrono::steady_clock::duration;
+        auto limit = std::chrono::duration_cast<Duration>(std::chrono::milliseconds(std::min<uint64_t>(timeout, INT32_MAX)));
+        auto spin = std::min(limit, std::chrono::duration_cast<Duration>(std::chrono::microseconds(m_spin.load(std::memory_order_relaxed))));
+        auto yield = std::chrono::duration_cast<Duration>(std::chrono::microseconds(m_yield.load(std::memory_order_relaxed)));
+        if (strategy == WaitStrategy::ADAPTIVE) {
+            // 平均到达间隔超过忙等上限时忙等没有意义，直接等待；否则忙等两倍的平均间隔
+            Duration avg(m_avgInterval.load(std::memory_order_relaxed));
+            if (avg > spin) {
+                return 0;
+            }
+            spin = std::min(spin, avg * 2);
+        }
+        yield = std::min(yield, limit - spin);
+
+        auto begin = std::chrono::steady_clock::now();
+        auto start = begin;
+        uint32_t loops = 0;
+        while (m_size.load(std::memory_order_acquire) == 0 && !ready()) {
+            CpuRelax();
+            if ((++loops & 63) == 0 && std::chrono::steady_clock::now() - start >= spin) {
+                break;
+            }
+        }
+        start = std::chrono::steady_clock::now();
+        while (m_size.load(std::memory_order_acquire) == 0 && !ready()) {
+            std::this_thread::yield();
+            if (std::chrono::steady_clock::now() - start >= yield) {
+                break;
+            }
+        }
+        auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+        return std::min<uint64_t>(static_cast<uint64_t>(spent), timeout);
+    }
+
+    // eventfd 的计数只在队列由空变为非空时增加，取空时清零，一批数据只唤醒一次，没有创建 eventfd 时什么都不做
+    void signalPollFd() {
+#if defined(__LINUX__) || defined(__ANDROID__)
+        int fd = m_pollFd.load(std::memory_order_acquire);
+        if (fd >= 0) {
+            eventfd_write(fd, 1);
+        }
+#endif
+    }
+
+    void clearPollFd() {
+#if defined(__LINUX__) || defined(__ANDROID__)
+        int fd = m_pollFd.load(std::memory_order_relaxed);
+        if (fd >= 0) {
+            eventfd_t value;
+            eventfd_read(fd, &value);
+        }
+#endif
+    }
+
+    std::deque<T, Alloc> m_dataBuffer;
     std::mutex m_mtx;
     std::condition_variable m_cv;
     const unsigned long MAXBUFFER;
+    std::atomic<int> m_pollFd{ -1 };     // 锁内创建，Wakeup 和 GetPollFd 不加锁读取
+    int m_waiters = 0;                   // 在条件变量上等待的消费者数量，锁内访问
+    std::atomic<int> m_parked{ 0 };      // 在条件变量上或外部等待的消费者数量，供 Wakeup 不加锁读取
+    std::function<void()> m_wakeHook;    // 消费者在外部等待时的唤醒函数
+    bool m_woken = false;                // 被 Wakeup 唤醒，锁内访问
+    std::atomic<size_t> m_size{ 0 };     // 队列长度，供忙等时不加锁读取
+    size_t m_peak = 0;                   // 上次 Shrink 以来的最大长度，锁内访问
+    // 等待方式在锁内修改，忙等时不加锁读取
+    std::atomic<WaitStrategy> m_strategy{ WaitStrategy::BLOCK };
+    std::atomic<int64_t> m_spin{ 50 };   // 微秒
+    std::atomic<int64_t> m_yield{ 50 };  // 微秒
+    int64_t m_lastArrival = 0;           // 锁内访问
+    std::atomic<int64_t> m_avgInterval{ 0 }; // steady_clock 的计数
 };// end MessageBuffer class
 
 template<class T,
@@ -0,0 +1,346 @@
+#pragma once
+#if defined(__LINUX__) || defined(__ANDROID__)
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "thread_helper.h"
+
+namespace helper {
+
+/*
+    共享内存中的多生产者单消费者环形缓冲区，用于其他进程向状态机投递消息。
+    每条消息是一个记录：消息类型、事件ID和序列化后的负载，消费者在共享内存中原地读取负载，不再复制。
+    生产者之间用共享内存中的自旋锁互斥（只保护一次 memcpy），生产者进程持有锁时崩溃会使其他生产者阻塞。
+    消费者在共享内存中的 futex 上等待，生产者提交后只在消费者等待时才唤醒。
+*/
+class ShmRing {
+  public:
+    // 单条消息负载的最大长度是容量的一半
+    static std::shared_ptr<ShmRing> Create(const std::string& name, size_t capacity) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            throwError("shm_open");
+        }
+        try {
+            return create(fd, capacity);
+        }
+        catch (...) {
+            shm_unlink(name.c_str());
+            throw;
+        }
+    }
+
+    // 匿名共享内存，把 GetFd 返回的描述符通过 fork 或 SCM_RIGHTS 交给生产者进程
+    static std::shared_ptr<ShmRing> CreateAnonymous(size_t capacity) {
+        int fd = static_cast<int>(syscall(SYS_memfd_create, "state_machine_ring", 0));
+        if (fd < 0) {
+            throwError("memfd_create");
+        }
+        return create(fd, capacity);
+    }
+
+    static std::shared_ptr<ShmRing> Open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0) {
+            throwError("shm_open");
+        }
+        return open(fd);
+    }
+
+    // 打开继承或收到的描述符，描述符的所有权转给 ShmRing
+    static std::shared_ptr<ShmRing> Open(int fd) {
+        return open(fd);
+    }
+
+    static void Unlink(const std::string& name) {
+        shm_unlink(name.c_str());
+    }
+
+    virtual ~ShmRing() {
+        munmap(header_, map_size_);
+        close(fd_);
+    }
+
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    int GetFd() const {
+        return fd_;
+    }
+
+    size_t Capacity() const {
+        return mask_ + 1;
+    }
+
+    // 生产者调用，缓冲区满时返回 false，负载超过容量的一半时抛出异常
+    bool Post(uint16_t type, uint32_t event_id, const void* data, size_t size) {
+        size_t need = recordSize(size);
+        if (need > Capacity() / 2) {
+            throw std::invalid_argument("Message is too large for the shared memory ring.");
+        }
+        lock();
+        uint64_t tail = header_->tail_.load(std::memory_order_relaxed);
+        uint64_t head = header_->head_.load(std::memory_order_acquire);
+        size_t offset = static_cast<size_t>(tail & mask_);
+        size_t padding = Capacity() - offset < need ? Capacity() - offset : 0;
+        if (tail + padding + need - head > Capacity()) {
+            unlock();
+            return false;
+        }
+        if (padding != 0) {
+            //剩余的连续空间不够，写一个填充记录，从头开始
+            auto record = recordAt(offset);
+            record->flags_ = kPadding;
+            record->size_ = 0;
+            offset = 0;
+        }
+        auto record = recordAt(offset);
+        record->size_ = static_cast<uint32_t>(size);
+        record->event_id_ = event_id;
+        record->type_ = type;
+        record->flags_ = 0;
+        if (size != 0) {
+            memcpy(record + 1, data, size);
+        }
+        header_->tail_.store(tail + padding + need, std::memory_order_release);
+        unlock();
+        Notify();
+        return true;
+    }
+
+    /*
+        消费者调用，取出一条消息交给 func(type, event_id, data, size)，func 返回后才释放空间，没有消息时返回 false。
+        共享内存可能被其他进程写坏：位置或记录长度超出缓冲区时计为丢弃一次，之后不再读取。
+    */
+    template<typename F>
+    bool TryRead(F&& func) {
+        if (corrupt_) {
+            return false;
+        }
+        uint64_t head = header_->head_.load(std::memory_order_relaxed);
+        uint64_t tail;
+        while (head != (tail = header_->tail_.load(std::memory_order_acquire))) {
+            if (tail - head > Capacity() || head % sizeof(Record) != 0) {
+                return markCorrupt();
+            }
+            size_t offset = static_cast<size_t>(head & mask_);
+            //记录头只读一次，校验和使用的都是这份副本，生产者进程之后再改写也不影响
+            const Record record = loadRecord(offset);
+            if (record.flags_ & kPadding) {
+                head += Capacity() - offset;
+                header_->head_.store(head, std::memory_order_release);
+                continue;
+            }
+            if (offset + sizeof(Record) + record.size_ > Capacity() || recordSize(record.size_) > tail - head) {
+                return markCorrupt();
+            }
+            struct Release {
+                ~Release() { header_->head_.store(next_, std::memory_order_release); }
+                Header* header_;
+                uint64_t next_;
+            } release{ header_, head + recordSize(record.size_) };
+            func(record.type_, record.event_id_, static_cast<const void*>(recordAt(offset) + 1), static_cast<size_t>(record.size_));
+            return true;
+        }
+        return false;
+    }
+
+    bool Empty() const {
+        return corrupt_ || header_->head_.load(std::memory_order_acquire) == header_->tail_.load(std::memory_order_acquire);
+    }
+
+    // 因共享内存被写坏而停止读取的次数，停止后为 1
+    uint64_t GetCorruptCount() const {
+        return corrupt_count_.load(std::memory_order_relaxed);
+    }
+
+    /*
+        消费者调用，缓冲区为空且 ready 返回 false 时在 futex 上等待，最多 ms 毫秒。
+        其他数据源的生产者在数据放好后调用 Notify 唤醒。
+    */
+    template<typename Ready>
+    void Wait(uint64_t ms, Ready&& ready) {
+        uint32_t seq = header_->seq_.load(std::memory_order_acquire);
+        header_->waiters_.fetch_add(1, std::memory_order_seq_cst);
+        if (Empty() && !ready()) {
+            struct timespec timeout;
+            timeout.tv_sec = static_cast<time_t>(ms / 1000);
+            timeout.tv_nsec = static_cast<long>(ms % 1000) * 1000000;
+            syscall(SYS_futex, &header_->seq_, FUTEX_WAIT, seq, &timeout, nullptr, 0);
+        }
+        header_->waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // 唤醒等待中的消费者，消费者没在等待时只有一次原子操作
+    void Notify() {
+        header_->seq_.fetch_add(1, std::memory_order_seq_cst);
+        if (header_->waiters_.load(std::memory_order_seq_cst) > 0) {
+            syscall(SYS_futex, &header_->seq_, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        }
+    }
+
+  private:
+    static constexpr uint32_t kMagic = 0x534d5247; // "SMRG"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint16_t kPadding = 1;
+    static constexpr size_t kCacheLine = 64;
+
+    static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+                  "Shared memory atomics must be lock free");
+
+    // 共享内存头部，多个进程映射同一份
+    struct Header {
+        std::atomic<uint32_t> magic_;
+        uint32_t version_;
+        uint64_t capacity_;
+        alignas(kCacheLine) std::atomic<uint32_t> lock_;    //生产者自旋锁
+        std::atomic<uint64_t> tail_;                        //已提交的写入位置
+        alignas(kCacheLine) std::atomic<uint64_t> head_;    //消费者读取位置
+        alignas(kCacheLine) std::atomic<uint32_t> seq_;     //futex 等待字，每次提交加一
+        std::atomic<uint32_t> waiters_;                     //在 futex 上等待的消费者数量
+    };
+
+    // 记录头，负载紧随其后，整条记录按 16 字节对齐
+    struct Record {
+        uint32_t size_;
+        uint32_t event_id_;
+        uint16_t type_;
+        uint16_t flags_;
+        uint32_t reserved_;
+    };
+    static_assert(sizeof(Record) == 16, "Record header must be 16 bytes");
+
+    static constexpr size_t headerSize() {
+        return (sizeof(Header) + kCacheLine - 1) / kCacheLine * kCacheLine;
+    }
+
+    static size_t recordSize(size_t size) {
+        return (sizeof(Record) + size + sizeof(Record) - 1) / sizeof(Record) * sizeof(Record);
+    }
+
+    [[noreturn]] static void throwError(const char* what) {
+        throw std::runtime_error(std::string(what) + " failed: " + strerror(errno));
+    }
+
+    static std::shared_ptr<ShmRing> create(int fd, size_t capacity) {
+        size_t size = 4096;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        if (ftruncate(fd, static_cast<off_t>(headerSize() + size)) != 0) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            throwError("ftruncate");
+        }
+        std::shared_ptr<ShmRing> ring(new ShmRing(fd, headerSize() + size));
+        auto header = new (ring->header_) Header();
+        header->version_ = kVersion;
+        header->capacity_ = size;
+        header->lock_.store(0, std::memory_order_relaxed);
+        header->tail_.store(0, std::memory_order_relaxed);
+        header->head_.store(0, std::memory_order_relaxed);
+        header->seq_.store(0, std::memory_order_relaxed);
+        header->waiters_.store(0, std::memory_order_relaxed);
+        header->magic_.store(kMagic, std::memory_order_release);
+        ring->mask_ = size - 1;
+        return ring;
+    }
+
+    static std::shared_ptr<ShmRing> open(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            throwError("fstat");
+        }
+        if (static_cast<size_t>(st.st_size) <= headerSize()) {
+            close(fd);
+            throw std::runtime_error("Shared memory ring is not initialized.");
+        }
+        std::shared_ptr<ShmRing> ring(new ShmRing(fd, static_cast<size_t>(st.st_size)));
+        auto header = ring->header_;
+        if (header->magic_.load(std::memory_order_acquire) != kMagic || header->version_ != kVersion
+            || header->capacity_ + headerSize() != static_cast<uint64_t>(st.st_size)) {
+            throw std::runtime_error("Shared memory ring has an incompatible layout.");
+        }
+        ring->mask_ = static_cast<size_t>(header->capacity_ - 1);
+        return ring;
+    }
+
+    ShmRing(int fd, size_t map_size) :fd_(fd), map_size_(map_size) {
+        void* addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            throwError("mmap");
+        }
+        header_ = static_cast<Header*>(addr);
+        data_ = static_cast<char*>(addr) + headerSize();
+    }
+
+    Record* recordAt(size_t offset) {
+        return reinterpret_cast<Record*>(data_ + offset);
+    }
+
+    // 经 volatile 逐个字段读取一次，编译器不会再回到共享内存重新读取
+    Record loadRecord(size_t offset) const {
+        auto src = reinterpret_cast<const volatile Record*>(data_ + offset);
+        Record record;
+        record.size_ = src->size_;
+        record.event_id_ = src->event_id_;
+        record.type_ = src->type_;
+        record.flags_ = src->flags_;
+        record.reserved_ = 0;
+        return record;
+    }
+
+    void lock() {
+        int spin = 0;
+        while (header_->lock_.exchange(1, std::memory_order_acquire) != 0) {
+            if (++spin < 64) {
+                CpuRelax();
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void unlock() {
+        header_->lock_.store(0, std::memory_order_release);
+    }
+
+    bool markCorrupt() {
+        corrupt_ = true;
+        corrupt_count_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    int fd_;
+    size_t map_size_;
+    Header* header_ = nullptr;
+    char* data_ = nullptr;
+    size_t mask_ = 0;
+    bool corrupt_ = false; //消费者访问
+    std::atomic<uint64_t> corrupt_count_{ 0 };
+};
+
+}//end namespace helper
+#endif
@@ -0,0 +1,185 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "state_machine.h"
+
+namespace helper {
+
+/*
+    单线程的确定性模拟执行器：所有状态机以轮询模式在调用线程上协作运行，使用虚拟时钟。
+    每一轮找出有待处理任务的状态机，按种子打乱顺序后各处理一个任务，相同的种子得到相同的交错顺序。
+    定时器和状态机的延迟任务、任务存活时间只在推进虚拟时间时到期，不需要真实的等待。
+    状态机之间的请求在同一线程上直接执行；使用了 region executor 等其他线程的状态机不再是确定的。
+    所有函数都必须在创建执行器的线程调用。
+*/
+class SimExecutor {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    explicit SimExecutor(uint64_t seed = 0)
+        :seed_(seed), random_(seed), now_(std::make_shared<TimePoint>()) {}
+    virtual ~SimExecutor() {}
+
+    SimExecutor(const SimExecutor&) = delete;
+    SimExecutor& operator=(const SimExecutor&) = delete;
+
+    // 加入状态机并以轮询模式启动，状态机不能已经启动
+    void Add(StateMachine& machine) {
+        auto now = now_;
+        machine.SetClock([now]() { return *now; });
+        machine.StartPolling(false);
+        machines_.push_back(&machine);
+    }
+
+    // 移除状态机，之后由调用者负责停止
+    void Remove(StateMachine& machine) {
+        machines_.erase(std::remove(machines_.begin(), machines_.end(), &machine), machines_.end());
+    }
+
+    TimePoint Now() const {
+        return *now_;
+    }
+
+    uint64_t GetSeed() const {
+        return seed_;
+    }
+
+    // 虚拟时间经过 delay 后执行 func，同一时间的定时器按加入顺序执行
+    void After(std::chrono::nanoseconds delay, std::function<void()> func) {
+        timers_.push({ *now_ + delay, timer_seq_++, std::move(func) });
+    }
+
+    // 处理一轮：有任务的每个状态机按打乱后的顺序各处理一个任务，返回处理的任务数
+    size_t Step() {
+        ready_.clear();
+        for (auto machine : machines_) {
+            if (machine->HasPendingTasks()) {
+                ready_.push_back(machine);
+            }
+        }
+        //不使用 std::shuffle，它的算法依赖标准库实现，换了编译器同一个种子的顺序会不同
+        for (size_t i = ready_.size(); i > 1; --i) {
+            std::swap(ready_[i - 1], ready_[random_() % i]);
+        }
+        size_t count = 0;
+        for (auto machine : ready_) {
+            count += machine->Poll(1);
+        }
+        return count;
+    }
+
+    // 不推进时间，处理到所有状态机都没有任务，返回处理的任务数
+    size_t RunUntilIdle(size_t max_tasks = SIZE_MAX) {
+        size_t count = 0;
+        while (count < max_tasks) {
+            size_t processed = Step();
+            if (processed == 0) {
+                break;
+            }
+            count += processed;
+        }
+        processed_ += count;
+        return count;
+    }
+
+    // 推进虚拟时间 duration，按时间顺序触发定时器和延迟任务过期，每次触发后处理到空闲
+    void AdvanceBy(std::chrono::nanoseconds duration) {
+        AdvanceTo(*now_ + duration);
+    }
+
+    void AdvanceTo(TimePoint target) {
+        RunUntilIdle();
+        TimePoint next;
+        while (nextWakeup(next) && next <= target) {
+            fire(next);
+        }
+        if (target > *now_) {
+            fire(target);
+        }
+    }
+
+    // 运行到没有任务、定时器和延迟任务，虚拟时间最多推进到 limit，返回是否已经空闲
+    bool Run(std::chrono::nanoseconds limit = std::chrono::hours(24)) {
+        TimePoint deadline = *now_ + limit;
+        RunUntilIdle();
+        TimePoint next;
+        while (nextWakeup(next)) {
+            if (next > deadline) {
+                return false;
+            }
+            fire(next);
+        }
+        return true;
+    }
+
+    // 累计处理的任务数
+    uint64_t GetProcessedCount() const {
+        return processed_;
+    }
+
+  private:
+    struct Timer {
+        TimePoint when_;
+        uint64_t seq_;
+        std::function<void()> func_;
+        bool operator>(const Timer& other) const {
+            return when_ != other.when_ ? when_ > other.when_ : seq_ > other.seq_;
+        }
+    };
+
+    // 最早的定时器或延迟任务过期时间，都没有时返回 false
+    bool nextWakeup(TimePoint& next) {
+        bool found = false;
+        if (!timers_.empty()) {
+            next = timers_.top().when_;
+            found = true;
+        }
+        for (auto machine : machines_) {
+            uint64_t wait = machine->GetPollTimeout();
+            if (wait == INT32_MAX) {
+                continue;
+            }
+            TimePoint when = *now_ + std::chrono::milliseconds(wait);
+            if (!found || when < next) {
+                next = when;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // 时间推进到 when，执行到期的定时器，清理过期的延迟任务，然后处理到空闲
+    void fire(TimePoint when) {
+        if (when > *now_) {
+            *now_ = when;
+        }
+        while (!timers_.empty() && timers_.top().when_ <= *now_) {
+            auto func = timers_.top().func_;
+            timers_.pop();
+            func();
+        }
+        for (auto machine : machines_) {
+            machine->Poll(0);
+        }
+        RunUntilIdle();
+    }
+
+    uint64_t seed_;
+    std::mt19937_64 random_;
+    std::shared_ptr<TimePoint> now_; //状态机的时钟持有它，执行器先于状态机析构时仍然有效
+    std::vector<StateMachine*> machines_;
+    std::vector<StateMachine*> ready_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+    uint64_t timer_seq_ = 0;
+    uint64_t processed_ = 0;
+};
+
+}//end namespace helper
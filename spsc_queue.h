@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace helper {
+
+// 单生产者单消费者的有界无锁环形队列，生产者和消费者各自只能有一个线程
+template<class T>
+class SpscQueue {
+  public:
+    // 容量向上取整为2的幂
+    explicit SpscQueue(size_t capacity = 1024) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        slots_.reset(new T[size]);
+    }
+    virtual ~SpscQueue() {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // 生产者调用，队列满时返回 false
+    bool TryPush(T&& data) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cached_head_ > mask_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = std::move(data);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPush(const T& data) {
+        T copy(data);
+        return TryPush(std::move(copy));
+    }
+
+    // 消费者调用，队列空时返回 false
+    bool TryPop(T& data) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_) {
+                return false;
+            }
+        }
+        data = std::move(slots_[head & mask_]);
+        slots_[head & mask_] = T();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 任意线程调用，结果只是一个瞬时值
+    bool Empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    size_t Capacity() const {
+        return mask_ + 1;
+    }
+
+  private:
+    static constexpr size_t kCacheLine = 64;
+
+    alignas(kCacheLine) std::atomic<size_t> head_{ 0 }; //消费者写
+    size_t cached_tail_ = 0;                            //消费者缓存的 tail_
+    alignas(kCacheLine) std::atomic<size_t> tail_{ 0 }; //生产者写
+    size_t cached_head_ = 0;                            //生产者缓存的 head_
+    alignas(kCacheLine) size_t mask_ = 0;
+    std::unique_ptr<T[]> slots_;
+};
+
+}//end namespace helper
@@ -5,13 +5,36 @@
 #include <thread>
 #include <future>
 #include <any>
+#include <typeinfo>
 #include <map>
 #include <list>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <tuple>
+#include <chrono>
 #include <algorithm>
 #include <exception>
+#include <stdexcept>
+#include <condition_variable>
+#include <cstddef>
+#include <memory_resource>
 #include "message_buffer.h"
 #include "thread_helper.h"
 #include "location.h"
+#include "event_id.h"
+#include "event.h"
+#include "completion.h"
+#include "correlation_table.h"
+#include "step_task.h"
+#include "thread_pool.h"
+#include "machine_registry.h"
+#include "spsc_queue.h"
+#include "shm_ring.h"
+#include "journal_binding.h"
+#include "watchdog.h"
+#include "hibernation.h"
+#include "coalescer.h"
 
 namespace helper {
 
@@ -35,8 +58,77 @@ namespace helper {
     template<typename FuncType, typename NewRet>
     using ChangeReturn = typename ChangeReturnType<FuncType, NewRet>::type;
 
+    // 提取处理函数除 Location 以外的形参类型
+    template<typename FuncType>
+    struct FunctionParams;
 
-    class StateMachine {
+    template<typename Ret, typename Loc, typename... Params>
+    struct FunctionParams<std::function<Ret(Loc, Params...)>> {
+        using type = std::tuple<Params...>;
+    };
+
+    // 调用条件函数：只有右值引用形参移动传入，保证参数在条件判断后仍然有效
+    template<typename Param, typename Arg>
+    decltype(auto) CondParam(Arg& arg) {
+        if constexpr (std::is_rvalue_reference_v<Param>) {
+            return std::move(arg);
+        }
+        else {
+            return (arg);
+        }
+    }
+
+    // 调用处理函数：除左值引用形参外都移动传入，处理函数只调用一次
+    template<typename Param, typename Arg>
+    decltype(auto) HandlerParam(Arg& arg) {
+        if constexpr (std::is_lvalue_reference_v<Param>) {
+            return (arg);
+        }
+        else {
+            return std::move(arg);
+        }
+    }
+
+    // 共享参数调用：同一份参数可能被多次、并发使用，右值引用形参传入副本，其余以常量左值传入
+    template<typename Param, typename Arg>
+    decltype(auto) SharedParam(const Arg& arg) {
+        if constexpr (std::is_rvalue_reference_v<Param>) {
+            return std::decay_t<Param>(arg);
+        }
+        else {
+            return (arg);
+        }
+    }
+
+    // 处理函数没有非常量左值引用形参时，才能以共享参数调用
+    template<typename FuncType>
+    struct IsSharedCallable;
+
+    template<typename Ret, typename Loc, typename... Params>
+    struct IsSharedCallable<std::function<Ret(Loc, Params...)>> {
+        static constexpr bool value = !((std::is_lvalue_reference_v<Params> && !std::is_const_v<std::remove_reference_t<Params>>) || ...);
+    };
+
+    template<typename FuncType, typename Func, typename Tuple, std::size_t... I>
+    decltype(auto) ApplyShared(Func&& func, const Location& loc, const Tuple& args, std::index_sequence<I...>) {
+        using Params = typename FunctionParams<FuncType>::type;
+        return func(loc, SharedParam<std::tuple_element_t<I, Params>>(std::get<I>(args))...);
+    }
+
+    template<typename FuncType, typename Func, typename Tuple, std::size_t... I>
+    decltype(auto) ApplyCond(Func&& func, const Location& loc, Tuple& args, std::index_sequence<I...>) {
+        using Params = typename FunctionParams<FuncType>::type;
+        return func(loc, CondParam<std::tuple_element_t<I, Params>>(std::get<I>(args))...);
+    }
+
+    template<typename FuncType, typename Func, typename Tuple, std::size_t... I>
+    decltype(auto) ApplyHandler(Func&& func, const Location& loc, Tuple& args, std::index_sequence<I...>) {
+        using Params = typename FunctionParams<FuncType>::type;
+        return func(loc, HandlerParam<std::tuple_element_t<I, Params>>(std::get<I>(args))...);
+    }
+
+
+    class StateMachine : private StepSuspender {
     public:
         enum class MessageType {
             ANYTYPE = -1,
@@ -47,9 +139,11 @@ namespace helper {
 
         class UnmatchedTask : public std::exception {
         private:
-            std::string message;
+            mutable std::string message;
             MessageType message_type_  = MessageType::ANYTYPE;
             std::string signature_;
+            const std::string* interned_ = nullptr; //按ID构造时引用驻留的签名，描述在 what() 中才生成
+            const char* reason_ = nullptr;
 
         public:
             // 构造函数
@@ -60,37 +154,158 @@ namespace helper {
             }
             // 构造函数
             UnmatchedTask(const std::string& msg) : message(msg) {}
+            //不分配内存的构造函数，reason 需要是静态字符串
+            UnmatchedTask(MessageType msgType, uint32_t event_id, const char* reason)
+                :message_type_(msgType), interned_(&EventIdRegistry::Name(event_id)), reason_(reason) {}
 
             // 返回异常描述的函数，必须重写此函数
             virtual const char* what() const noexcept override {
+                if (interned_ && message.empty()) {
+                    try {
+                        message = "Unmatched Task: MessageType=" + std::to_string(static_cast<int>(message_type_)) + ", signature=" + *interned_ + ", " + reason_;
+                    }
+                    catch (...) {
+                        return reason_;
+                    }
+                }
                 return message.c_str();
             }
 
             MessageType GetMessageType() const { return message_type_; }
-            const std::string& GetSignature() const { return signature_; }
+            const std::string& GetSignature() const { return interned_ ? *interned_ : signature_; }
+        };
+
+        //任务在队列中超过了存活时间，请求以此异常结束
+        class TaskTimeout : public std::exception {
+        private:
+            std::string message;
+        public:
+            TaskTimeout(MessageType msgType, const std::string& signature) {
+                message = "Task Timeout: MessageType=" + std::to_string(static_cast<int>(msgType)) + ", signature=" + signature;
+            }
+
+            virtual const char* what() const noexcept override {
+                return message.c_str();
+            }
         };
+
+        //状态机停止时还没有处理的任务被取消，请求以此异常结束
+        class TaskCancelled : public std::exception {
+        private:
+            std::string message;
+        public:
+            TaskCancelled(MessageType msgType, const std::string& signature) {
+                message = "Task Cancelled: MessageType=" + std::to_string(static_cast<int>(msgType)) + ", signature=" + signature;
+            }
+
+            virtual const char* what() const noexcept override {
+                return message.c_str();
+            }
+        };
+
+        //轻量的未匹配任务通知，不分配内存，描述信息在需要时才生成
+        class UnmatchedNotice {
+        public:
+            UnmatchedNotice(MessageType type, uint32_t event_id, const Location& loc, uint64_t count, uint64_t suppressed)
+                :type_(type), event_id_(event_id), loc_(loc), count_(count), suppressed_(suppressed) {}
+
+            MessageType GetMessageType() const { return type_; }
+            uint32_t GetEventId() const { return event_id_; }
+            const std::string& GetSignature() const { return EventIdRegistry::Name(event_id_); }
+            const Location& GetLocation() const { return loc_; }
+            //此签名累计未匹配的次数
+            uint64_t GetCount() const { return count_; }
+            //上次通知以后因限流没有通知的次数
+            uint64_t GetSuppressed() const { return suppressed_; }
+
+            std::string Message() const {
+                Location loc = loc_;
+                return "Unmatched Task: MessageType=" + std::to_string(static_cast<int>(type_)) + ", signature=" + GetSignature()
+                    + ", location=" + loc.ToString() + ", count=" + std::to_string(count_) + ", suppressed=" + std::to_string(suppressed_);
+            }
+        private:
+            MessageType type_;
+            uint32_t event_id_;
+            Location loc_;
+            uint64_t count_;
+            uint64_t suppressed_;
+        };
+
+        using SlowHandlerNotice = helper::SlowHandlerNotice;
     public:
         using Task = std::function<void(std::any func)>;
         using Cond = std::function<bool(std::any cond)>;
 
-        class TaskData {
+        //按键分派的处理函数匹配的键，low_ 到 high_ 的闭区间
+        struct DispatchKey {
+            int64_t low_;
+            int64_t high_;
+        };
+
+        class TaskData : public std::enable_shared_from_this<TaskData> {
         public:
             TaskData(const Location& loc, const MessageType& type, const std::string& signature)
-                :loc_(loc), type_(type), signature_(signature) {}
+                :loc_(loc), type_(type), event_id_(EventIdRegistry::Intern(signature)), signature_(signature) {}
+            TaskData(const Location& loc, const MessageType& type, uint32_t event_id)
+                :loc_(loc), type_(type), event_id_(event_id) {}
             virtual ~TaskData() {}
         public:
             //在状态机中使用的信息
             Location loc_; //需要传递给状态机处理函数，定位问题需要。
             MessageType type_;
-            std::string signature_;
+            uint32_t event_id_; //签名驻留后的ID，匹配时比较ID
+            std::string signature_; //只有由签名构造时保存，按ID构造时为空，不为每个任务复制签名，用 GetSignature 读取
+            const std::string& GetSignature() const { return signature_.empty() ? EventIdRegistry::Name(event_id_) : signature_; }
             Task task_;
             Cond cond_;
+            Task shared_task_; //可以多次、并发调用的处理函数，参数以常量传入，为空表示不支持
+            bool coalesced_ = false; //事件类型设置了合并策略
+            bool keyed_ = false; //已经用 SET_DISCRIMINATOR 的函数提取了分派键
+            int64_t key_ = 0;
+            std::function<int64_t(const std::any& key)> key_of_; //广播任务在各状态机中按各自的提取函数计算分派键
+            uint64_t coalesce_key_ = 0; //合并的键，相同事件类型和键的待处理任务只保留最新的一个
+            std::chrono::steady_clock::time_point deadline_ = std::chrono::steady_clock::time_point::max(); //出队时超过此时间则丢弃
+            std::shared_ptr<SuspendedStep> resume_; //不为空时是恢复挂起的运行步骤的任务
+            bool correlated_ = false; //已经用 SET_CORRELATION 的函数提取了关联ID
+            uint64_t correlation_id_ = 0;
+            bool direct_ = false; //不匹配处理函数，直接调用 task_（等待响应超时）
+            uint64_t journal_lsn_ = 0; //写入日志的任务，处理后在日志中标记为已应用
+            enum { PENDING, CANCELLED, STARTED };
+            std::atomic<int> state_{ PENDING }; //取消和开始处理只有一个成功
+        };
+
+        //取消还未处理的事件或响应
+        class CancelToken {
+        public:
+            CancelToken() = default;
+            explicit CancelToken(const std::shared_ptr<TaskData>& task_data) :task_data_(task_data) {}
+
+            //任务还没有开始处理时取消成功，返回 true；已经开始处理、已经取消或已经被合并时返回 false
+            bool Cancel() {
+                auto task_data = task_data_.lock();
+                if (!task_data) {
+                    return false;
+                }
+                int expected = TaskData::PENDING;
+                return task_data->state_.compare_exchange_strong(expected, TaskData::CANCELLED);
+            }
+        private:
+            std::weak_ptr<TaskData> task_data_;
         };
 
+        //状态机拥有的容器使用的分配器，内存来自构造时传入的 memory_resource
+        using Allocator = std::pmr::polymorphic_allocator<std::byte>;
+
         using Action = std::function<void()>;
-        class ActionVector : public std::vector<Action> {
+        class ActionVector : public std::pmr::vector<Action> {
         public:
             ActionVector() = default;
+            explicit ActionVector(const Allocator& alloc) :std::pmr::vector<Action>(alloc) {}
+            ActionVector(const ActionVector& other, const Allocator& alloc) :std::pmr::vector<Action>(other, alloc) {}
+            ActionVector(const ActionVector&) = default;
+            ActionVector(ActionVector&&) = default;
+            ActionVector& operator=(const ActionVector&) = default;
+            ActionVector& operator=(ActionVector&&) = default;
             ~ActionVector() = default;
             ActionVector& operator +(const Action& action)
             {
@@ -103,7 +318,7 @@ namespace helper {
                 if (this->size() < _pos + 1) {
                     this->resize(_pos + 1);
                 }
-                return std::vector<Action>::operator[](_pos);
+                return std::pmr::vector<Action>::operator[](_pos);
             }
         };
 
@@ -122,6 +337,28 @@ namespace helper {
 #define RESPONSE_3(funcType,cond, lambda) \
         Matching(MessageType::RESPONSE, #funcType,(helper::ChangeReturn<funcType, bool>)cond, (funcType)lambda)
 
+        /*
+            按键分派：SET_DISCRIMINATOR 为处理函数类型设置提取函数，每个任务只提取一次键，
+            然后在状态中按键查找处理函数，不再逐个调用条件函数。精确的键优先于范围，
+            都没有找到时再按顺序匹配普通的处理函数。同一状态中的键不能重复，范围不能重叠。
+        */
+#define EVENT_KEY(funcType, key, lambda) \
+        Matching(MessageType::EVENT, #funcType, DispatchKey{ key, key }, (funcType)lambda)
+#define EVENT_RANGE(funcType, low, high, lambda) \
+        Matching(MessageType::EVENT, #funcType, DispatchKey{ low, high }, (funcType)lambda)
+#define REQUEST_KEY(funcType, key, lambda) \
+        Matching(MessageType::REQUEST, #funcType, DispatchKey{ key, key }, (funcType)lambda)
+#define REQUEST_RANGE(funcType, low, high, lambda) \
+        Matching(MessageType::REQUEST, #funcType, DispatchKey{ low, high }, (funcType)lambda)
+#define RESPONSE_KEY(funcType, key, lambda) \
+        Matching(MessageType::RESPONSE, #funcType, DispatchKey{ key, key }, (funcType)lambda)
+#define RESPONSE_RANGE(funcType, low, high, lambda) \
+        Matching(MessageType::RESPONSE, #funcType, DispatchKey{ low, high }, (funcType)lambda)
+
+        //没有处理函数，只转移到 target 状态的事件
+#define EVENT_TO(funcType, target) \
+        Matching(MessageType::EVENT, #funcType, typeid(funcType)).To(target)
+
         struct Matching
         {
             Matching() {};
@@ -130,24 +367,56 @@ namespace helper {
                 type_(type), func_(func) {
                 static_assert(is_std_function<std::decay_t<F>>::value,"Parameter must be std::function type");
                 signature_ = func_.type().name() + signature;
+                event_id_ = EventIdRegistry::Intern(signature_);
             }
             template <typename F, typename F2>
             Matching(MessageType type, const std::string& signature,  F2&& cond, F&& func) :
                 type_(type), func_(func) {
                 static_assert(is_std_function<std::decay_t<F>>::value, "Parameter must be std::function type");
                 signature_ = func_.type().name() + signature;
+                event_id_ = EventIdRegistry::Intern(signature_);
                 static_assert(is_std_function<std::decay_t<F2>>::value, "Parameter must be std::function type");
                 cond_ = cond;
             }
+            Matching(MessageType type, const std::string& signature, const std::type_info& func_type) :
+                type_(type) {
+                signature_ = func_type.name() + signature;
+                event_id_ = EventIdRegistry::Intern(signature_);
+            }
+            template <typename F>
+            Matching(MessageType type, const std::string& signature, DispatchKey key, F&& func) :
+                type_(type), func_(func), keyed_(true), key_(key) {
+                static_assert(is_std_function<std::decay_t<F>>::value, "Parameter must be std::function type");
+                if (key.low_ > key.high_) {
+                    throw std::invalid_argument("Dispatch key range is empty: " + signature);
+                }
+                signature_ = func_.type().name() + signature;
+                event_id_ = EventIdRegistry::Intern(signature_);
+            }
+            //处理函数返回后转移到 target 状态，处理函数中不需要再调用 Transition
+            Matching& To(const std::string& target) {
+                target_ = target;
+                return *this;
+            }
             MessageType type_ = MessageType::ANYTYPE;
             std::any cond_;
             std::string signature_;
+            uint32_t event_id_ = EventIdRegistry::kInvalidId;
             std::any func_;
+            std::string target_; //为空表示不转移
+            bool keyed_ = false; //按键分派，不使用 cond_
+            DispatchKey key_{ 0, 0 };
         };
 
-        class MatchingVector : public std::vector<Matching> {
+        class MatchingVector : public std::pmr::vector<Matching> {
         public:
             MatchingVector() = default;
+            explicit MatchingVector(const Allocator& alloc) :std::pmr::vector<Matching>(alloc) {}
+            MatchingVector(const MatchingVector& other, const Allocator& alloc) :std::pmr::vector<Matching>(other, alloc) {}
+            MatchingVector(const MatchingVector&) = default;
+            MatchingVector(MatchingVector&&) = default;
+            MatchingVector& operator=(const MatchingVector&) = default;
+            MatchingVector& operator=(MatchingVector&&) = default;
             ~MatchingVector() = default;
 
             MatchingVector& operator +(const Matching& _cond)
@@ -161,14 +430,64 @@ namespace helper {
                 if (this->size() < _pos + 1) {
                     this->resize(_pos + 1);
                 }
-                return std::vector<Matching>::operator[](_pos);
+                return std::pmr::vector<Matching>::operator[](_pos);
             };
         };
 
+        //延迟事件声明：状态中没有匹配的任务暂存起来，状态转移后重新投递
+#define DEFER_EVENT(funcType) \
+        Deferring(MessageType::EVENT, #funcType, typeid(funcType))
+#define DEFER_REQUEST(funcType) \
+        Deferring(MessageType::REQUEST, #funcType, typeid(funcType))
+#define DEFER_RESPONSE(funcType) \
+        Deferring(MessageType::RESPONSE, #funcType, typeid(funcType))
+
+        struct Deferring
+        {
+            Deferring() {};
+            Deferring(MessageType type, const std::string& signature, const std::type_info& func_type) :
+                type_(type) {
+                signature_ = func_type.name() + signature;
+                event_id_ = EventIdRegistry::Intern(signature_);
+            }
+            MessageType type_ = MessageType::ANYTYPE;
+            std::string signature_;
+            uint32_t event_id_ = EventIdRegistry::kInvalidId;
+        };
+
+        class DeferringVector : public std::pmr::vector<Deferring> {
+        public:
+            DeferringVector() = default;
+            explicit DeferringVector(const Allocator& alloc) :std::pmr::vector<Deferring>(alloc) {}
+            DeferringVector(const DeferringVector& other, const Allocator& alloc) :std::pmr::vector<Deferring>(other, alloc) {}
+            DeferringVector(const DeferringVector&) = default;
+            DeferringVector(DeferringVector&&) = default;
+            DeferringVector& operator=(const DeferringVector&) = default;
+            DeferringVector& operator=(DeferringVector&&) = default;
+            ~DeferringVector() = default;
+
+            DeferringVector& operator +(const Deferring& _defer)
+            {
+                this->push_back(_defer);
+                return *this;
+            }
+        };
+
+        /*
+            状态树是分配器感知的类型：子状态在父状态的 map 中创建时使用同一个 memory_resource，
+            所以只要根状态使用状态机的分配器，整棵树的容器都从它分配。状态ID等字符串仍然使用全局堆。
+        */
         class BaseState {
         public:
+            using allocator_type = Allocator;
             BaseState(const std::string& id_) :id(id_) {}
             BaseState() {}
+            explicit BaseState(const allocator_type& alloc) :onentry(alloc), onexit(alloc) {}
+            BaseState(const BaseState& other, const allocator_type& alloc)
+                :onentry(other.onentry, alloc), onexit(other.onexit, alloc), id(other.id),
+                parent(other.parent), concurrent_root_(other.concurrent_root_), active_(other.active_), index_(other.index_) {}
+            BaseState(const BaseState&) = default;
+            BaseState& operator=(const BaseState&) = default;
             virtual ~BaseState() {}
         public:
             const std::string& GetId() const { return id; }
@@ -177,7 +496,9 @@ namespace helper {
         private:
             std::string id;
             class BaseState* parent = nullptr;
+            class BaseState* concurrent_root_ = nullptr; //最外层的并发 parallel 祖先（包括自己），parseStates 中计算
             bool active_ = false;
+            uint32_t index_ = 0; //状态句柄
             friend class StateMachine;
         };
 
@@ -185,6 +506,7 @@ namespace helper {
         class  Final : public BaseState {
         public:
             Final() {}
+            explicit Final(const allocator_type& alloc) :BaseState(alloc) {}
         };
 
 
@@ -194,10 +516,21 @@ namespace helper {
             class Parallel : public BaseState {
             public:
                 Parallel() {}
+                explicit Parallel(const allocator_type& alloc) :BaseState(alloc), children_(alloc) {}
+                Parallel(const Parallel& other, const allocator_type& alloc)
+                    :BaseState(other, alloc), children_(other.children_, alloc), concurrent(other.concurrent) {}
+                Parallel(const Parallel&) = default;
+                Parallel& operator=(const Parallel&) = default;
                 State& operator[](const std::string& keyval) {
                     return children_[keyval];
                 }
-                std::map<std::string, State> children_;
+                std::pmr::map<std::string, State> children_;
+                /*
+                    各分支互不共享数据时设置为 true：事件和响应广播到所有分支，每个分支各自匹配一次，在 region executor 上并发处理；
+                    没有设置 region executor 时在 worker 线程依次处理，仍然是广播。
+                    为 false 时按分支顺序匹配，第一个匹配的分支处理后结束。请求总是按 false 的方式匹配。
+                */
+                bool concurrent = false;
             private:
 
                 friend class StateMachine;
@@ -206,52 +539,284 @@ namespace helper {
             State(const std::string& id)
                 :BaseState(id) {}
             State() {}
+            explicit State(const allocator_type& alloc)
+                :BaseState(alloc), match(alloc), defer(alloc), children(alloc), parallel(alloc) {}
+            State(const State& other, const allocator_type& alloc)
+                :BaseState(other, alloc), match(other.match, alloc), defer(other.defer, alloc), budget(other.budget),
+                children(other.children, alloc), parallel(other.parallel, alloc) {}
+            State(const State&) = default;
+            State& operator=(const State&) = default;
             State& operator[](const std::string& keyval) {
                 return children[keyval];
             }
         public:
             MatchingVector match;
-            std::map<std::string, State> children;
-            std::map<std::string, Parallel> parallel;
+            DeferringVector defer;
+            std::chrono::milliseconds budget{ 0 }; //看门狗：在此状态（包括子状态）中处理一个任务的时间上限，0 表示使用上层状态的设置
+            std::pmr::map<std::string, State> children;
+            std::pmr::map<std::string, Parallel> parallel;
             friend class StateMachine;
         };
 
     public:
-        StateMachine(const std::string& name)
-            :name_(name) {
+        /*
+            resource 为空时使用 std::pmr::get_default_resource()。
+            状态树、任务队列、延迟任务和状态查找表等状态机拥有的容器都从 resource 分配，
+            生产者线程放入任务时也会使用它，所以它必须是线程安全的，例如上游为 monotonic_buffer_resource
+            的 synchronized_pool_resource，状态机析构后一次释放。resource 的生命周期必须长于状态机。
+            任务记录不使用 resource：CancelToken 可能在状态机析构后还持有它的控制块。
+        */
+        StateMachine(const std::string& name, std::pmr::memory_resource* resource = nullptr)
+            :root(allocatorOf(resource)), final(allocatorOf(resource)), stateId_map_(allocatorOf(resource)),
+            task_queue_(allocatorOf(resource)), name_(name), unmatched_counters_(allocatorOf(resource)),
+            deferred_tasks_(allocatorOf(resource)), states_(allocatorOf(resource)), state_scratch_(allocatorOf(resource)),
+            coalescer_(allocatorOf(resource)) {
         }
         virtual ~StateMachine()
         {
+            if (polling_ && !IsInWorkerThread()) {
+                finishPolling(); //在其他线程析构时事件循环已经不再使用状态机，直接清理
+            }
             Stop();
+#if defined(__LINUX__) || defined(__ANDROID__)
+            journal_.Detach(); //在自己线程停止时没有等待提交，之后提交的记录留到重启后处理
+#endif
         }
     public:
         void Start() {
+            registerMachine();
+            parseStates();
+            queue_closed_.store(false, std::memory_order_relaxed);
             thread_is_run_ = new bool();
             *thread_is_run_ = true;
-            this->thread_run_ = std::thread(&StateMachine::Run, this); //启动线程
+            worker_.Start([this]() { Run(false); }); //启动线程
+        }
+        /*
+            不启动 worker 线程，由调用者的事件循环驱动状态机。
+            返回的 eventfd 在有任务时可读，把它加入 epoll 后在可读时调用 Poll，
+            之后所有的 Poll/RunOnce 都必须在调用 StartPolling 的线程执行。
+            在其他线程调用 Stop 只标记停止并唤醒 eventfd，轮询线程在下一次 Poll 中处理完剩余的任务后停止。
+            调用者自己判断何时 Poll 时（例如模拟执行器）可以不创建 eventfd，返回 -1。
+        */
+        int StartPolling(bool with_fd = true) {
+            registerMachine();
+            poll_thread_id_ = std::this_thread::get_id();
+            poll_discard_.store(false, std::memory_order_relaxed);
+            queue_closed_.store(false, std::memory_order_relaxed);
+            polling_ = true;
+            worker_node_.store(CurrentNumaNode(), std::memory_order_release);
+            int fd = with_fd ? task_queue_.EnablePollFd() : -1;
+            parseStates();
+            {
+                StepScope step(in_step_);
+                processEntry(this->current_state_);
+            }
+            publishState();
+            replayJournal(nullptr);
+            return fd;
+        }
+
+        //处理最多 max_tasks 个已就绪的任务，不等待，返回处理的任务数
+        size_t Poll(size_t max_tasks = SIZE_MAX) {
+            if (!polling_) {
+                return 0;
+            }
+            expireDeferred();
+            expireOutstanding(nullptr);
+            size_t count = 0;
+            while (count < max_tasks && polling_) {
+                poll_batch_.clear();
+                task_queue_.TryGet(poll_batch_, max_tasks - count);
+                pollSources(poll_batch_, max_tasks - count);
+                if (poll_batch_.empty()) {
+                    break;
+                }
+                for (auto& task_data : poll_batch_) {
+                    if (task_data == nullptr) {
+                        finishPolling(); //其他线程调用了 Stop
+                        continue;
+                    }
+                    if (!polling_ || poll_discard_.load(std::memory_order_relaxed)) {
+                        cancelTask(*task_data); //停止标记之后放入的任务和不处理的剩余任务都取消
+                        continue;
+                    }
+                    processStep(task_data, nullptr);
+                    expireOutstanding(nullptr);
+                    ++count;
+                }
+            }
+            poll_batch_.clear();
+            //队列取空时会清除 eventfd，其他来源还有剩余任务时重新置位
+            if (polling_ && sourceReady()) {
+                task_queue_.Wakeup();
+            }
+            return count;
+        }
+
+        //处理一个已就绪的任务
+        bool RunOnce() {
+            return Poll(1) == 1;
+        }
+
+        int GetPollFd() const {
+            return task_queue_.GetPollFd();
+        }
+
+        //队列、通道或共享内存中是否有待处理的任务
+        bool HasPendingTasks() const {
+            return task_queue_.HasData() || sourceReady();
+        }
+
+        //事件循环等待的最长时间（毫秒），到时需要调用 Poll 处理过期的延迟任务
+        uint64_t GetPollTimeout() {
+            return std::min(deferredWaitTime(), outstandingWaitTime());
         }
+
         void Stop(bool consume_all_at_exit = true) {
-            if (thread_run_.joinable()) { //线程在运行中
-                if (!consume_all_at_exit && thread_is_run_) {
-                    *thread_is_run_ = false; //设置运行标志为false
+#if defined(__LINUX__) || defined(__ANDROID__)
+            if (journal_.Attached() && !IsInWorkerThread()) {
+                journal_.Sync(); //已经写入日志的事件先投递，停止时和其他任务一起处理
+            }
+#endif
+            MachineRegistry::Instance().Remove(registry_handle_);
+            registry_handle_ = nullptr;
+            watch_.Reset(); //在处理函数中停止时运行步骤不再结束计时
+            if (polling_) {
+                if (!IsInWorkerThread()) {
+                    //Poll 只能在轮询线程执行：这里只标记停止，轮询线程下次 Poll 时处理或取消剩余的任务后停止
+                    poll_discard_.store(!consume_all_at_exit, std::memory_order_relaxed);
+                    task_queue_.Put(nullptr);
+                    return;
+                }
+                if (consume_all_at_exit) {
+                    Poll();
                 }
-                task_queue_.Put(nullptr);
+                finishPolling();
+                return;
+            }
+            if (workerStarted() && !stopHibernated()) { //线程在运行中
+                signalStop(consume_all_at_exit);
+                joinWorker();
+            }
+        }
 
-                if (thread_run_.get_id() == std::this_thread::get_id()) {
-                    thread_run_.detach(); //自己线程调用停止，不能join
+        /*
+            同时停止一组状态机：先通知所有 worker 线程，它们并行处理剩余的任务，
+            超过 deadline 后剩余的任务被取消（请求抛出 TaskCancelled），最后等待所有线程结束。
+            正在执行的处理函数不会被打断，线程在它返回后结束。轮询模式的状态机需要在自己的线程调用 Stop，这里跳过。
+        */
+        static void StopAll(const std::vector<StateMachine*>& machines, std::chrono::steady_clock::time_point deadline) {
+            int64_t deadline_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+            std::vector<StateMachine*> stopping;
+            stopping.reserve(machines.size());
+            for (auto machine : machines) {
+                if (machine == nullptr || machine->polling_) {
+                    continue;
                 }
-                else if (thread_run_.joinable()) {
-                    thread_run_.join(); //其他线程调用停止，等待结束
+                MachineRegistry::Instance().Remove(machine->registry_handle_);
+                machine->registry_handle_ = nullptr;
+                if (machine->workerStarted() && !machine->stopHibernated()) {
+                    machine->drain_deadline_.store(deadline_ns == 0 ? 1 : deadline_ns, std::memory_order_relaxed);
+                    machine->signalStop(true);
+                    stopping.push_back(machine);
                 }
             }
+            for (auto machine : stopping) {
+                machine->joinWorker();
+                machine->drain_deadline_.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        //停止分组中的所有状态机，调用期间不能在其他线程释放这些状态机
+        static void StopAll(const std::string& group, std::chrono::milliseconds timeout) {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            std::vector<StateMachine*> machines;
+            MachineRegistry::Instance().VisitGroup(group, [&machines](StateMachine& machine) { machines.push_back(&machine); });
+            StopAll(machines, deadline);
         }
 
+        //在 worker 线程返回当前状态，在其他线程返回最近一次运行步骤结束时发布的状态
         const std::string& GetCurStateId() {
-            return this->current_state_->GetId();
+            if (states_.empty() || IsInWorkerThread()) {
+                return this->current_state_->GetId();
+            }
+            return states_[GetStateSnapshot().state_]->GetId();
+        }
+
+        //状态句柄，Start 之后不再变化，可以在任意线程使用
+        using StateHandle = uint32_t;
+        static constexpr StateHandle kInvalidState = UINT32_MAX;
+
+        //运行步骤结束时发布的当前状态和状态转移计数
+        struct StateSnapshot {
+            StateHandle state_;
+            uint32_t version_;
+        };
+
+        //在 Start 之后调用，状态不存在时返回 kInvalidState
+        StateHandle GetStateHandle(const std::string& id) {
+            auto state = GetState(id);
+            return state ? state->index_ : kInvalidState;
+        }
+
+        StateHandle GetRootHandle() const {
+            return this->root.index_;
+        }
+
+        StateHandle GetFinalHandle() const {
+            return this->final.index_;
+        }
+
+        //可以在任意线程调用，无锁，正在发布时重试
+        StateSnapshot GetStateSnapshot() const {
+            return readPublished([this]() { return snapshotOf(state_word_.load(std::memory_order_relaxed)); });
+        }
+
+        //状态（或它的子孙状态）是否在最近一次发布的活动配置中，可以在任意线程调用，无锁，正在发布时重试
+        bool IsInState(StateHandle handle) const {
+            if (handle >= state_count_) {
+                return false;
+            }
+            return readPublished([this, handle]() { return state_flags_[handle].load(std::memory_order_relaxed); });
+        }
+
+        /*
+            从同一次发布中读取当前状态和一组状态是否在活动配置中，结果互相一致，可以在任意线程调用。
+            active[i] 对应 handles[i]，无效的句柄为 false。
+        */
+        StateSnapshot ReadConfiguration(const StateHandle* handles, bool* active, size_t count) const {
+            return readPublished([this, handles, active, count]() {
+                for (size_t i = 0; i < count; ++i) {
+                    active[i] = handles[i] < state_count_ && state_flags_[handles[i]].load(std::memory_order_relaxed);
+                }
+                return snapshotOf(state_word_.load(std::memory_order_relaxed));
+            });
+        }
+
+        //阻塞等待状态进入活动配置，超时返回 false，不能在 worker 线程调用
+        bool WaitForState(StateHandle handle, std::chrono::milliseconds timeout) {
+            if (handle >= state_count_) {
+                throw std::invalid_argument("Invalid state handle.");
+            }
+            if (IsInState(handle)) {
+                return true;
+            }
+            if (IsInWorkerThread()) {
+                throw std::logic_error("WaitForState called from the worker thread would deadlock.");
+            }
+            std::unique_lock<std::mutex> lck(state_mtx_);
+            state_waiters_.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool result = state_cv_.wait_for(lck, timeout, [this, handle]() { return IsInState(handle); });
+            state_waiters_.fetch_sub(1, std::memory_order_relaxed);
+            return result;
         }
 
         std::thread::id GetWorkerThreadId() {
-            return thread_run_.get_id();
+            if (poll_thread_id_ != std::thread::id()) {
+                return poll_thread_id_;
+            }
+            return worker_id_.load(std::memory_order_acquire);
         }
 
 #define ADD_REQUEST_TASK(FuncType, ...) \
@@ -261,8 +826,53 @@ namespace helper {
         auto AddRequetTask(Location&& loc, const char* signature, Args&&... args)
         {
             static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
-            auto future = AddTask<FuncType, Args...>(std::forward<Location>(loc), MessageType::REQUEST, signature, std::forward<Args>(args)...);
-            return future.get();
+            auto request = AddTask<FuncType, Args...>(std::chrono::milliseconds(0), std::forward<Location>(loc), MessageType::REQUEST, signature, std::forward<Args>(args)...);
+            return request->result_.Get();
+        }
+
+#define ADD_REQUEST_TASK_FOR(ttl, FuncType, ...) \
+        AddRequestTaskFor<FuncType>(ttl, HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
+
+        //在队列中超过 ttl 还没有处理的请求抛出 TaskTimeout
+        template<typename FuncType, typename... Args>
+        auto AddRequestTaskFor(std::chrono::milliseconds ttl, Location&& loc, const char* signature, Args&&... args)
+        {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            auto request = AddTask<FuncType, Args...>(ttl, std::forward<Location>(loc), MessageType::REQUEST, signature, std::forward<Args>(args)...);
+            return request->result_.Get();
+        }
+
+#define ASYNC_REQUEST_TASK(FuncType, ...) \
+        AsyncRequestTask<FuncType>(HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
+
+        /*
+            不等待返回的请求，参数复制到任务中，通过返回的 Completion 取得结果。
+            在 worker 线程且不在运行步骤中时立即执行，否则排队；不能在本状态机的 worker 线程中等待结果。
+        */
+        template<typename FuncType, typename... Args>
+        auto AsyncRequestTask(Location&& loc, const char* signature, Args&&... args)->Completion<typename StepResult<typename FuncType::result_type>::type>
+        {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            using RetType = typename StepResult<typename FuncType::result_type>::type;
+            using Request = RequestTask<FuncType, std::tuple<std::decay_t<Args>...>>;
+            auto task_data = std::make_shared<Request>(loc, MessageType::REQUEST, eventIdOf<FuncType>(signature), std::forward<Args>(args)...);
+            Request* request = task_data.get();
+            task_data->task_ = [request](std::any func_)->void {
+                completeRequest<FuncType>(*request, func_, [request](const FuncType& func) {
+                    return ApplyHandler<FuncType>(func, request->loc_, request->args_, std::index_sequence_for<Args...>());
+                });
+            };
+            task_data->cond_ = [request](std::any cond_)->bool {
+                if (!cond_.has_value()) {
+                    return true;
+                }
+                const auto& cond = *std::any_cast<helper::ChangeReturn<FuncType, bool>>(&cond_);
+                return ApplyCond<FuncType>(cond, request->loc_, request->args_, std::index_sequence_for<Args...>());
+            };
+            setDeadline(*task_data, task_ttl_);
+            setDispatchKey<FuncType>(*task_data, task_data->loc_, task_data->args_);
+            submitAsync(task_data);
+            return Completion<RetType>(std::shared_ptr<OneShot<RetType>>(task_data, &task_data->result_));
         }
 
 
@@ -270,376 +880,2347 @@ namespace helper {
         AddResponseTask<FuncType>(HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
 
         template<typename FuncType, typename... Args> //不等待返回
-        void AddResponseTask(Location&& loc, const char* signature, Args&&... args)
+        CancelToken AddResponseTask(Location&& loc, const char* signature, Args&&... args)
+        {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            return AsyncAddTask<FuncType>(std::chrono::milliseconds(0), std::forward<Location>(loc), MessageType::RESPONSE, signature, std::forward<Args>(args)...);
+        }
+
+#define ADD_RESPONSE_TASK_FOR(ttl, FuncType, ...) \
+        AddResponseTaskFor<FuncType>(ttl, HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
+
+        //在队列中超过 ttl 还没有处理的响应被丢弃
+        template<typename FuncType, typename... Args>
+        CancelToken AddResponseTaskFor(std::chrono::milliseconds ttl, Location&& loc, const char* signature, Args&&... args)
         {
             static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
-            AsyncAddTask<FuncType>(std::forward<Location>(loc), MessageType::RESPONSE, signature, std::forward<Args>(args)...);
-            return;
+            return AsyncAddTask<FuncType>(ttl, std::forward<Location>(loc), MessageType::RESPONSE, signature, std::forward<Args>(args)...);
         }
 
 #define ADD_EVENT_TASK(FuncType, ...) \
         AddEventTask<FuncType>(HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
 
         template<typename FuncType, typename... Args>//不等待返回
-        void AddEventTask(Location&& loc, const char * signature, Args&&... args)
+        CancelToken AddEventTask(Location&& loc, const char * signature, Args&&... args)
         {
             static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
-            AsyncAddTask<FuncType>(std::forward<Location>(loc), MessageType::EVENT, signature, std::forward<Args>(args)...);
-            return;
+            return AsyncAddTask<FuncType>(std::chrono::milliseconds(0), std::forward<Location>(loc), MessageType::EVENT, signature, std::forward<Args>(args)...);
         }
 
-        virtual bool TransitionRoot()final {
-            return Transition(&this->root);
-        }
+#define ADD_EVENT_TASK_FOR(ttl, FuncType, ...) \
+        AddEventTaskFor<FuncType>(ttl, HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
 
-        virtual bool TransitionFinal()final {
-            return Transition(&this->final);
+        //在队列中超过 ttl 还没有处理的事件被丢弃
+        template<typename FuncType, typename... Args>
+        CancelToken AddEventTaskFor(std::chrono::milliseconds ttl, Location&& loc, const char* signature, Args&&... args)
+        {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            return AsyncAddTask<FuncType>(ttl, std::forward<Location>(loc), MessageType::EVENT, signature, std::forward<Args>(args)...);
         }
 
-        virtual bool Transition(const std::string& target) final {
-            return Transition(GetState(target));
+#define DISPATCH_REQUEST_TASK(FuncType, ...) \
+        DispatchRequestTask<FuncType>(HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
+#define DISPATCH_RESPONSE_TASK(FuncType, ...) \
+        DispatchResponseTask<FuncType>(HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
+#define DISPATCH_EVENT_TASK(FuncType, ...) \
+        DispatchEventTask<FuncType>(HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
+
+        /*
+            Dispatch 系列：在 worker 线程调用且不在其他处理函数的运行步骤中时立即执行，否则排队。
+            请求在 worker 线程的运行步骤中无法等待结果，会抛出 std::logic_error。
+            直接执行主要用于在同一线程轮询的多个状态机：一个状态机的处理函数向另一个状态机发请求时直接调用，没有队列往返。
+            线程模式下处理函数总在运行步骤中，向自己的状态机发请求会抛出异常，需要改用事件或 ASYNC_REQUEST_TASK。
+        */
+        template<typename FuncType, typename... Args>
+        auto DispatchRequestTask(Location&& loc, const char* signature, Args&&... args)
+        {
+            return AddRequetTask<FuncType>(std::forward<Location>(loc), signature, std::forward<Args>(args)...);
         }
 
-        bool IsRoot() {
-            return this->current_state_ == &this->root;
+        template<typename FuncType, typename... Args>
+        void DispatchResponseTask(Location&& loc, const char* signature, Args&&... args)
+        {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            submitAsync(makeAsyncTask<FuncType>(std::forward<Location>(loc), MessageType::RESPONSE, signature, std::forward<Args>(args)...));
         }
 
-        bool IsFinal() {
-            return this->current_state_ == &this->final;
+        template<typename FuncType, typename... Args>
+        void DispatchEventTask(Location&& loc, const char* signature, Args&&... args)
+        {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            submitAsync(makeAsyncTask<FuncType>(std::forward<Location>(loc), MessageType::EVENT, signature, std::forward<Args>(args)...));
         }
 
-        void SetExceptionHandler(std::function<void(const std::exception*)> handler) {
-            exception_handler_ = handler;
-        }
+        using MachineRegistry = BasicMachineRegistry<StateMachine>;
 
-    protected:
-        State root;
-        Final final;
-    private:
-        BaseState* current_state_ = nullptr;
-        std::map<std::string, BaseState*> stateId_map_;
-        std::thread thread_run_;
-        bool* thread_is_run_ = nullptr;
-        helper::MessageBuffer<std::shared_ptr<TaskData>> task_queue_;
-        std::string name_; //状态机名称，也用作线程名称
-        std::function<void(const std::exception*)> exception_handler_ = nullptr;
-    private:
-        //添加任务，packaged_task 中返回的future，不调用get()不会阻塞
+        using BroadcastResult = MachineRegistry::BroadcastResult;
+
+#define BROADCAST_EVENT_TASK(group, FuncType, ...) \
+        helper::StateMachine::BroadcastEventTask<FuncType>(group, HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
+
+        /*
+            向分组中的所有状态机广播事件：参数只分配一次，由所有目标共享，
+            每个目标有自己的任务记录。处理函数的形参不能是非常量左值引用。
+        */
         template<typename FuncType, typename... Args>
-        auto AddTask(Location&& loc, MessageType&& type, const char * signature, Args&&... args)
+        static BroadcastResult BroadcastEventTask(const std::string& group, Location&& loc, const char* signature, Args&&... args)
         {
-            using RetType = typename FuncType::result_type; //推导返回值类型
-            auto task_data = std::make_shared<StateMachine::TaskData>(loc, type, std::string(typeid(FuncType).name()) + signature);
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            static_assert(IsSharedCallable<FuncType>::value, "Broadcast handler can not take non-const lvalue reference parameters");
+            auto make_task = makeSharedTask<FuncType>(loc, MessageType::EVENT, signature, std::forward<Args>(args)...);
+            return MachineRegistry::Instance().Broadcast(group, [&make_task](StateMachine& machine) { machine.putTask(make_task()); });
+        }
 
-            auto func = [&loc, &args...](std::any func_)->RetType {
-                    if(!func_.has_value()) {
-                        return RetType();
-                    }
-                    FuncType func = std::any_cast<FuncType>(func_);
-                    return func(loc, std::forward<Args>(args)...);
-            };
+        /*
+            状态机之间的单生产者单消费者通道，发送方固定为一个线程（通常是另一个状态机的 worker 线程），
+            发送不加锁、不分配队列节点，通道满时返回 false。接收方的 worker 线程和 task_queue_ 轮流取任务。
+            通道只能在接收方存活期间使用。
+        */
+        class Channel {
+          public:
+            Channel(StateMachine* receiver, size_t capacity) :receiver_(receiver), queue_(capacity) {}
+
+            template<typename FuncType, typename... Args>
+            bool SendEvent(Location&& loc, const char* signature, Args&&... args) {
+                static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+                return send(receiver_->makeAsyncTask<FuncType>(std::forward<Location>(loc), MessageType::EVENT, signature, std::forward<Args>(args)...));
+            }
 
-            //在这里使用统一的packpaged类型
-            auto taskPack = std::make_shared<std::packaged_task<RetType(std::any func_)>>(func);
+            template<typename FuncType, typename... Args>
+            bool SendResponse(Location&& loc, const char* signature, Args&&... args) {
+                static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+                return send(receiver_->makeAsyncTask<FuncType>(std::forward<Location>(loc), MessageType::RESPONSE, signature, std::forward<Args>(args)...));
+            }
 
-            std::future<RetType> futureRet = taskPack->get_future();
-            task_data->task_ = [taskPack](std::any func_)->void { (*taskPack)(func_); };
+            size_t Capacity() const {
+                return queue_.Capacity();
+            }
 
-            auto cond = [&loc, &args...](std::any cond_)->bool {
-                if (!cond_.has_value()) {
+          private:
+            bool send(std::shared_ptr<TaskData>&& task_data) {
+                if (task_data->coalesced_ && receiver_->coalesceTask(task_data)) {
                     return true;
                 }
-                auto cond = std::any_cast<helper::ChangeReturn<FuncType, bool>>(cond_);
-                return cond(loc, std::forward<Args>(args)...);
-                };
+                if (!queue_.TryPush(std::move(task_data))) {
+                    receiver_->releaseCoalesced(*task_data);
+                    return false;
+                }
+                receiver_->task_queue_.Wakeup();
+                return true;
+            }
 
-            task_data->cond_ = cond;
-            task_queue_.Put(task_data);
+            StateMachine* receiver_;
+            SpscQueue<std::shared_ptr<TaskData>> queue_;
+            friend class StateMachine;
+        };
+
+#define CHANNEL_EVENT_TASK(channel, FuncType, ...) \
+        (channel)->SendEvent<FuncType>(HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
+
+#define CHANNEL_RESPONSE_TASK(channel, FuncType, ...) \
+        (channel)->SendResponse<FuncType>(HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
 
-            return futureRet;
+        //创建一个发往本状态机的通道，把返回值交给发送方，在 Start 之前调用
+        std::shared_ptr<Channel> OpenChannel(size_t capacity = 1024) {
+            if (polling_ || workerStarted()) {
+                throw std::logic_error("Channel must be opened before the state machine starts.");
+            }
+            auto channel = std::make_shared<Channel>(this, capacity);
+            channels_.push_back(channel);
+            return channel;
         }
 
-        template<typename FuncType, typename... Args>
-        auto AsyncAddTask(Location&& loc, MessageType&& type, const char* signature, Args&&... args)->void
+#if defined(__LINUX__) || defined(__ANDROID__)
+#define INGRESS_DECODER(wire_id, FuncType, decoder) \
+        AddIngressDecoder<FuncType>(wire_id, HELPER_FROM_HERE, #FuncType, decoder)
+
+        /*
+            接收其他进程通过共享内存投递的消息，在 Start 之前调用。worker 线程在共享内存的 futex 上等待，
+            不再使用 SetWaitStrategy 设置的忙等。轮询模式下其他进程投递消息不会使 eventfd 可读，需要定时调用 Poll。
+        */
+        void AttachIngress(std::shared_ptr<ShmRing> ring) {
+            if (polling_ || workerStarted()) {
+                throw std::logic_error("Ingress must be attached before the state machine starts.");
+            }
+            ingress_ = ring;
+            task_queue_.SetWakeHook([ring]() { ring->Notify(); });
+        }
+
+        /*
+            注册消息解码函数：wire_id 是进程间约定的事件编号，decoder(const void* data, size_t size)
+            返回处理函数 Location 之后的参数组成的 std::tuple，抛出异常表示消息无效，消息被丢弃。
+        */
+        template<typename FuncType, typename Decoder>
+        void AddIngressDecoder(uint32_t wire_id, Location&& loc, const char* signature, Decoder&& decoder)
         {
-            auto task_data = std::make_shared<StateMachine::TaskData>(loc, type, std::string(typeid(FuncType).name()) + signature);
-            //参数使用临时变量
-            auto func = [loc, args...](std::any func_)->void {
-                if (!func_.has_value()) {
-                    return ;
-                }
-                return std::any_cast<FuncType>(func_)(loc, std::move(args)...);
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            ingress_decoders_[wire_id] = [this, loc, signature, decoder](MessageType type, const void* data, size_t size) {
+                return std::apply([&](auto&&... args) {
+                    return this->template makeAsyncTask<FuncType>(Location(loc), std::move(type), signature, std::forward<decltype(args)>(args)...);
+                }, decoder(data, size));
             };
+        }
 
-            //在这里使用统一的packpaged类型
-            auto taskPack = std::make_shared<std::packaged_task<void(std::any func_)>>(func);
-
-            task_data->task_ = [taskPack](std::any func_)->void { (*taskPack)(func_); };
+        //生产者进程调用，投递事件或响应，缓冲区满时返回 false
+        static bool PostIngress(ShmRing& ring, MessageType type, uint32_t wire_id, const void* data, size_t size) {
+            if (type != MessageType::EVENT && type != MessageType::RESPONSE) {
+                throw std::invalid_argument("Only event and response can be posted through shared memory.");
+            }
+            return ring.Post(static_cast<uint16_t>(type), wire_id, data, size);
+        }
 
-            auto cond = [&loc, &args...](std::any cond_)->bool {
-                if (!cond_.has_value()) {
-                    return true;
-                }
-                auto cond = std::any_cast<helper::ChangeReturn<FuncType, bool>>(cond_);
-                return cond(loc, std::forward<Args>(args)...);
-            };
+        //没有解码函数或解码失败而丢弃的消息数量，共享内存被写坏而停止读取时再加一
+        uint64_t GetIngressDropped() const {
+            uint64_t dropped = ingress_dropped_.load(std::memory_order_relaxed);
+#if defined(__LINUX__) || defined(__ANDROID__)
+            if (ingress_) {
+                dropped += ingress_->GetCorruptCount();
+            }
+#endif
+            return dropped;
+        }
 
-            task_data->cond_ = cond;
+        /*
+            使用预写日志，stream 是本状态机在日志中的流编号，重启后用相同的编号恢复，在 Start 之前调用。
+            Start 时先按顺序处理日志中还没有应用的任务（与正常投递的任务一样分派），再处理新任务。
+        */
+        void AttachJournal(std::shared_ptr<Journal> journal, uint32_t stream) {
+            if (polling_ || workerStarted()) {
+                throw std::logic_error("Journal must be attached before the state machine starts.");
+            }
+            journal_.Attach(journal, stream, [this](const std::shared_ptr<TaskData>& task_data) { putCommitted(task_data); });
+        }
 
-            task_queue_.Put(task_data);
-            return;
+#define JOURNAL_CODEC(wire_id, FuncType, encoder, decoder) \
+        AddJournalCodec<FuncType>(wire_id, HELPER_FROM_HERE, #FuncType, (helper::ChangeReturn<FuncType, std::string>)encoder, decoder)
 
+        /*
+            注册写入日志的事件的序列化函数：wire_id 是日志中的事件编号，重启后不能改变；
+            encoder 的参数与处理函数相同，返回负载；decoder 与 INGRESS_DECODER 相同，恢复时调用。
+        */
+        template<typename FuncType, typename Decoder>
+        void AddJournalCodec(uint32_t wire_id, Location&& loc, const char* signature, helper::ChangeReturn<FuncType, std::string> encoder, Decoder&& decoder)
+        {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            if (polling_ || workerStarted()) {
+                throw std::logic_error("Journal codec must be added before the state machine starts.");
+            }
+            journal_.AddCodec(eventIdOf<FuncType>(signature), wire_id, encoder, [this, loc, signature, decoder](uint16_t type, const void* data, size_t size) {
+                return std::apply([&](auto&&... args) {
+                    return this->template makeAsyncTask<FuncType>(Location(loc), static_cast<MessageType>(type), signature, std::forward<decltype(args)>(args)...);
+                }, decoder(data, size));
+            });
         }
 
-        //解析状态机结构
-        void ParseState(BaseState* baseState, BaseState* parent) {
-            baseState->parent = parent;
-            stateId_map_[baseState->GetId()] = baseState;
-            State* state = dynamic_cast<State*>(baseState);
-            if (state) {
-                for (auto& parallel : state->parallel) {
-                    parallel.second.id = parallel.first;
-                    ParseState(&parallel.second, baseState);
-                }
+#define JOURNAL_EVENT_TASK(FuncType, ...) \
+        JournalEventTask<FuncType>(HELPER_FROM_HERE, #FuncType, ##__VA_ARGS__)
 
-                for (auto& child : state->children) {
+        /*
+            先写入日志再投递的事件：多个调用者（包括其他状态机）的记录合并为一次 fdatasync，
+            落盘后才放入队列，返回的 Completion 在落盘后完成，写入失败时抛出异常且事件不投递。
+            与 ADD_EVENT_TASK 投递的事件之间不保证顺序。队列满时不阻塞日志的写线程，事件放入溢出列表由 worker 线程取走，
+            此时与队列中较早的日志事件之间也不保证顺序。处理完（或过期、没有匹配）后才标记为已应用，
+            被延迟的事件和挂起的协程在停止或崩溃后重新处理。
+        */
+        template<typename FuncType, typename... Args>
+        Completion<void> JournalEventTask(Location&& loc, const char* signature, Args&&... args)
+        {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            if (!journal_.Attached()) {
+                throw std::logic_error("No journal attached to the state machine.");
+            }
+            const auto& codec = journal_.GetCodec(eventIdOf<FuncType>(signature), signature);
+            auto params = std::make_tuple(std::forward<Args>(args)...);
+            const auto& encoder = *std::any_cast<helper::ChangeReturn<FuncType, std::string>>(&codec.encoder_);
+            std::string payload = ApplyCond<FuncType>(encoder, loc, params, std::index_sequence_for<Args...>());
+            auto task_data = std::apply([&](auto&... args) {
+                return makeAsyncTask<FuncType>(std::move(loc), MessageType::EVENT, signature, std::move(args)...);
+            }, params);
+            auto completion = MakeCompletion<void>();
+            journal_.Append(static_cast<uint16_t>(MessageType::EVENT), codec.wire_id_, payload, task_data,
+                [slot = completion.first](std::exception_ptr error) {
+                    if (error) {
+                        slot->SetException(error);
+                    }
+                    else {
+                        slot->SetValue();
+                    }
+                });
+            return completion.second;
+        }
+#endif
+
+#define COALESCE_EVENT(FuncType) \
+        SetCoalesce<FuncType>(#FuncType)
+#define COALESCE_EVENT_BY(FuncType, key) \
+        SetCoalesce<FuncType>(#FuncType, (helper::ChangeReturn<FuncType, uint64_t>)key)
+
+        /*
+            设置事件的合并策略：队列中已经有同类型（以及 key 返回的键相同）且未处理的事件时，新事件替换它的参数，
+            不再排队。key 的参数与处理函数相同，没有 key 时同类型的事件都合并。在 Start 之前调用。
+            只对通过 ADD_EVENT_TASK 和通道发送的事件生效。
+        */
+        template<typename FuncType>
+        void SetCoalesce(const char* signature, helper::ChangeReturn<FuncType, uint64_t> key = nullptr) {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            if (polling_ || workerStarted()) {
+                throw std::logic_error("Coalesce policy must be set before the state machine starts.");
+            }
+            std::any key_func;
+            if (key) {
+                key_func = key;
+            }
+            coalescer_.SetPolicy(eventIdOf<FuncType>(signature), key_func);
+        }
+
+#define SET_DISCRIMINATOR(FuncType, key) \
+        SetDiscriminator<FuncType>(#FuncType, (helper::ChangeReturn<FuncType, int64_t>)key)
+
+        /*
+            设置处理函数类型的分派键提取函数，参数与处理函数相同，在投递任务时调用一次。
+            状态中用 EVENT_KEY、EVENT_RANGE 等注册的处理函数按提取的键查找。在 Start 之前调用。
+        */
+        template<typename FuncType>
+        void SetDiscriminator(const char* signature, helper::ChangeReturn<FuncType, int64_t> key) {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            if (polling_ || workerStarted()) {
+                throw std::logic_error("Discriminator must be set before the state machine starts.");
+            }
+            if (!key) {
+                throw std::invalid_argument("Discriminator can not be empty.");
+            }
+            discriminators_[eventIdOf<FuncType>(signature)] = key;
+        }
+
+        //等待的响应超时，在 worker 线程调用
+        using ResponseTimeout = std::function<void(const Location& loc, uint64_t correlation_id)>;
+
+#define SET_CORRELATION(FuncType, id_of) \
+        SetCorrelation<FuncType>(#FuncType, (helper::ChangeReturn<FuncType, uint64_t>)id_of)
+
+        /*
+            设置响应类型的关联ID提取函数，参数与处理函数相同，在投递响应时调用一次。在 Start 之前调用。
+            关联ID对应 EXPECT_RESPONSE 登记的请求时，响应直接交给登记的处理函数，不再按状态匹配；
+            没有对应的请求（已经超时或不是本状态机发出的）时按普通响应处理。
+        */
+        template<typename FuncType>
+        void SetCorrelation(const char* signature, helper::ChangeReturn<FuncType, uint64_t> id_of) {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            if (polling_ || workerStarted()) {
+                throw std::logic_error("Correlation must be set before the state machine starts.");
+            }
+            if (!id_of) {
+                throw std::invalid_argument("Correlation id extractor can not be empty.");
+            }
+            correlations_[eventIdOf<FuncType>(signature)] = id_of;
+        }
+
+#define EXPECT_RESPONSE(FuncType, timeout, ...) \
+        ExpectResponse<FuncType>(HELPER_FROM_HERE, #FuncType, timeout, __VA_ARGS__)
+
+        /*
+            登记一个发出的请求，返回关联ID，由调用者放在请求中，外部组件在响应（ADD_RESPONSE_TASK）中带回。
+            在 worker 线程（处理函数或轮询线程）调用。响应在 timeout 内到达时在运行步骤中调用 on_response，
+            否则把超时作为一个合成的响应运行，调用 on_timeout，两者只调用一次；timeout 为 0 表示不超时。
+            停止状态机时丢弃等待中的请求，都不调用。
+        */
+        template<typename FuncType>
+        uint64_t ExpectResponse(Location&& loc, const char* signature, std::chrono::milliseconds timeout, FuncType on_response, ResponseTimeout on_timeout) {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            if (!IsInWorkerThread()) {
+                throw std::logic_error("ExpectResponse must be called on the worker thread.");
+            }
+            uint32_t event_id = eventIdOf<FuncType>(signature);
+            if (correlations_.find(event_id) == correlations_.end()) {
+                throw std::logic_error("Response type " + std::string(signature) + " has no correlation id extractor.");
+            }
+            auto deadline = timeout.count() > 0 ? clockNow() + timeout : std::chrono::steady_clock::time_point::max();
+            uint64_t id = outstanding_.Insert({ loc, event_id, std::any(std::move(on_response)), std::move(on_timeout) }, deadline);
+            outstanding_count_.store(outstanding_.Size(), std::memory_order_relaxed);
+            return id;
+        }
+
+        //等待响应的请求数量，可以在任意线程读取
+        size_t GetOutstandingRequestCount() const {
+            return outstanding_count_.load(std::memory_order_relaxed);
+        }
+
+        //等待响应超时的请求数量，可以在任意线程读取
+        uint64_t GetResponseTimeoutCount() const {
+            return response_timeouts_.load(std::memory_order_relaxed);
+        }
+
+        //协程处理函数挂起期间如何处理新的任务
+        enum class SuspendPolicy {
+            BUFFER, //缓存新任务，挂起的运行步骤都结束后按顺序处理，处理函数看到的状态与同步执行时相同
+            INTERLEAVE, //继续处理新任务，挂起的运行步骤恢复时状态可能已经改变
+        };
+
+        //在 Start 之前调用，默认为 BUFFER
+        void SetSuspendPolicy(SuspendPolicy policy) {
+            if (polling_ || workerStarted()) {
+                throw std::logic_error("Suspend policy must be set before the state machine starts.");
+            }
+            suspend_policy_ = policy;
+        }
+
+        //挂起中的运行步骤数量，可以在任意线程读取
+        size_t GetSuspendedStepCount() const {
+            return suspended_.Count();
+        }
+
+        //被合并（没有单独处理）的事件数量，可以在任意线程读取
+        uint64_t GetCoalescedCount() const {
+            return coalescer_.GetMergedCount();
+        }
+
+        //没有指定存活时间的任务在队列中的默认存活时间，0 表示不过期，在 Start 之前调用
+        void SetTaskTtl(std::chrono::milliseconds ttl) {
+            task_ttl_ = ttl;
+        }
+
+        //出队时已经过期而丢弃的任务数量
+        uint64_t GetExpiredCount() const {
+            return expired_total_.load(std::memory_order_relaxed);
+        }
+
+        //出队时已经取消而丢弃的任务数量
+        uint64_t GetCancelledCount() const {
+            return cancelled_total_.load(std::memory_order_relaxed);
+        }
+
+        //替换延迟任务和任务存活时间使用的时钟，用于虚拟时间，在 Start 之前调用
+        void SetClock(std::function<std::chrono::steady_clock::time_point()> clock) {
+            clock_ = clock;
+        }
+
+        /*
+            启用看门狗：处理一个任务（包括它触发的延迟任务重新投递）超过时间上限时调用 handler。
+            处理结束后在 worker 线程通知；启动了 StartWatchdog 时，还在执行的处理函数由看门狗线程通知一次。
+            时间上限依次取 SET_HANDLER_BUDGET、当前状态及上层状态的 budget、default_budget。在 Start 之前调用。
+        */
+        void EnableWatchdog(std::function<void(const SlowHandlerNotice&)> handler, std::chrono::milliseconds default_budget) {
+            watch_.SetHandler(handler);
+            default_budget_ = default_budget;
+        }
+
+#define SET_HANDLER_BUDGET(FuncType, budget) \
+        SetHandlerBudget<FuncType>(#FuncType, budget)
+
+        template<typename FuncType>
+        void SetHandlerBudget(const char* signature, std::chrono::milliseconds budget) {
+            static_assert(is_std_function<std::decay_t<FuncType>>::value, "Parameter must be std::function type");
+            handler_budgets_[eventIdOf<FuncType>(signature)] = budget;
+        }
+
+        //超时的处理次数，可以在任意线程读取
+        uint64_t GetSlowHandlerCount() const {
+            return watch_.GetSlowCount();
+        }
+
+        //按签名ID统计的超时次数
+        std::unordered_map<uint32_t, uint64_t> GetSlowHandlerCounts() {
+            return watch_.GetSlowCounts();
+        }
+
+        //启动全局看门狗线程，每隔 interval 检查一次所有启用了看门狗的状态机
+        static void StartWatchdog(std::chrono::milliseconds interval) {
+            MachineRegistry::Instance(); //先构造注册表，保证注册表在看门狗线程之后析构
+            WatchdogThread::Instance().Start(interval, [](std::vector<HandlerWatch::Alert>& alerts) {
+                MachineRegistry::Instance().VisitAll([&alerts](StateMachine& machine) { machine.watch_.Check(alerts); });
+            });
+        }
+
+        static void StopWatchdog() {
+            MachineRegistry::Instance();
+            WatchdogThread::Instance().Stop();
+        }
+
+        /*
+            worker 线程绑定到 cpus 中的核，realtime_priority 大于 0 时使用实时调度（SCHED_FIFO），在 Start 之前调用。
+            设置失败（例如没有权限）时通过异常处理函数通知，状态机继续运行。
+            只影响 worker 线程在哪里运行，不影响内存的位置：状态机对象、状态树、任务队列和 Start 中建立的查找表
+            都在构造或调用 Start 的线程分配（首次写入也在那里），要让它们在 worker 所在的 NUMA 节点上，
+            需要在该节点的线程上构造并启动状态机，或者传入从该节点分配的 memory_resource。
+        */
+        void SetWorkerAffinity(const std::vector<int>& cpus, int realtime_priority = 0) {
+            worker_cpus_ = cpus;
+            realtime_priority_ = realtime_priority;
+        }
+
+        //worker 线程所在的 NUMA 节点，线程启动前为 -1
+        int GetWorkerNumaNode() const {
+            return worker_node_.load(std::memory_order_acquire);
+        }
+
+        /*
+            访问分组中离调用线程最近的一个状态机：优先 worker 绑定在调用线程所在核上的，
+            其次 worker 在同一 NUMA 节点上的，都没有时访问分组中的任意一个，分组为空时返回 false。
+            这里只比较 worker 线程的位置，状态机的内存在哪个节点取决于在哪里构造（见 SetWorkerAffinity）。
+        */
+        template<typename F>
+        static bool VisitLocal(const std::string& group, F&& func) {
+            int cpu = CurrentCpu();
+            int node = CurrentNumaNode();
+            return MachineRegistry::Instance().VisitPreferred(group, func,
+                [cpu](StateMachine& machine) {
+                    return cpu >= 0 && std::find(machine.worker_cpus_.begin(), machine.worker_cpus_.end(), cpu) != machine.worker_cpus_.end();
+                },
+                [node](StateMachine& machine) { return machine.GetWorkerNumaNode() == node; },
+                [](StateMachine&) { return true; });
+        }
+
+        std::pmr::memory_resource* GetMemoryResource() const {
+            return stateId_map_.get_allocator().resource();
+        }
+
+        //设置分组标签，用于广播，在 Start 之前调用
+        void SetGroup(const std::string& group) {
+            group_ = group;
+        }
+
+        const std::string& GetGroup() const {
+            return group_;
+        }
+
+        const std::string& GetName() const {
+            return name_;
+        }
+
+        //当前线程是否是状态机的 worker 线程
+        bool IsInWorkerThread() {
+            return GetWorkerThreadId() == std::this_thread::get_id();
+        }
+
+        virtual bool TransitionRoot()final {
+            return Transition(&this->root);
+        }
+
+        virtual bool TransitionFinal()final {
+            return Transition(&this->final);
+        }
+
+        virtual bool Transition(const std::string& target) final {
+            return Transition(GetState(target));
+        }
+
+        bool IsRoot() {
+            if (states_.empty() || IsInWorkerThread()) {
+                return this->current_state_ == &this->root;
+            }
+            return GetStateSnapshot().state_ == this->root.index_;
+        }
+
+        bool IsFinal() {
+            if (states_.empty() || IsInWorkerThread()) {
+                return this->current_state_ == &this->final;
+            }
+            return GetStateSnapshot().state_ == this->final.index_;
+        }
+
+        void SetExceptionHandler(std::function<void(const std::exception*)> handler) {
+            exception_handler_ = handler;
+        }
+
+        //未匹配任务的轻量通知，在 worker 线程调用
+        void SetUnmatchedHandler(std::function<void(const UnmatchedNotice&)> handler) {
+            unmatched_handler_ = handler;
+        }
+
+        //同一签名的未匹配任务在 interval 内只通知一次，其余只计数，0 表示每次都通知
+        void SetUnmatchedReportInterval(std::chrono::milliseconds interval) {
+            unmatched_report_interval_ = interval;
+        }
+
+        //未匹配任务总数，可以在任意线程读取
+        uint64_t GetUnmatchedCount() const {
+            return unmatched_total_.load(std::memory_order_relaxed);
+        }
+
+        //按签名ID统计的未匹配次数，签名用 EventIdRegistry::Name 取得
+        std::unordered_map<uint32_t, uint64_t> GetUnmatchedCounts() {
+            std::unique_lock<std::mutex> lck(unmatched_mtx_);
+            std::unordered_map<uint32_t, uint64_t> counts;
+            for (const auto& counter : unmatched_counters_) {
+                counts.emplace(counter.first, counter.second.count_);
+            }
+            return counts;
+        }
+
+        //设置 worker 线程等待任务的方式，对延迟敏感的状态机使用忙等，在 Start 之前调用
+        void SetWaitStrategy(WaitStrategy strategy,
+                             std::chrono::microseconds spin = std::chrono::microseconds(50),
+                             std::chrono::microseconds yield = std::chrono::microseconds(50)) {
+            task_queue_.SetWaitStrategy(strategy, spin, yield);
+        }
+
+        //设置并发处理 parallel 分支的执行器，没有设置时 concurrent 分支在 worker 线程依次处理（仍广播到所有分支）
+        void SetRegionExecutor(std::shared_ptr<ThreadPool> executor) {
+            region_executor_ = executor;
+        }
+
+        /*
+            worker 线程空闲超过 idle 后休眠：只释放线程，并收缩队列的空闲存储。状态机对象（状态树、处理函数、
+            当前状态）仍然常驻内存，不做持久化，所以休眠节省的是线程，不是状态机本身占用的内存。
+            下一个任务放入队列时重新创建 worker 线程，从原来的状态继续，不再执行 onentry。
+            有延迟任务，或者使用了通道、共享内存输入时不休眠。0 表示不休眠，在 Start 之前调用。
+        */
+        void SetHibernation(std::chrono::milliseconds idle) {
+            worker_.SetIdle(idle);
+        }
+
+        using HibernationStats = helper::HibernationStats;
+
+        //可以在任意线程读取
+        HibernationStats GetHibernationStats() {
+            return worker_.GetStats();
+        }
+
+        //设置延迟任务的上限和存活时间，ttl 为 0 表示不过期，在 Start 之前调用
+        void SetDeferLimit(std::size_t max_deferred, std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+            max_deferred_ = max_deferred;
+            defer_ttl_ = ttl;
+        }
+
+    protected:
+        State root;
+        Final final;
+    private:
+        struct DeferredTask {
+            std::shared_ptr<TaskData> task_data_;
+            std::chrono::steady_clock::time_point expire_;
+        };
+
+        struct UnmatchedCounter {
+            uint64_t count_ = 0;
+            uint64_t suppressed_ = 0;
+            std::chrono::steady_clock::time_point last_report_;
+        };
+
+        BaseState* current_state_ = nullptr;
+        std::pmr::map<std::string, BaseState*> stateId_map_;
+        HibernatingWorker worker_; //worker 线程，空闲时休眠
+        std::atomic<std::thread::id> worker_id_{ std::thread::id() }; //worker 线程启动时设置
+        bool* thread_is_run_ = nullptr;
+        std::atomic<bool> polling_{ false }; //由外部事件循环驱动
+        std::atomic<bool> poll_discard_{ false }; //其他线程停止轮询时不处理剩余的任务
+        std::atomic<bool> queue_closed_{ false }; //停止后不再处理队列，之后放入的任务直接取消
+        bool in_step_ = false; //worker 线程正在执行运行步骤（处理任务或进入初始状态）
+        const TaskData* step_task_ = nullptr; //正在执行的运行步骤的任务，挂起时复制位置信息和日志序号
+        bool step_suspended_ = false; //step_task_ 的处理函数在 co_await 处挂起了，日志标记推迟到协程结束
+        SuspendPolicy suspend_policy_ = SuspendPolicy::BUFFER;
+        SuspendedSteps suspended_; //挂起中的运行步骤
+        std::deque<std::shared_ptr<TaskData>> buffered_; //BUFFER 策略下挂起期间到达的任务
+        bool redispatch_pending_ = false; //挂起期间发生了转移，挂起的步骤都结束后再重新投递延迟任务
+        std::thread::id poll_thread_id_;
+        std::vector<std::shared_ptr<TaskData>> poll_batch_;
+        helper::MessageBuffer<std::shared_ptr<TaskData>, std::pmr::polymorphic_allocator<std::shared_ptr<TaskData>>> task_queue_;
+        std::string name_; //状态机名称，也用作线程名称
+        std::string group_; //分组标签
+        MachineRegistry::HandlePtr registry_handle_;
+        std::function<void(const std::exception*)> exception_handler_ = nullptr;
+        std::vector<int> worker_cpus_;
+        int realtime_priority_ = 0;
+        std::atomic<int> worker_node_{ -1 };
+        std::chrono::milliseconds default_budget_{ 0 };
+        std::unordered_map<uint32_t, std::chrono::milliseconds> handler_budgets_; //启动后不再变化
+        std::vector<std::chrono::milliseconds> state_budgets_; //按状态句柄索引，状态及上层状态的 budget 或 default_budget
+        bool watch_enabled_ = false; //启用了看门狗且配置了时间上限，parseStates 中计算
+        HandlerWatch watch_;
+        std::function<void(const UnmatchedNotice&)> unmatched_handler_ = nullptr;
+        std::chrono::milliseconds unmatched_report_interval_{ 0 };
+        std::mutex unmatched_mtx_;
+        std::pmr::unordered_map<uint32_t, UnmatchedCounter> unmatched_counters_; //在 worker 线程更新，GetUnmatchedCounts 在其他线程读取
+        std::atomic<uint64_t> unmatched_total_{ 0 };
+        std::pmr::list<DeferredTask> deferred_tasks_; //延迟任务，按到达顺序保存，只在 worker 线程访问
+        std::size_t max_deferred_ = 1024;
+        std::chrono::milliseconds defer_ttl_{ 0 };
+        uint64_t transition_count_ = 0; //状态转移计数，用于判断任务处理过程中是否发生了转移
+        std::pmr::vector<BaseState*> states_; //按状态句柄索引，启动后不再变化
+        size_t state_count_ = 0;
+        std::unique_ptr<std::atomic<bool>[]> state_flags_; //按状态句柄索引，状态是否在发布的活动配置中
+        std::pmr::vector<uint8_t> state_scratch_; //只在 worker 线程访问
+        std::atomic<uint64_t> state_word_{ 0 }; //发布的快照：高32位是状态转移计数，低32位是当前状态句柄
+        std::atomic<uint64_t> state_seq_{ 0 }; //发布的序号，奇数表示正在发布，读者在前后序号相同时才采用读到的值
+        uint64_t published_count_ = UINT64_MAX; //最近一次发布时的状态转移计数
+        std::mutex state_mtx_;
+        std::condition_variable state_cv_;
+        std::atomic<int> state_waiters_{ 0 }; //在 WaitForState 中等待的线程数，没有等待时发布不加锁
+        std::shared_ptr<ThreadPool> region_executor_;
+        bool regions_running_ = false; //正在并发处理 parallel 分支，分支中的状态转移先记录，汇合后再执行
+        std::mutex region_mtx_;
+        std::vector<std::vector<BaseState*>> region_transitions_; //按分支记录的状态转移
+        std::vector<std::shared_ptr<Channel>> channels_; //发往本状态机的通道，启动后不再变化
+        size_t next_source_ = 0; //轮询任务来源的起点，0 是 task_queue_，之后依次是各个通道和共享内存
+        std::unordered_map<uint32_t, std::any> discriminators_; //事件ID到分派键提取函数，启动后不再变化
+        std::unordered_map<uint32_t, std::any> correlations_; //事件ID到关联ID提取函数，启动后不再变化
+        struct OutstandingRequest {
+            Location loc_;
+            uint32_t event_id_ = 0;
+            std::any on_response_;
+            ResponseTimeout on_timeout_;
+        };
+        CorrelationTable<OutstandingRequest> outstanding_; //等待响应的请求，只在 worker 线程访问
+        std::atomic<size_t> outstanding_count_{ 0 };
+        std::atomic<uint64_t> response_timeouts_{ 0 };
+        struct KeyRange {
+            int64_t low_;
+            int64_t high_;
+            const Matching* matching_;
+        };
+        struct KeyTable {
+            std::unordered_map<int64_t, const Matching*> keys_;
+            std::vector<KeyRange> ranges_; //按 low_ 排序，互不重叠
+        };
+        //按状态句柄索引，每个状态中消息类型和事件ID到键表，没有按键分派的处理函数时为空
+        std::vector<std::unordered_map<uint64_t, KeyTable>> key_index_;
+        Coalescer<TaskData> coalescer_;
+        std::chrono::milliseconds task_ttl_{ 0 };
+        std::function<std::chrono::steady_clock::time_point()> clock_; //为空时使用 steady_clock
+        std::atomic<uint64_t> expired_total_{ 0 };
+        std::atomic<uint64_t> cancelled_total_{ 0 };
+        std::atomic<int64_t> drain_deadline_{ 0 }; //StopAll 的处理期限（steady_clock 纳秒），0 表示没有
+#if defined(__LINUX__) || defined(__ANDROID__)
+        using IngressDecoder = std::function<std::shared_ptr<TaskData>(MessageType, const void*, size_t)>;
+        std::shared_ptr<ShmRing> ingress_;
+        std::unordered_map<uint32_t, IngressDecoder> ingress_decoders_;
+        std::atomic<uint64_t> ingress_dropped_{ 0 };
+        JournalBinding<TaskData> journal_;
+#endif
+        CommittedOverflow<std::shared_ptr<TaskData>> committed_; //队列满时日志写线程放在这里的任务，作为一个来源由 worker 线程取走
+    private:
+        static Allocator allocatorOf(std::pmr::memory_resource* resource) {
+            return Allocator(resource ? resource : std::pmr::get_default_resource());
+        }
+
+        /*
+            函数类型和签名对应的ID。签名来自宏展开的字符串字面量，地址不变，按地址缓存在每个线程中，
+            避免每个任务都拼接签名字符串；内容相同、地址不同的签名驻留后仍是同一个ID。
+        */
+        template<typename FuncType>
+        static uint32_t eventIdOf(const char* signature) {
+            thread_local std::unordered_map<const char*, uint32_t> ids;
+            auto it = ids.find(signature);
+            if (it != ids.end()) {
+                return it->second;
+            }
+            uint32_t id = EventIdRegistry::Intern(std::string(typeid(FuncType).name()) + signature);
+            ids.emplace(signature, id);
+            return id;
+        }
+
+        /*
+            请求任务：完成槽和参数都放在任务记录中，只分配一次。
+            处理函数、条件函数只捕获任务记录的指针，不会再为 std::function 分配内存。
+        */
+        template<typename FuncType, typename ArgTuple>
+        class RequestTask : public TaskData {
+        public:
+            template<typename... Args>
+            RequestTask(const Location& loc, MessageType type, uint32_t event_id, Args&&... args)
+                :TaskData(loc, type, event_id), args_(std::forward<Args>(args)...) {}
+            ArgTuple args_;
+            OneShot<typename StepResult<typename FuncType::result_type>::type> result_; //处理函数是协程时保存协程的结果
+        };
+
+        //调用处理函数并写入完成槽：丢弃的任务以异常结束，没有匹配的请求返回默认值，处理函数的异常交给调用者
+        template<typename FuncType, typename Request, typename Invoke>
+        static void completeRequest(Request& request, const std::any& func_, Invoke&& invoke) {
+            using RetType = typename FuncType::result_type;
+            try {
+                if (func_.type() == typeid(std::exception_ptr)) {
+                    request.result_.SetException(std::any_cast<std::exception_ptr>(func_));
+                    return;
+                }
+                if (!func_.has_value()) {
+                    request.result_.SetUnmatched();
+                    return;
+                }
+                const FuncType& func = *std::any_cast<FuncType>(&func_);
+                if constexpr (StepResult<RetType>::kIsStep) {
+                    //协程处理函数执行完时写入完成槽，挂起期间由协程持有任务记录和处理函数（lambda 的捕获）；
+                    //没有执行完就被销毁时以 TaskCancelled 结束
+                    auto record = std::static_pointer_cast<Request>(request.shared_from_this());
+                    auto handler = std::make_shared<FuncType>(func);
+                    invoke(*handler).OnDone([record, handler](auto& promise) {
+                        if (!promise.finished_) {
+                            record->result_.SetException(std::make_exception_ptr(TaskCancelled(record->type_, record->GetSignature())));
+                        }
+                        else if (promise.error_) {
+                            record->result_.SetException(std::exchange(promise.error_, nullptr));
+                        }
+                        else if constexpr (std::is_void_v<typename StepResult<RetType>::type>) {
+                            record->result_.SetValue();
+                        }
+                        else {
+                            record->result_.SetValue(std::move(*promise.value_));
+                        }
+                    });
+                }
+                else if constexpr (std::is_void_v<RetType>) {
+                    invoke(func);
+                    request.result_.SetValue();
+                }
+                else {
+                    request.result_.SetValue(invoke(func));
+                }
+            }
+            catch (...) {
+                request.result_.SetException(std::current_exception());
+            }
+        }
+
+        //添加阻塞的请求：参数以引用保存，调用者等待结果期间一直有效
+        template<typename FuncType, typename... Args>
+        auto AddTask(std::chrono::milliseconds ttl, Location&& loc, MessageType&& type, const char * signature, Args&&... args)
+        {
+            using Request = RequestTask<FuncType, std::tuple<Args&&...>>;
+            auto task_data = std::make_shared<Request>(loc, type, eventIdOf<FuncType>(signature), std::forward<Args>(args)...);
+            setDeadline(*task_data, ttl.count() > 0 ? ttl : task_ttl_);
+
+            Request* request = task_data.get();
+            task_data->task_ = [request](std::any func_)->void {
+                completeRequest<FuncType>(*request, func_, [request](const FuncType& func) {
+                    return ApplyHandler<FuncType>(func, request->loc_, request->args_, std::index_sequence_for<Args...>());
+                });
+            };
+
+            task_data->cond_ = [request](std::any cond_)->bool {
+                if (!cond_.has_value()) {
+                    return true;
+                }
+                const auto& cond = *std::any_cast<helper::ChangeReturn<FuncType, bool>>(&cond_);
+                //条件检查不能移走参数，处理函数还要使用
+                return ApplyCond<FuncType>(cond, request->loc_, request->args_, std::index_sequence_for<Args...>());
+            };
+
+            if (!discriminators_.empty()) {
+                setDispatchKey<FuncType>(*task_data, task_data->loc_, task_data->args_);
+            }
+            submitRequest(task_data);
+
+            return task_data;
+        }
+
+        template<typename FuncType, typename... Args>
+        auto AsyncAddTask(std::chrono::milliseconds ttl, Location&& loc, MessageType&& type, const char* signature, Args&&... args)->CancelToken
+        {
+            auto task_data = makeAsyncTask<FuncType>(std::forward<Location>(loc), std::forward<MessageType>(type), signature, std::forward<Args>(args)...);
+            if (ttl.count() > 0) {
+                setDeadline(*task_data, ttl);
+            }
+            putTask(task_data);
+            return CancelToken(task_data);
+        }
+
+        std::chrono::steady_clock::time_point clockNow() const {
+            return clock_ ? clock_() : std::chrono::steady_clock::now();
+        }
+
+        void setDeadline(TaskData& task_data, std::chrono::milliseconds ttl) {
+            if (ttl.count() > 0) {
+                task_data.deadline_ = clockNow() + ttl;
+            }
+        }
+
+        template<typename FuncType, typename... Args>
+        auto makeAsyncTask(Location&& loc, MessageType&& type, const char* signature, Args&&... args)->std::shared_ptr<TaskData>
+        {
+            auto task_data = std::make_shared<StateMachine::TaskData>(loc, type, eventIdOf<FuncType>(signature));
+            //参数使用临时变量，条件函数和处理函数共享同一份参数，任务被延迟后参数仍然有效
+            using ArgTuple = std::tuple<std::decay_t<Args>...>;
+            auto params = std::make_shared<ArgTuple>(std::forward<Args>(args)...);
+            auto func = [loc, params](std::any func_)->void {
+                if (!func_.has_value()) {
+                    return ;
+                }
+                if constexpr (StepResult<typename FuncType::result_type>::kIsStep) {
+                    //协程结束前保持处理函数（lambda 的捕获）、参数和位置有效，任务记录释放后引用形参仍然可以访问
+                    auto handler = std::make_shared<FuncType>(std::any_cast<FuncType>(std::move(func_)));
+                    auto step_loc = std::make_shared<const Location>(loc);
+                    ApplyHandler<FuncType>(*handler, *step_loc, *params, std::index_sequence_for<Args...>())
+                        .OnDone([handler, params, step_loc](auto&) {});
+                    return;
+                }
+                ApplyHandler<FuncType>(std::any_cast<FuncType>(func_), loc, *params, std::index_sequence_for<Args...>());
+            };
+
+            //在这里使用统一的packpaged类型
+            auto taskPack = std::make_shared<std::packaged_task<void(std::any func_)>>(func);
+
+            task_data->task_ = [taskPack](std::any func_)->void { (*taskPack)(func_); };
+
+            auto cond = [loc, params](std::any cond_)->bool {
+                if (!cond_.has_value()) {
+                    return true;
+                }
+                auto cond = std::any_cast<helper::ChangeReturn<FuncType, bool>>(cond_);
+                return ApplyCond<FuncType>(cond, loc, *params, std::index_sequence_for<Args...>());
+            };
+
+            task_data->cond_ = cond;
+            setDeadline(*task_data, task_ttl_);
+            setDispatchKey<FuncType>(*task_data, loc, *params);
+            if (type == MessageType::RESPONSE) {
+                setCorrelationId<FuncType>(*task_data, loc, *params);
+            }
+
+            if (type == MessageType::EVENT) {
+                if (auto policy = coalescer_.FindPolicy(task_data->event_id_)) {
+                    task_data->coalesced_ = true;
+                    if (policy->has_value()) {
+                        auto key = std::any_cast<helper::ChangeReturn<FuncType, uint64_t>>(*policy);
+                        task_data->coalesce_key_ = ApplyCond<FuncType>(key, loc, *params, std::index_sequence_for<Args...>());
+                    }
+                }
+            }
+
+            if constexpr (IsSharedCallable<FuncType>::value && std::is_copy_constructible_v<ArgTuple>) {
+                task_data->shared_task_ = [loc, params](std::any func_)->void {
+                    if (!func_.has_value()) {
+                        return;
+                    }
+                    ApplyShared<FuncType>(std::any_cast<FuncType>(func_), loc, *params, std::index_sequence_for<Args...>());
+                };
+            }
+            return task_data;
+        }
+
+        /*
+            在 worker 线程发起请求时排队等待会死锁：不在运行步骤中直接执行，在运行步骤中抛出异常。
+            同一线程轮询的其他状态机的处理函数发来的请求在这里直接执行；互相请求形成回环时（A 请求 B，B 的处理函数又请求 A）
+            A 仍在运行步骤中，抛出异常。
+        */
+        void submitRequest(const std::shared_ptr<TaskData>& task_data) {
+            if (currentRegionOwner() == this) {
+                throw std::logic_error("Request task issued from a concurrent region of the same state machine would deadlock.");
+            }
+            if (!IsInWorkerThread()) {
+                putTask(task_data);
+                return;
+            }
+            if (in_step_) {
+                throw std::logic_error("Request task issued from a handler of the same state machine would deadlock.");
+            }
+            runStep(task_data, nullptr); //调用者等待结果，挂起期间也不缓存
+        }
+
+        //在 worker 线程且不在运行步骤中直接执行，否则排队
+        void submitAsync(const std::shared_ptr<TaskData>& task_data) {
+            if (IsInWorkerThread() && !in_step_) {
+                processStep(task_data, nullptr);
+                return;
+            }
+            putTask(task_data);
+        }
+
+        void registerMachine() {
+            if (!registry_handle_) {
+                registry_handle_ = MachineRegistry::Instance().Add(this, name_, group_);
+            }
+        }
+
+        //所有任务都从这里放入队列
+        void putTask(const std::shared_ptr<TaskData>& task_data) {
+            if (task_data->coalesced_ && coalesceTask(task_data)) {
+                return;
+            }
+            try {
+                task_queue_.Put(task_data);
+            }
+            catch (...) {
+                releaseCoalesced(*task_data);
+                throw;
+            }
+            if (queue_closed_.load(std::memory_order_seq_cst)) {
+                cancelQueued(); //状态机已经停止，没有线程再处理队列
+                return;
+            }
+            if (worker_.Enabled()) {
+                wakeFromHibernation();
+            }
+        }
+
+        //任务放入队列后调用，与 hibernate 中先公开休眠再检查队列配对，状态机休眠时重新创建 worker 线程
+        void wakeFromHibernation() {
+            worker_.Wake([this]() {
+                worker_id_.store(std::thread::id(), std::memory_order_release);
+                return std::thread(&StateMachine::Run, this, true);
+            });
+        }
+
+        //在 worker 线程调用，没有待处理的任务时进入休眠，返回 true 后 worker 线程直接退出
+        bool hibernate() {
+            if (!deferred_tasks_.empty() || !channels_.empty() || !buffered_.empty()
+                || outstanding_.NextDeadline() != std::chrono::steady_clock::time_point::max()) {
+                return false;
+            }
+#if defined(__LINUX__) || defined(__ANDROID__)
+            if (ingress_) {
+                return false;
+            }
+#endif
+            //之后放入的任务由放入的线程唤醒
+            return worker_.Enter([this]() { return task_queue_.HasData(); }, [this]() { return task_queue_.Shrink(); });
+        }
+
+        //停止休眠中的状态机，线程已经退出，只需要回收，不是休眠状态时返回 false
+        bool stopHibernated() {
+            return worker_.StopHibernated([this]() {
+                worker_id_.store(std::thread::id(), std::memory_order_release);
+                delete thread_is_run_;
+                thread_is_run_ = nullptr;
+                abandonPending();
+            });
+        }
+
+        //有同键的待处理任务时把参数替换到待处理任务中，返回 true；否则登记为待处理任务，返回 false
+        //已经取消或过期的待处理任务不再合并，由新任务替换登记
+        bool coalesceTask(const std::shared_ptr<TaskData>& task_data) {
+            return coalescer_.Merge(task_data,
+                [this](const TaskData& pending) {
+                    return pending.state_.load(std::memory_order_acquire) == TaskData::PENDING && !isExpired(pending);
+                },
+                [this](TaskData& pending, TaskData& task) {
+                    pending.loc_ = task.loc_;
+                    pending.task_ = std::move(task.task_);
+                    pending.cond_ = std::move(task.cond_);
+                    pending.shared_task_ = std::move(task.shared_task_);
+                    pending.deadline_ = task.deadline_;
+                    //分派键由参数计算，和参数一起替换
+                    pending.keyed_ = task.keyed_;
+                    pending.key_ = task.key_;
+                    pending.key_of_ = std::move(task.key_of_);
+                    if (task.journal_lsn_ != 0) {
+                        //待处理任务带上新的参数，被替换的日志记录不再恢复
+                        markApplied(pending);
+                        pending.journal_lsn_ = task.journal_lsn_;
+                    }
+                    task.state_.store(TaskData::STARTED, std::memory_order_relaxed);
+                });
+        }
+
+        //任务出队、取消、过期或停止时丢弃后不再接受合并
+        void releaseCoalesced(const TaskData& task_data) {
+            coalescer_.Release(task_data);
+        }
+
+        //有提取函数时，投递任务时计算一次分派键
+        template<typename FuncType, typename Tuple>
+        void setDispatchKey(TaskData& task_data, const Location& loc, Tuple& params) {
+            if (discriminators_.empty()) {
+                return;
+            }
+            auto discriminator = discriminators_.find(task_data.event_id_);
+            if (discriminator == discriminators_.end()) {
+                return;
+            }
+            auto key = std::any_cast<helper::ChangeReturn<FuncType, int64_t>>(discriminator->second);
+            task_data.key_ = ApplyCond<FuncType>(key, loc, params, std::make_index_sequence<std::tuple_size_v<Tuple>>());
+            task_data.keyed_ = true;
+        }
+
+        //有提取函数时，投递响应时计算一次关联ID
+        template<typename FuncType, typename Tuple>
+        void setCorrelationId(TaskData& task_data, const Location& loc, Tuple& params) {
+            if (correlations_.empty()) {
+                return;
+            }
+            auto correlation = correlations_.find(task_data.event_id_);
+            if (correlation == correlations_.end()) {
+                return;
+            }
+            const auto& id_of = *std::any_cast<helper::ChangeReturn<FuncType, uint64_t>>(&correlation->second);
+            task_data.correlation_id_ = ApplyCond<FuncType>(id_of, loc, params, std::make_index_sequence<std::tuple_size_v<Tuple>>());
+            task_data.correlated_ = true;
+        }
+
+        /*
+            广播任务：参数只保存一份，作为只读数据被所有目标状态机共享，处理函数可以被多个 worker 线程并发调用。
+            返回的函数为每个目标构造一个任务记录，取消、认领等状态各自独立。
+        */
+        template<typename FuncType, typename... Args>
+        static auto makeSharedTask(const Location& loc, MessageType type, const char* signature, Args&&... args)
+        {
+            using ArgTuple = std::tuple<std::decay_t<Args>...>;
+            std::shared_ptr<const ArgTuple> params = std::make_shared<const ArgTuple>(std::forward<Args>(args)...);
+            uint32_t event_id = eventIdOf<FuncType>(signature);
+            return [loc, type, event_id, params]() {
+                auto task_data = std::make_shared<StateMachine::TaskData>(loc, type, event_id);
+                task_data->task_ = [loc, params](std::any func_)->void {
+                    if (!func_.has_value()) {
+                        return;
+                    }
+                    ApplyShared<FuncType>(std::any_cast<FuncType>(func_), loc, *params, std::index_sequence_for<Args...>());
+                };
+                task_data->shared_task_ = task_data->task_;
+                task_data->cond_ = [loc, params](std::any cond_)->bool {
+                    if (!cond_.has_value()) {
+                        return true;
+                    }
+                    auto cond = std::any_cast<helper::ChangeReturn<FuncType, bool>>(cond_);
+                    return ApplyShared<FuncType>(cond, loc, *params, std::index_sequence_for<Args...>());
+                };
+                task_data->key_of_ = [loc, params](const std::any& key_)->int64_t {
+                    auto key = std::any_cast<helper::ChangeReturn<FuncType, int64_t>>(key_);
+                    return ApplyShared<FuncType>(key, loc, *params, std::index_sequence_for<Args...>());
+                };
+                return task_data;
+            };
+        }
+
+        //解析状态机结构
+        //在启动线程解析状态树并分配状态句柄，之后其他线程可以读取状态树的结构
+        void parseStates() {
+            states_.clear();
+            this->ParseState(&this->root, nullptr);
+            this->final.index_ = static_cast<uint32_t>(states_.size());
+            states_.push_back(&this->final);
+            state_count_ = states_.size();
+            for (auto state : states_) {
+                state->concurrent_root_ = nullptr;
+                for (auto ancestor = state; ancestor != nullptr; ancestor = ancestor->parent) {
+                    auto parallel = dynamic_cast<typename State::Parallel*>(ancestor);
+                    if (parallel && parallel->concurrent) {
+                        state->concurrent_root_ = parallel;
+                    }
+                }
+            }
+            //看门狗的时间上限按状态预先计算，运行步骤中不再向上查找
+            state_budgets_.assign(state_count_, default_budget_);
+            watch_enabled_ = !handler_budgets_.empty();
+            for (auto state : states_) {
+                for (auto ancestor = state; ancestor != nullptr; ancestor = ancestor->parent) {
+                    auto with_budget = dynamic_cast<State*>(ancestor);
+                    if (with_budget && with_budget->budget.count() > 0) {
+                        state_budgets_[state->index_] = with_budget->budget;
+                        break;
+                    }
+                }
+                watch_enabled_ = watch_enabled_ || state_budgets_[state->index_].count() > 0;
+            }
+            watch_enabled_ = watch_enabled_ && watch_.HasHandler();
+            state_flags_.reset(new std::atomic<bool>[state_count_]);
+            for (size_t i = 0; i < state_count_; ++i) {
+                state_flags_[i].store(false, std::memory_order_relaxed);
+            }
+            state_scratch_.assign(state_count_, 0);
+            buildKeyIndex();
+            published_count_ = UINT64_MAX;
+            this->current_state_ = &this->root;
+            state_word_.store(this->root.index_, std::memory_order_release);
+        }
+
+        //发布活动配置：活动状态和它们的祖先标记为在配置中，只在发生了状态转移后更新
+        void publishState() {
+            if (published_count_ == transition_count_ || states_.empty()) {
+                return;
+            }
+            published_count_ = transition_count_;
+            std::fill(state_scratch_.begin(), state_scratch_.end(), 0);
+            for (auto state : states_) {
+                if (!state->active_) {
+                    continue;
+                }
+                for (auto ancestor = state; ancestor && !state_scratch_[ancestor->index_]; ancestor = ancestor->parent) {
+                    state_scratch_[ancestor->index_] = 1;
+                }
+            }
+            //顺序锁：标记和快照在两次序号增加之间写入，读者看到序号变化时重读
+            uint64_t seq = state_seq_.load(std::memory_order_relaxed);
+            state_seq_.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < state_count_; ++i) {
+                if (state_flags_[i].load(std::memory_order_relaxed) != (state_scratch_[i] != 0)) {
+                    state_flags_[i].store(state_scratch_[i] != 0, std::memory_order_relaxed);
+                }
+            }
+            state_word_.store((static_cast<uint64_t>(static_cast<uint32_t>(transition_count_)) << 32) | this->current_state_->index_,
+                              std::memory_order_relaxed);
+            state_seq_.store(seq + 2, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (state_waiters_.load(std::memory_order_relaxed) > 0) {
+                std::unique_lock<std::mutex> lck(state_mtx_);
+                state_cv_.notify_all();
+            }
+        }
+
+        static StateSnapshot snapshotOf(uint64_t word) {
+            return { static_cast<StateHandle>(word & 0xFFFFFFFF), static_cast<uint32_t>(word >> 32) };
+        }
+
+        //按顺序锁读取发布的活动配置，读取期间发生了发布时重读
+        template<typename Read>
+        auto readPublished(Read&& read) const -> decltype(read()) {
+            while (true) {
+                uint64_t begin = state_seq_.load(std::memory_order_acquire);
+                if (begin & 1) {
+                    CpuRelax();
+                    continue;
+                }
+                auto result = read();
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (state_seq_.load(std::memory_order_relaxed) == begin) {
+                    return result;
+                }
+            }
+        }
+
+        static uint64_t keyTableId(MessageType type, uint32_t event_id) {
+            return (static_cast<uint64_t>(static_cast<uint32_t>(type)) << 32) | event_id;
+        }
+
+        //为按键分派的处理函数建立索引，缺少提取函数、键重复或范围重叠时抛出 std::logic_error
+        void buildKeyIndex() {
+            key_index_.clear();
+            for (auto base : states_) {
+                auto state = dynamic_cast<State*>(base);
+                if (!state) {
+                    continue;
+                }
+                for (const auto& c : state->match) {
+                    if (!c.keyed_) {
+                        continue;
+                    }
+                    if (discriminators_.find(c.event_id_) == discriminators_.end()) {
+                        throw std::logic_error("Keyed handler has no discriminator: " + c.signature_);
+                    }
+                    if (key_index_.empty()) {
+                        key_index_.resize(state_count_);
+                    }
+                    auto& table = key_index_[state->index_][keyTableId(c.type_, c.event_id_)];
+                    if (c.key_.low_ == c.key_.high_) {
+                        if (!table.keys_.emplace(c.key_.low_, &c).second) {
+                            throw std::logic_error("Duplicate dispatch key " + std::to_string(c.key_.low_) + " in state " + state->GetId() + ": " + c.signature_);
+                        }
+                    }
+                    else {
+                        table.ranges_.push_back({ c.key_.low_, c.key_.high_, &c });
+                    }
+                }
+            }
+            for (auto& tables : key_index_) {
+                for (auto& table : tables) {
+                    auto& ranges = table.second.ranges_;
+                    std::sort(ranges.begin(), ranges.end(), [](const KeyRange& a, const KeyRange& b) { return a.low_ < b.low_; });
+                    for (size_t i = 1; i < ranges.size(); ++i) {
+                        if (ranges[i].low_ <= ranges[i - 1].high_) {
+                            throw std::logic_error("Overlapping dispatch key ranges: " + ranges[i].matching_->signature_);
+                        }
+                    }
+                }
+            }
+        }
+
+        //按键查找状态中的处理函数，没有找到返回 nullptr
+        const Matching* matchKey(const State* state, const TaskData& task_data) const {
+            const auto& tables = key_index_[state->index_];
+            if (tables.empty()) {
+                return nullptr;
+            }
+            auto table = tables.find(keyTableId(task_data.type_, task_data.event_id_));
+            if (table == tables.end()) {
+                return nullptr;
+            }
+            int64_t key = task_data.key_;
+            if (!task_data.keyed_) {
+                auto discriminator = discriminators_.find(task_data.event_id_);
+                if (!task_data.key_of_ || discriminator == discriminators_.end()) {
+                    return nullptr;
+                }
+                key = task_data.key_of_(discriminator->second);
+            }
+            auto exact = table->second.keys_.find(key);
+            if (exact != table->second.keys_.end()) {
+                return exact->second;
+            }
+            const auto& ranges = table->second.ranges_;
+            auto range = std::upper_bound(ranges.begin(), ranges.end(), key, [](int64_t k, const KeyRange& r) { return k < r.low_; });
+            if (range != ranges.begin() && key <= (--range)->high_) {
+                return range->matching_;
+            }
+            return nullptr;
+        }
+
+        void ParseState(BaseState* baseState, BaseState* parent) {
+            baseState->index_ = static_cast<uint32_t>(states_.size());
+            states_.push_back(baseState);
+            baseState->parent = parent;
+            stateId_map_[baseState->GetId()] = baseState;
+            State* state = dynamic_cast<State*>(baseState);
+            if (state) {
+                for (auto& parallel : state->parallel) {
+                    parallel.second.id = parallel.first;
+                    ParseState(&parallel.second, baseState);
+                }
+
+                for (auto& child : state->children) {
                     child.second.id = child.first;
                     ParseState(&child.second, baseState);
                 }
             }
 
-            auto parallel = dynamic_cast<typename State::Parallel*>(baseState);
-            if (parallel) {
-                for (auto& child : parallel->children_) {
-                    child.second.id = child.first;
-                    ParseState(&child.second, baseState);
-                }
+            auto parallel = dynamic_cast<typename State::Parallel*>(baseState);
+            if (parallel) {
+                for (auto& child : parallel->children_) {
+                    child.second.id = child.first;
+                    ParseState(&child.second, baseState);
+                }
+            }
+
+        }
+
+        virtual bool Transition(BaseState* target_state) final {
+
+            if (target_state && regions_running_) {
+                //并发分支中不能修改活动配置，记录下来等所有分支处理完成后执行
+                std::unique_lock<std::mutex> lck(region_mtx_);
+                auto region = currentRegion();
+                if (region < region_transitions_.size()) {
+                    region_transitions_[region].push_back(target_state);
+                }
+                return true;
+            }
+
+            if (target_state)
+            {
+                ++transition_count_;
+                //从当前状态到目标状态找到最短路径
+                //1、从当前状态->当前状态
+                //2、从当前状态->当前状态的子孙状态
+                //3、从当前状态->兄弟状态
+                //4、从当前状态->父状态
+                //5、从当前状态->父状态的兄弟子状态分支
+
+
+                //构建根到current_state的双向链表
+                std::list<BaseState*> current_state_path_list;
+                {
+                    auto current_state_path = this->current_state_;
+                    current_state_path_list.push_front(current_state_path);
+                    while (current_state_path) {
+                        current_state_path_list.push_front(current_state_path->parent);
+                        current_state_path = current_state_path->parent;
+                    }
+                }
+
+                //构建根到target_state的双向链表
+                std::list<BaseState*> target_state_path_list;
+                {
+                    auto target_state_path = target_state;
+                    target_state_path_list.push_front(target_state_path);
+                    while (target_state_path) {
+                        target_state_path_list.push_front(target_state_path->parent);
+                        target_state_path = target_state_path->parent;
+                    }
+                }
+
+                for (auto rcurr = current_state_path_list.rbegin(); rcurr != current_state_path_list.rend(); ++rcurr)// 逆序 
+                {
+                    auto same_state = std::find(target_state_path_list.begin(), target_state_path_list.end(), *rcurr);
+                    //找到相同的父节点
+                    if (same_state != target_state_path_list.end())
+                    {
+                        //处理离开路径状态
+                        auto leave_state = current_state_path_list.rbegin();
+                        while (leave_state != rcurr) {
+                            processExit(*leave_state);
+                            ++leave_state;
+                        }
+                        //设置当前状态为最短路径根结点
+                        this->current_state_ = *same_state;
+                        if (this->current_state_) {
+                            this->current_state_->active_ = true;
+                        }
+
+                        //处理进入路径状态
+                        auto entry_state = ++same_state;
+                        while (entry_state != target_state_path_list.end()) {
+                            processEntry(*entry_state);
+                            entry_state++;
+                        }
+                        break;
+                    }
+                }
+                return true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        BaseState* GetState(const std::string& stateId) {
+            const auto& state = this->stateId_map_.find(stateId);
+            if (state != stateId_map_.end()) {
+                return state->second;
+            }
+            return nullptr;
+        }
+
+        BaseState* findActiveState(State* state) {
+            if (state->active_ == true) {
+                return state;
+            }
+            else {
+                for (auto& child : state->children) {
+                    auto active_ = findActiveState(&child.second);
+                    if (active_) {
+                        return active_;
+                    }
+                }
+                for (auto& parallel : state->parallel) {
+                    if (parallel.second.active_ == true) {
+                        return &parallel.second;
+                    }
+                }
+                return nullptr;
+            }
+        }
+
+        void processExit(BaseState* leave) {
+            auto* parallel = dynamic_cast<typename State::Parallel*>(leave);
+            if (parallel) {//是parallel状态，离开所有子状态
+                for (auto& child : parallel->children_) {
+                    BaseState* active_state = findActiveState(&child.second);
+                    while (active_state != nullptr && active_state != parallel) {
+                        processExit(active_state);
+                        active_state = active_state->parent;
+                    }
+                }
+            }
+            if (leave) {
+                this->current_state_ = leave;
+                this->current_state_->active_ = false;
+                processOnExit(this->current_state_);
+            }
+        }
+
+        void processEntry(BaseState* entry) {
+
+            if (dynamic_cast<State*>(entry->parent)) {//如果父状态不是parallel是State，设置为非活跃
+                entry->parent->active_ = false;
+            }
+
+            if (entry->active_ == true) { //parallel 状态子状态已经进入过，不需要重新进入
+                return;
+            }
+
+            this->current_state_ = entry;
+            this->current_state_->active_ = true;
+            processOnEntry(this->current_state_);
+
+            auto* parallel = dynamic_cast<typename State::Parallel*>(entry);
+            if (parallel) {//是parallel状态，进入所有子状态
+                for (auto& child : parallel->children_) {
+                    this->current_state_ = &child.second;
+                    child.second.active_ = true;
+                    processOnEntry(&child.second);
+                }
+            }
+        }
+
+        void processOnEntry(const BaseState* entry_state) {
+            for (const auto& action : entry_state->onentry) {
+                if (action) {
+                    action();
+                }
+            }
+        }
+
+        void processOnExit(BaseState* leave_state) {
+            for (const auto& action : leave_state->onexit) {
+                if (action) {
+                    action();
+                }
+            }
+        }
+
+        void runMatching(const Matching& c, TaskData& task_data, bool shared) {
+            if (shared) {
+                task_data.shared_task_(c.func_);
+            }
+            else {
+                task_data.task_(c.func_);
+            }
+            if (!c.target_.empty()) {
+                Transition(c.target_);
+            }
+        }
+
+        bool processTask(BaseState* filterState, std::shared_ptr<TaskData> task_data, bool shared = false) {
+            auto state = dynamic_cast<State*>(filterState);
+            if (state) {
+                if (!key_index_.empty()) {
+                    auto keyed = matchKey(state, *task_data);
+                    if (keyed) {
+                        runMatching(*keyed, *task_data, shared);
+                        return true;
+                    }
+                }
+                for (const auto& c : state->match) {
+                    if (task_data->type_ == c.type_ 
+                        && task_data->event_id_ == c.event_id_
+                        && !c.keyed_
+                        && task_data->cond_(c.cond_)) {
+                        //processCondtion
+                        runMatching(c, *task_data, shared);
+                        return true;
+                    }
+                }
+            }
+
+            auto parallel = dynamic_cast<typename State::Parallel*>(filterState);
+            if (parallel && parallel->concurrent && !regions_running_
+                && task_data->type_ != MessageType::REQUEST && task_data->shared_task_) {
+                return processRegions(parallel, task_data);
+            }
+            if (parallel) {//是parallel状态，匹配所有子分支
+                for (auto& child : parallel->children_) {
+                    auto filter_Parallel = findActiveState(&child.second);
+                    while (filter_Parallel != nullptr && filter_Parallel != parallel) {
+                        if (processTask(filter_Parallel, task_data, shared)) {
+                            return true;
+                        }
+                        else {
+                            filter_Parallel = filter_Parallel->parent;
+                        }
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        //当前线程正在处理的并发分支序号
+        static size_t& currentRegion() {
+            thread_local size_t region = SIZE_MAX;
+            return region;
+        }
+
+        //当前线程正在处理哪个状态机的并发分支
+        static StateMachine*& currentRegionOwner() {
+            thread_local StateMachine* owner = nullptr;
+            return owner;
+        }
+
+        //在一个分支中匹配任务，从分支的活动状态向上到 parallel 状态
+        bool processRegion(typename State::Parallel* parallel, State* region, const std::shared_ptr<TaskData>& task_data) {
+            auto filterState = findActiveState(region);
+            while (filterState != nullptr && filterState != parallel) {
+                if (processTask(filterState, task_data, true)) {
+                    return true;
+                }
+                filterState = filterState->parent;
+            }
+            return false;
+        }
+
+        /*
+            并发处理互相独立的分支：任务广播到每个分支，各分支独立匹配，
+            第一个分支在 worker 线程处理，其余分支提交到 region executor。
+            所有分支处理完成（汇合）后再按分支顺序执行记录的状态转移，
+            先执行分支内部的转移，离开 parallel 状态的转移只执行第一个。
+        */
+        bool processRegions(typename State::Parallel* parallel, const std::shared_ptr<TaskData>& task_data) {
+            std::vector<State*> regions;
+            for (auto& child : parallel->children_) {
+                regions.push_back(&child.second);
+            }
+            std::vector<char> matched(regions.size(), 0);
+            std::vector<std::exception_ptr> errors(regions.size());
+            region_transitions_.assign(regions.size(), {});
+            regions_running_ = true;
+
+            auto runRegion = [this, parallel, &regions, &matched, &errors, &task_data](size_t index) {
+                SuspenderScope suspender(nullptr); //分支中的 co_await 抛出 logic_error
+                currentRegion() = index;
+                currentRegionOwner() = this;
+                try {
+                    matched[index] = processRegion(parallel, regions[index], task_data);
+                }
+                catch (...) {
+                    errors[index] = std::current_exception();
+                }
+                currentRegion() = SIZE_MAX;
+                currentRegionOwner() = nullptr;
+            };
+
+            if (region_executor_ && regions.size() > 1) {
+                CountDownLatch latch(regions.size() - 1);
+                for (size_t index = 1; index < regions.size(); ++index) {
+                    region_executor_->Post([&runRegion, &latch, index]() {
+                        runRegion(index);
+                        latch.CountDown();
+                    });
+                }
+                runRegion(0);
+                latch.Wait(); //汇合
+            }
+            else {
+                for (size_t index = 0; index < regions.size(); ++index) {
+                    runRegion(index);
+                }
+            }
+            regions_running_ = false;
+
+            //先执行分支内部的转移，再执行第一个离开 parallel 状态的转移
+            auto transitions = std::move(region_transitions_);
+            BaseState* leave_target = nullptr;
+            for (auto& region : transitions) {
+                for (auto target : region) {
+                    if (isDescendant(target, parallel)) {
+                        Transition(target);
+                    }
+                    else if (leave_target == nullptr) {
+                        leave_target = target;
+                    }
+                }
+            }
+            if (leave_target) {
+                Transition(leave_target);
+            }
+
+            for (auto& error : errors) {
+                if (error && exception_handler_) {
+                    try {
+                        std::rethrow_exception(error);
+                    }
+                    catch (const std::exception& e) {
+                        exception_handler_(&e);
+                    }
+                    catch (...) {
+                    }
+                }
+            }
+            return std::find(matched.begin(), matched.end(), 1) != matched.end();
+        }
+
+        static bool isDescendant(const BaseState* state, const BaseState* ancestor) {
+            for (auto parent = state ? state->parent : nullptr; parent != nullptr; parent = parent->parent) {
+                if (parent == ancestor) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //按当前状态到根状态的顺序匹配任务，匹配成功返回true
+        bool dispatchTask(const std::shared_ptr<TaskData>& task_data) {
+            auto filterState = this->current_state_;
+            if (filterState->concurrent_root_ && task_data->type_ != MessageType::REQUEST && task_data->shared_task_) {
+                //当前状态在并发 parallel 状态中时，从最外层的并发 parallel 状态开始，由它广播到所有分支
+                filterState = filterState->concurrent_root_;
+            }
+            while (filterState != nullptr) {
+                if (processTask(filterState, task_data)) {
+                    return true;
+                }
+                filterState = filterState->parent;
+            }
+            return false;
+        }
+
+        void unmatchedTask(const std::shared_ptr<TaskData>& task_data) {
+            task_data->task_(std::any()); //没有匹配的请求，直接返回，避免调用者一直等待
+            unmatched_total_.fetch_add(1, std::memory_order_relaxed);
+
+            //按签名ID计数并限流，未匹配任务大量出现时只周期性通知，签名的描述在通知中需要时才生成
+            std::unique_lock<std::mutex> lck(unmatched_mtx_);
+            auto& counter = unmatched_counters_[task_data->event_id_];
+            ++counter.count_;
+            if (!exception_handler_ && !unmatched_handler_) {
+                return;
+            }
+            auto now = clockNow();
+            if (unmatched_report_interval_.count() > 0 && counter.count_ > 1
+                && now - counter.last_report_ < unmatched_report_interval_) {
+                ++counter.suppressed_;
+                return;
+            }
+            UnmatchedNotice notice(task_data->type_, task_data->event_id_, task_data->loc_, counter.count_, counter.suppressed_);
+            counter.last_report_ = now;
+            counter.suppressed_ = 0;
+            lck.unlock();
+
+            if (unmatched_handler_) {
+                unmatched_handler_(notice);
+            }
+            if(exception_handler_){
+                UnmatchedTask e(task_data->type_, task_data->event_id_, "No matching condition found for the task.");
+                exception_handler_(&e);
+            }
+        }
+
+        //在活动配置中查找满足条件的状态：从 state 向上到 stop，parallel 状态查找所有活动分支
+        template<typename Pred>
+        bool anyActiveState(BaseState* state, BaseState* stop, Pred& pred) {
+            for (; state != nullptr && state != stop; state = state->parent) {
+                if (pred(state)) {
+                    return true;
+                }
+                auto parallel = dynamic_cast<typename State::Parallel*>(state);
+                if (parallel) {
+                    for (auto& child : parallel->children_) {
+                        if (anyActiveState(findActiveState(&child.second), parallel, pred)) {
+                            return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+        //当前活动配置中是否有任务对应类型的处理函数，不判断条件
+        bool hasMatching(const TaskData& task_data) {
+            auto pred = [&task_data](BaseState* baseState)->bool {
+                auto state = dynamic_cast<State*>(baseState);
+                if (state) {
+                    for (const auto& c : state->match) {
+                        if (task_data.type_ == c.type_ && task_data.event_id_ == c.event_id_) {
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            };
+            return anyActiveState(this->current_state_, nullptr, pred);
+        }
+
+        //当前活动配置声明了延迟，把任务放入延迟队列
+        bool deferTask(const std::shared_ptr<TaskData>& task_data) {
+            if (deferred_tasks_.size() >= max_deferred_) {
+                return false;
+            }
+            auto pred = [&task_data](BaseState* baseState)->bool {
+                auto state = dynamic_cast<State*>(baseState);
+                if (state) {
+                    for (const auto& d : state->defer) {
+                        if (task_data->type_ == d.type_ && task_data->event_id_ == d.event_id_) {
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            };
+            if (!anyActiveState(this->current_state_, nullptr, pred)) {
+                return false;
+            }
+            auto expire = std::chrono::steady_clock::time_point::max();
+            if (defer_ttl_.count() > 0) {
+                expire = clockNow() + defer_ttl_;
+            }
+            deferred_tasks_.push_back({ task_data, expire });
+            return true;
+        }
+
+        //清理过期的延迟任务，按未匹配任务处理
+        void expireDeferred() {
+            auto now = clockNow();
+            while (!deferred_tasks_.empty() && deferred_tasks_.front().expire_ <= now) {
+                auto task_data = std::move(deferred_tasks_.front().task_data_);
+                deferred_tasks_.pop_front();
+                unmatchedTask(task_data);
+                markApplied(*task_data);
+            }
+        }
+
+        //worker 线程等待新任务的时间，有延迟任务时等到最早的过期时间
+        uint64_t deferredWaitTime() {
+            if (deferred_tasks_.empty() || deferred_tasks_.front().expire_ == std::chrono::steady_clock::time_point::max()) {
+                return INT32_MAX;
+            }
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deferred_tasks_.front().expire_ - clockNow());
+            return wait.count() > 0 ? wait.count() + 1 : 0;
+        }
+
+        //状态转移后重新投递延迟任务，只投递新配置中有处理函数的任务，投递后又发生转移则从头再来
+        void redispatchDeferred() {
+            expireDeferred();
+            auto deferred = deferred_tasks_.begin();
+            while (deferred != deferred_tasks_.end()) {
+                if (isExpired(*deferred->task_data_)) {
+                    auto task_data = deferred->task_data_;
+                    deferred = deferred_tasks_.erase(deferred);
+                    dropExpired(*task_data);
+                    markApplied(*task_data);
+                    continue;
+                }
+                if (!hasMatching(*deferred->task_data_)) {
+                    ++deferred;
+                    continue;
+                }
+                auto task_data = deferred->task_data_;
+                auto expire = deferred->expire_;
+                deferred = deferred_tasks_.erase(deferred);
+                auto transition_count = transition_count_;
+                auto saved_task = std::exchange(step_task_, task_data.get());
+                auto saved_suspended = std::exchange(step_suspended_, false);
+                bool handled = dispatchTask(task_data);
+                bool suspended = std::exchange(step_suspended_, saved_suspended);
+                step_task_ = saved_task;
+                if (!handled) {
+                    //条件不满足，保持原来的位置继续延迟
+                    deferred = std::next(deferred_tasks_.insert(deferred, { task_data, expire }));
+                    continue;
+                }
+                if (!suspended) {
+                    markApplied(*task_data);
+                }
+                if (transition_count != transition_count_) {
+                    deferred = deferred_tasks_.begin();
+                }
+            }
+        }
+
+        //任务开始处理前检查是否已经取消或过期，被丢弃时返回 false，不调用条件函数和处理函数
+        bool claimTask(TaskData& task_data) {
+            int expected = TaskData::PENDING;
+            if (!task_data.state_.compare_exchange_strong(expected, TaskData::STARTED) && expected == TaskData::CANCELLED) {
+                cancelled_total_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (isExpired(task_data)) {
+                dropExpired(task_data);
+                return false;
+            }
+            return true;
+        }
+
+        bool isExpired(const TaskData& task_data) const {
+            return task_data.deadline_ != std::chrono::steady_clock::time_point::max()
+                && clockNow() >= task_data.deadline_;
+        }
+
+        //丢弃过期的任务，请求以 TaskTimeout 结束
+        void dropExpired(TaskData& task_data) {
+            releaseCoalesced(task_data);
+            expired_total_.fetch_add(1, std::memory_order_relaxed);
+            if (task_data.type_ == MessageType::REQUEST) {
+                task_data.task_(std::any(std::make_exception_ptr(TaskTimeout(task_data.type_, task_data.GetSignature()))));
             }
+        }
 
+        //停止时取消没有处理的任务，请求以 TaskCancelled 结束
+        void cancelTask(TaskData& task_data) {
+            releaseCoalesced(task_data);
+            int expected = TaskData::PENDING;
+            if (!task_data.state_.compare_exchange_strong(expected, TaskData::STARTED) && expected == TaskData::CANCELLED) {
+                return;
+            }
+            cancelled_total_.fetch_add(1, std::memory_order_relaxed);
+            if (task_data.type_ == MessageType::REQUEST) {
+                task_data.task_(std::any(std::make_exception_ptr(TaskCancelled(task_data.type_, task_data.GetSignature()))));
+            }
         }
 
-        virtual bool Transition(BaseState* target_state) final {
+        //StopAll 设置的处理期限已过，剩余的任务直接取消
+        bool drainExpired() const {
+            int64_t deadline = drain_deadline_.load(std::memory_order_relaxed);
+            return deadline != 0 && watchClock() >= deadline;
+        }
 
-            if (target_state)
-            {
-                //从当前状态到目标状态找到最短路径
-                //1、从当前状态->当前状态
-                //2、从当前状态->当前状态的子孙状态
-                //3、从当前状态->兄弟状态
-                //4、从当前状态->父状态
-                //5、从当前状态->父状态的兄弟子状态分支
+        void cancelDeferred() {
+            while (!deferred_tasks_.empty()) {
+                auto task_data = std::move(deferred_tasks_.front().task_data_);
+                deferred_tasks_.pop_front();
+                cancelTask(*task_data);
+            }
+        }
 
+        //标记运行步骤，嵌套调用时恢复原来的值
+        struct StepScope {
+            explicit StepScope(bool& in_step) :in_step_(in_step), saved_(in_step) { in_step_ = true; }
+            ~StepScope() { in_step_ = saved_; }
+            bool& in_step_;
+            bool saved_;
+        };
 
-                //构建根到current_state的双向链表
-                std::list<BaseState*> current_state_path_list;
-                {
-                    auto current_state_path = this->current_state_;
-                    current_state_path_list.push_front(current_state_path);
-                    while (current_state_path) {
-                        current_state_path_list.push_front(current_state_path->parent);
-                        current_state_path = current_state_path->parent;
-                    }
-                }
+        //在 worker 线程的运行步骤中调用（CompletionAwaiter）
+        std::shared_ptr<SuspendedStep> SuspendStep(std::function<void()> resume, std::function<void()> destroy) override {
+            step_suspended_ = true;
+            //恢复任务在 worker 线程继续执行协程，协程在恢复的步骤中结束时标记日志记录
+            auto post = [this, loc = step_task_->loc_, journal_lsn = step_task_->journal_lsn_](const std::shared_ptr<SuspendedStep>& step) {
+                auto task_data = std::make_shared<TaskData>(loc, MessageType::EVENT, 0);
+                task_data->resume_ = step;
+                task_data->journal_lsn_ = journal_lsn;
+                putTask(task_data);
+            };
+            return suspended_.Add(post, std::move(resume), std::move(destroy));
+        }
 
-                //构建根到target_state的双向链表
-                std::list<BaseState*> target_state_path_list;
-                {
-                    auto target_state_path = target_state;
-                    target_state_path_list.push_front(target_state_path);
-                    while (target_state_path) {
-                        target_state_path_list.push_front(target_state_path->parent);
-                        target_state_path = target_state_path->parent;
+        //在 worker 线程恢复挂起的运行步骤；协程再次挂起时创建新的挂起记录，挂起后抛出的异常交给 SetExceptionHandler
+        void resumeStep(const TaskData& task_data) {
+            if (auto error = suspended_.Continue(task_data.resume_)) {
+                try {
+                    std::rethrow_exception(error);
+                }
+                catch (const std::exception& e) {
+                    if (exception_handler_) {
+                        exception_handler_(&e);
                     }
                 }
+                catch (...) {
+                }
+            }
+        }
 
-                for (auto rcurr = current_state_path_list.rbegin(); rcurr != current_state_path_list.rend(); ++rcurr)// 逆序 
-                {
-                    auto same_state = std::find(target_state_path_list.begin(), target_state_path_list.end(), *rcurr);
-                    //找到相同的父节点
-                    if (same_state != target_state_path_list.end())
-                    {
-                        //处理离开路径状态
-                        auto leave_state = current_state_path_list.rbegin();
-                        while (leave_state != rcurr) {
-                            processExit(*leave_state);
-                            ++leave_state;
-                        }
-                        //设置当前状态为最短路径根结点
-                        this->current_state_ = *same_state;
-                        if (this->current_state_) {
-                            this->current_state_->active_ = true;
-                        }
+        //在轮询线程结束轮询模式
+        void finishPolling() {
+            polling_ = false;
+            if (!in_step_) {
+                abandonPending();
+            }
+        }
 
-                        //处理进入路径状态
-                        auto entry_state = ++same_state;
-                        while (entry_state != target_state_path_list.end()) {
-                            processEntry(*entry_state);
-                            entry_state++;
-                        }
-                        break;
-                    }
+        //停止后销毁没有恢复的协程（等待中的请求以 TaskCancelled 结束），取消缓存和延迟的任务，丢弃等待响应的请求
+        void abandonPending() {
+            closeQueue();
+            suspended_.AbandonAll();
+            while (!buffered_.empty()) {
+                auto task_data = std::move(buffered_.front());
+                buffered_.pop_front();
+                cancelTask(*task_data);
+            }
+            cancelDeferred();
+            for (auto& task_data : committed_.TakeAll()) {
+                cancelTask(*task_data);
+            }
+            redispatch_pending_ = false;
+            outstanding_.Clear();
+            outstanding_count_.store(0, std::memory_order_relaxed);
+        }
+
+        //停止后关闭队列并取消队列中剩余的任务，与 putTask 配合：任务要么被这里取消，要么由放入的线程取消
+        void closeQueue() {
+            queue_closed_.store(true, std::memory_order_seq_cst);
+            cancelQueued();
+        }
+
+        void cancelQueued() {
+            std::shared_ptr<TaskData> task_data;
+            while (task_queue_.TryGet(task_data)) {
+                if (task_data) {
+                    cancelTask(*task_data);
                 }
-                return true;
             }
-            else
-            {
+        }
+
+        //关联ID对应等待中的请求时，把响应交给登记的处理函数，返回 true
+        bool completeCorrelated(TaskData& task_data) {
+            if (!task_data.correlated_) {
+                return false;
+            }
+            auto outstanding = outstanding_.Find(task_data.correlation_id_);
+            if (outstanding == nullptr || outstanding->event_id_ != task_data.event_id_) {
                 return false;
             }
+            OutstandingRequest done;
+            outstanding_.Take(task_data.correlation_id_, done);
+            outstanding_count_.store(outstanding_.Size(), std::memory_order_relaxed);
+            task_data.task_(std::move(done.on_response_));
+            return true;
         }
 
-        BaseState* GetState(const std::string& stateId) {
-            const auto& state = this->stateId_map_.find(stateId);
-            if (state != stateId_map_.end()) {
-                return state->second;
+        //等到最早的请求超时的时间（毫秒）
+        uint64_t outstandingWaitTime() {
+            if (outstanding_.Empty()) {
+                return INT32_MAX;
             }
-            return nullptr;
+            auto deadline = outstanding_.NextDeadline();
+            if (deadline == std::chrono::steady_clock::time_point::max()) {
+                return INT32_MAX;
+            }
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clockNow());
+            return wait.count() > 0 ? wait.count() + 1 : 0;
         }
 
-        BaseState* findActiveState(State* state) {
-            if (state->active_ == true) {
-                return state;
+        //超时的请求作为合成的响应处理，调用登记的 on_timeout，异常交给 SetExceptionHandler
+        void expireOutstanding(const bool* running) {
+            if (outstanding_.Empty()) {
+                return;
             }
-            else {
-                for (auto& child : state->children) {
-                    auto active_ = findActiveState(&child.second);
-                    if (active_) {
-                        return active_;
+            auto now = clockNow();
+            uint64_t id = 0;
+            OutstandingRequest expired;
+            while ((running == nullptr || *running) && outstanding_.TakeExpired(now, id, expired)) {
+                outstanding_count_.store(outstanding_.Size(), std::memory_order_relaxed);
+                response_timeouts_.fetch_add(1, std::memory_order_relaxed);
+                auto task_data = std::make_shared<TaskData>(expired.loc_, MessageType::RESPONSE, expired.event_id_);
+                task_data->direct_ = true;
+                task_data->task_ = [this, on_timeout = std::move(expired.on_timeout_), loc = expired.loc_, id](std::any) {
+                    if (!on_timeout) {
+                        return;
                     }
-                }
-                for (auto& parallel : state->parallel) {
-                    if (parallel.second.active_ == true) {
-                        return &parallel.second;
+                    try {
+                        on_timeout(loc, id);
                     }
-                }
-                return nullptr;
+                    catch (const std::exception& e) {
+                        if (exception_handler_) {
+                            exception_handler_(&e);
+                        }
+                    }
+                };
+                processStep(task_data, running);
             }
         }
 
-        void processExit(BaseState* leave) {
-            auto* parallel = dynamic_cast<typename State::Parallel*>(leave);
-            if (parallel) {//是parallel状态，离开所有子状态
-                for (auto& child : parallel->children_) {
-                    BaseState* active_state = findActiveState(&child.second);
-                    while (active_state != nullptr && active_state != parallel) {
-                        processExit(active_state);
-                        active_state = active_state->parent;
-                    }
-                }
+        //日志中的任务已经处理，或者因为过期、没有匹配而丢弃，重启后不再恢复；停止时取消的任务重启后重新处理
+        void markApplied(const TaskData& task_data) {
+#if defined(__LINUX__) || defined(__ANDROID__)
+            journal_.MarkApplied(task_data);
+#else
+            (void)task_data;
+#endif
+        }
+
+        //在日志的写线程调用，不等待：队列满时（或溢出列表还没有取空时，保持日志事件的顺序）放入溢出列表
+        void putCommitted(const std::shared_ptr<TaskData>& task_data) {
+            if (committed_.Offer(task_data, [this](const std::shared_ptr<TaskData>& task) { putTask(task); })) {
+                return;
             }
-            if (leave) {
-                this->current_state_ = leave;
-                this->current_state_->active_ = false;
-                processOnExit(this->current_state_);
+            task_queue_.Wakeup();
+            if (worker_.Enabled()) {
+                wakeFromHibernation();
             }
         }
 
-        void processEntry(BaseState* entry) {
+        //启动时按 LSN 顺序处理日志中还没有应用的任务，无法解码的记录交给 SetExceptionHandler 并标记为已应用
+        void replayJournal(const bool* running) {
+#if defined(__LINUX__) || defined(__ANDROID__)
+            journal_.Replay(running, [this, running](const std::shared_ptr<TaskData>& task_data) { processStep(task_data, running); },
+                [this](const std::exception& e) {
+                    if (exception_handler_) {
+                        exception_handler_(&e);
+                    }
+                });
+#else
+            (void)running;
+#endif
+        }
 
-            if (dynamic_cast<State*>(entry->parent)) {//如果父状态不是parallel是State，设置为非活跃
-                entry->parent->active_ = false;
+        bool bufferingSteps() const {
+            return suspend_policy_ == SuspendPolicy::BUFFER && !suspended_.Empty();
+        }
+
+        //处理一个任务，BUFFER 策略下有挂起的运行步骤时先缓存，挂起的步骤都结束后按到达顺序处理
+        void processStep(const std::shared_ptr<TaskData>& task_data, const bool* running) {
+            if (!task_data->resume_ && bufferingSteps()) {
+                buffered_.push_back(task_data);
+                return;
+            }
+            runStep(task_data, running);
+            while ((running == nullptr || *running) && suspended_.Empty()) {
+                if (redispatch_pending_) {
+                    redispatch_pending_ = false;
+                    redispatchDeferred();
+                    publishState();
+                }
+                if (buffered_.empty()) {
+                    break;
+                }
+                auto next = std::move(buffered_.front());
+                buffered_.pop_front();
+                runStep(next, running);
             }
+        }
 
-            if (entry->active_ == true) { //parallel 状态子状态已经进入过，不需要重新进入
+        //一次完整的运行步骤，running 为空表示不会在处理函数中释放状态机
+        void runStep(const std::shared_ptr<TaskData>& task_data, const bool* running) {
+            releaseCoalesced(*task_data);
+            if (!claimTask(*task_data)) {
+                markApplied(*task_data); //取消或过期的任务重启后不再恢复
+                return;
+            }
+            StepScope step(in_step_);
+            SuspenderScope suspender(this);
+            auto saved_task = std::exchange(step_task_, task_data.get());
+            auto saved_suspended = std::exchange(step_suspended_, false);
+            WatchScope watch(beginWatch(*task_data) ? &watch_ : nullptr);
+            auto transition_count = transition_count_;
+            bool deferred = false;
+            if (task_data->resume_) {
+                resumeStep(*task_data);
+            }
+            else if (task_data->direct_) {
+                task_data->task_(std::any());
+            }
+            else if (!completeCorrelated(*task_data) && !dispatchTask(task_data)) {
+                deferred = deferTask(task_data);
+                if (!deferred) {
+                    unmatchedTask(task_data);
+                }
+            }
+            //处理函数中可能停止并释放了状态机，确认仍在运行再访问成员；Stop 已经结束了看门狗计时
+            if (running != nullptr && !*running) {
+                watch.Dismiss();
                 return;
             }
+            step_task_ = saved_task;
+            //延迟的任务在处理或丢弃时标记，挂起的协程在结束时标记
+            if (!deferred && !step_suspended_) {
+                markApplied(*task_data);
+            }
+            step_suspended_ = saved_suspended;
+            if (transition_count != transition_count_) {
+                if (bufferingSteps()) {
+                    redispatch_pending_ = true;
+                }
+                else {
+                    redispatchDeferred();
+                }
+                publishState();
+            }
+        }
 
-            this->current_state_ = entry;
-            this->current_state_->active_ = true;
-            processOnEntry(this->current_state_);
+        static int64_t watchClock() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
 
-            auto* parallel = dynamic_cast<typename State::Parallel*>(entry);
-            if (parallel) {//是parallel状态，进入所有子状态
-                for (auto& child : parallel->children_) {
-                    this->current_state_ = &child.second;
-                    child.second.active_ = true;
-                    processOnEntry(&child.second);
+        //运行步骤结束（包括处理函数抛出异常）时结束看门狗计时
+        struct WatchScope {
+            explicit WatchScope(HandlerWatch* watch) :watch_(watch) {}
+            ~WatchScope() {
+                if (watch_) {
+                    watch_->End();
                 }
             }
-        }
+            void Dismiss() { watch_ = nullptr; }
+            HandlerWatch* watch_;
+        };
 
-        void processOnEntry(const BaseState* entry_state) {
-            for (const auto& action : entry_state->onentry) {
-                if (action) {
-                    action();
+        /*
+            运行步骤开始，按处理函数和当前状态取时间上限并开始计时。
+            没有启用看门狗或这个任务没有时间上限时不计时，返回 false。
+        */
+        bool beginWatch(const TaskData& task_data) {
+            if (!watch_enabled_) {
+                return false;
+            }
+            auto budget = state_budgets_[this->current_state_->index_];
+            if (!handler_budgets_.empty()) {
+                auto handler_budget = handler_budgets_.find(task_data.event_id_);
+                if (handler_budget != handler_budgets_.end()) {
+                    budget = handler_budget->second;
                 }
             }
+            if (budget.count() <= 0) {
+                return false;
+            }
+            watch_.Begin(task_data.event_id_, task_data.loc_, budget);
+            return true;
         }
 
-        void processOnExit(BaseState* leave_state) {
-            for (const auto& action : leave_state->onexit) {
-                if (action) {
-                    action();
+        //通道或共享内存中是否有任务
+        bool sourceReady() const {
+            if (committed_.Pending()) {
+                return true;
+            }
+            for (const auto& channel : channels_) {
+                if (!channel->queue_.Empty()) {
+                    return true;
                 }
             }
+#if defined(__LINUX__) || defined(__ANDROID__)
+            if (ingress_ && !ingress_->Empty()) {
+                return true;
+            }
+#endif
+            return false;
         }
 
-        bool processTask(BaseState* filterState, std::shared_ptr<TaskData> task_data) {
-            auto state = dynamic_cast<State*>(filterState);
-            if (state) {
-                for (const auto& c : state->match) {
-                    if (task_data->type_ == c.type_ 
-                        && task_data->signature_ == c.signature_
-                        && task_data->cond_(c.cond_)) {
-                        //processCondtion
-                        task_data->task_(c.func_);
-                        return true;
+        //从共享内存取一条消息并解码，跳过无法解码的消息
+        bool fetchIngress(std::shared_ptr<TaskData>& task_data) {
+#if defined(__LINUX__) || defined(__ANDROID__)
+            bool fetched = false;
+            while (!fetched && ingress_ && ingress_->TryRead([this, &task_data, &fetched](uint16_t type, uint32_t wire_id, const void* data, size_t size) {
+                auto decoder = ingress_decoders_.find(wire_id);
+                auto message_type = static_cast<MessageType>(type);
+                if (decoder == ingress_decoders_.end() || (message_type != MessageType::EVENT && message_type != MessageType::RESPONSE)) {
+                    ingress_dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                try {
+                    task_data = decoder->second(message_type, data, size);
+                    fetched = true;
+                }
+                catch (const std::exception& e) {
+                    ingress_dropped_.fetch_add(1, std::memory_order_relaxed);
+                    if (exception_handler_) {
+                        exception_handler_(&e);
                     }
                 }
-            }
+            })) {}
+            return fetched;
+#else
+            return false;
+#endif
+        }
 
-            auto parallel = dynamic_cast<typename State::Parallel*>(filterState);
-            if (parallel) {//是parallel状态，匹配所有子分支
-                for (auto& child : parallel->children_) {
-                    auto filter_Parallel = findActiveState(&child.second);
-                    while (filter_Parallel != nullptr && filter_Parallel != parallel) {
-                        if (processTask(filter_Parallel, task_data)) {
-                            return true;
-                        }
-                        else {
-                            filter_Parallel = filter_Parallel->parent;
-                        }
-                    }
+        //从各个通道和共享内存依次取任务，最多 max_tasks 个
+        void pollSources(std::vector<std::shared_ptr<TaskData>>& tasks, size_t max_tasks) {
+            std::shared_ptr<TaskData> task_data;
+            for (auto& channel : channels_) {
+                while (tasks.size() < max_tasks && channel->queue_.TryPop(task_data)) {
+                    tasks.push_back(std::move(task_data));
                 }
             }
+            while (tasks.size() < max_tasks && fetchIngress(task_data)) {
+                tasks.push_back(std::move(task_data));
+            }
+            while (tasks.size() < max_tasks && committed_.TryTake(task_data)) {
+                tasks.push_back(std::move(task_data));
+            }
+        }
+
+        //没有任务时等待，等到 task_queue_ 中的任务返回 true，超时或其他来源有任务返回 false
+        bool waitTask(std::shared_ptr<TaskData>& task_data) {
+#if defined(__LINUX__) || defined(__ANDROID__)
+            if (ingress_) {
+                task_queue_.BeginExternalWait();
+                ingress_->Wait(waitTime(), [this]() { return task_queue_.HasData() || sourceReady(); });
+                task_queue_.EndExternalWait();
+                return false;
+            }
+#endif
+            return task_queue_.Get(task_data, waitTime(), [this]() { return sourceReady(); });
+        }
+
+        //worker 线程等待任务的最长时间：最早的延迟任务过期，或者需要检查是否空闲到可以休眠
+        uint64_t waitTime() {
+            uint64_t wait = std::min(deferredWaitTime(), outstandingWaitTime());
+            if (worker_.Enabled() && static_cast<uint64_t>(worker_.Idle().count()) < wait) {
+                wait = static_cast<uint64_t>(worker_.Idle().count());
+            }
+            return wait;
+        }
 
+        //从 task_queue_、各个通道、共享内存和日志溢出列表轮流取一个任务，每次从上一次取到任务的下一个来源开始，都没有任务时返回 false
+        bool fetchTask(std::shared_ptr<TaskData>& task_data) {
+            size_t sources = channels_.size() + 2; //最后一个来源是日志溢出列表
+#if defined(__LINUX__) || defined(__ANDROID__)
+            if (ingress_) {
+                ++sources;
+            }
+#endif
+            if (sources == 2 && !committed_.Pending()) {
+                return false;
+            }
+            for (size_t i = 0; i < sources; ++i) {
+                size_t source = (next_source_ + i) % sources;
+                bool fetched = source == 0
+                    ? task_queue_.HasData() && task_queue_.TryGet(task_data)
+                    : source <= channels_.size()
+                    ? channels_[source - 1]->queue_.TryPop(task_data)
+                    : source == sources - 1
+                    ? committed_.TryTake(task_data)
+                    : fetchIngress(task_data);
+                if (fetched) {
+                    next_source_ = source + 1;
+                    return true;
+                }
+            }
             return false;
         }
 
-        void Run() {
+        //停止时处理通道、共享内存和日志溢出列表中剩余的任务
+        void drainSources(const bool* running) {
+            std::shared_ptr<TaskData> task_data;
+            while (*running && fetchTask(task_data)) {
+                if (task_data == nullptr) {
+                    continue;
+                }
+                if (drainExpired()) {
+                    cancelTask(*task_data);
+                    continue;
+                }
+                processStep(task_data, running);
+            }
+        }
+
+        //通知 worker 线程退出，不等待
+        void signalStop(bool consume_all_at_exit) {
+            if (!consume_all_at_exit && thread_is_run_) {
+                *thread_is_run_ = false; //设置运行标志为false
+            }
+            task_queue_.Put(nullptr);
+        }
+
+        bool workerStarted() {
+            return worker_.Started();
+        }
+
+        void joinWorker() {
+            std::thread worker = worker_.Take(); //自己线程调用停止时线程已经分离，不能join
+            if (worker.joinable()) {
+                worker.join(); //其他线程调用停止，等待结束
+                worker_id_.store(std::thread::id(), std::memory_order_release);
+                abandonPending();
+            }
+        }
+
+        //在 worker 线程开始时设置亲和性和调度策略，记录所在的 NUMA 节点
+        void placeWorker() {
+            if (!worker_cpus_.empty() && !SetCurrentThreadAffinity(worker_cpus_) && exception_handler_) {
+                std::runtime_error e("Failed to set worker thread affinity.");
+                exception_handler_(&e);
+            }
+            if (realtime_priority_ > 0 && !SetCurrentThreadRealtime(realtime_priority_) && exception_handler_) {
+                std::runtime_error e("Failed to set worker thread realtime scheduling.");
+                exception_handler_(&e);
+            }
+            worker_node_.store(CurrentNumaNode(), std::memory_order_release);
+        }
+
+        //resume 为 true 时是从休眠中唤醒，保持原来的状态，不执行 onentry
+        void Run(bool resume) {
+            worker_id_.store(std::this_thread::get_id(), std::memory_order_release);
             helper::SetCurrentThreadName(this->name_.c_str());
-            this->ParseState(&this->root, nullptr);
-            this->current_state_ = &this->root;
+            placeWorker();
             /*
                 在自己线程调用Stop时，不能等待线程结束，
                 在执行完 task 后，this对象已经释放，thread_is_run_ 变的不可访问。
             */
             bool* tmp_thread_is_run = this->thread_is_run_;
-            processEntry(this->current_state_);
+            if (!resume) {
+                StepScope step(in_step_);
+                processEntry(this->current_state_);
+            }
+            publishState();
+            if (!resume) {
+                replayJournal(tmp_thread_is_run);
+            }
 
+            HibernatingWorker::IdleTimer idle;
             while (*tmp_thread_is_run) {
                 std::shared_ptr<TaskData>  task_data;
-                if (task_queue_.Get(task_data) && task_data != nullptr) {
-                    auto filterState = this->current_state_;
-                    bool foundMsg = false;
-                    while (filterState != nullptr && foundMsg == false) {
-                        foundMsg = processTask(filterState, task_data);
-                        if (!foundMsg)
-                        {
-                            filterState = filterState->parent;
-                        }
-                    }
-                    if (!foundMsg) {
-                        task_data->task_(std::any()); //没有匹配的请求，直接返回，避免调用者一直等待
-                        if(exception_handler_){
-                            auto e = std::make_shared<UnmatchedTask>(task_data->type_, task_data->signature_, "No matching condition found for the task.");
-                            exception_handler_(e.get());
-                        }
+                if (!fetchTask(task_data) && !waitTask(task_data)) {
+                    expireDeferred(); //等待超时或其他来源有任务，清理过期的延迟任务
+                    expireOutstanding(tmp_thread_is_run);
+                    if (worker_.Enabled() && idle.Elapsed(worker_.Idle()) && hibernate()) {
+                        return; //thread_is_run_ 留给唤醒后的线程
                     }
+                    continue;
                 }
                 if (task_data == nullptr) {
+                    drainSources(tmp_thread_is_run);
+                    if (*tmp_thread_is_run && drain_deadline_.load(std::memory_order_relaxed) != 0) {
+                        cancelDeferred();
+                    }
+                    if (*tmp_thread_is_run) {
+                        closeQueue(); //在自己线程停止时没有 joinWorker，之后放入的任务在这里或放入时取消
+                    }
                     break;
                 }
-
+                if (drainExpired()) {
+                    cancelTask(*task_data);
+                    continue;
+                }
+                processStep(task_data, tmp_thread_is_run);
+                if (*tmp_thread_is_run) {
+                    expireOutstanding(tmp_thread_is_run);
+                }
+                idle.MarkBusy();
             }
 
             delete tmp_thread_is_run;
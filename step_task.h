@@ -0,0 +1,327 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "completion.h"
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define HELPER_STEP_TASK 1
+#endif
+
+namespace helper {
+
+//挂起的运行步骤，协程处理函数在 co_await 处挂起时由状态机创建
+class SuspendedStep {
+  public:
+    virtual ~SuspendedStep() {}
+    //可以在任意线程调用，把恢复投递到状态机的 worker 线程；状态机已经停止时什么都不做
+    virtual void Resume() = 0;
+};
+
+//状态机在 worker 线程执行运行步骤期间设置为当前线程的挂起接口
+class StepSuspender {
+  public:
+    virtual ~StepSuspender() {}
+    //resume 在 worker 线程恢复协程，destroy 在状态机停止时销毁没有恢复的协程
+    virtual std::shared_ptr<SuspendedStep> SuspendStep(std::function<void()> resume, std::function<void()> destroy) = 0;
+
+    static StepSuspender*& Current() {
+        thread_local StepSuspender* current = nullptr;
+        return current;
+    }
+};
+
+//处理函数的返回类型是 StepTask<T> 时，请求的调用者得到 T
+template<typename T>
+struct StepResult {
+    using type = T;
+    static constexpr bool kIsStep = false;
+};
+
+#if defined(HELPER_STEP_TASK)
+
+//挂起后恢复的协程在 final_suspend 中结束，异常交给恢复它的 worker 线程报告
+static inline std::exception_ptr& PendingStepError() {
+    thread_local std::exception_ptr error;
+    return error;
+}
+
+/*
+    协程处理函数的返回类型，例如 std::function<StepTask<int>(const Location&, int)>。
+    处理函数同步执行到第一个 co_await；等待的结果还没有到达时，运行步骤挂起，worker 线程继续处理其他任务
+    （按 SetSuspendPolicy 缓存或交错），结果到达后在 worker 线程恢复。任务的参数和 Location 保留到协程结束，
+    引用形参在恢复后仍然有效；阻塞请求（ADD_REQUEST_TASK）的参数是调用者的变量，调用者等待结果期间有效。
+    第一次挂起之前抛出的异常与普通处理函数相同；挂起之后的异常，请求交给调用者，事件和响应交给 SetExceptionHandler。
+*/
+template<typename T = void>
+class StepTask;
+
+template<typename T>
+class StepPromiseBase {
+  public:
+    StepPromiseBase() = default;
+    StepPromiseBase(const StepPromiseBase&) = delete;
+    StepPromiseBase& operator=(const StepPromiseBase&) = delete;
+
+    ~StepPromiseBase() {
+        //没有执行完就被销毁（状态机停止），通知等待的请求
+        if (on_done_) {
+            auto done = std::move(on_done_);
+            done(*this);
+        }
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+        return {};
+    }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+        template<typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            auto& promise = handle.promise();
+            promise.finished_ = true;
+            if (promise.on_done_) {
+                auto done = std::move(promise.on_done_);
+                done(promise);
+            }
+            //挂起过的协程由自己销毁，没有挂起过的由 StepTask 销毁
+            if (promise.detached_) {
+                if (promise.error_) {
+                    PendingStepError() = std::move(promise.error_);
+                }
+                handle.destroy();
+            }
+        }
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        if (!detached_) {
+            throw; //还没有挂起过，异常直接抛给调用处理函数的地方
+        }
+        error_ = std::current_exception();
+    }
+
+    bool detached_ = false; //已经挂起过，协程帧由状态机持有
+    bool finished_ = false;
+    std::exception_ptr error_;
+    std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value_;
+    std::function<void(StepPromiseBase&)> on_done_; //执行完（finished_ 为 true）或被销毁时调用一次
+};
+
+template<typename T>
+class StepTask {
+  public:
+    struct promise_type : StepPromiseBase<T> {
+        StepTask get_return_object() {
+            return StepTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        template<typename U>
+        void return_value(U&& value) {
+            this->value_.emplace(std::forward<U>(value));
+        }
+    };
+    using Promise = StepPromiseBase<T>;
+
+    StepTask(StepTask&& other) noexcept :handle_(std::exchange(other.handle_, nullptr)) {}
+    StepTask(const StepTask&) = delete;
+    StepTask& operator=(const StepTask&) = delete;
+
+    ~StepTask() {
+        if (handle_ && handle_.done()) {
+            handle_.destroy();
+        }
+    }
+
+    //协程执行完时调用 done，已经执行完时立即调用；只能设置一次
+    void OnDone(std::function<void(Promise&)> done) {
+        if (handle_.done()) {
+            done(handle_.promise());
+            return;
+        }
+        handle_.promise().on_done_ = std::move(done);
+    }
+
+  private:
+    explicit StepTask(std::coroutine_handle<promise_type> handle) :handle_(handle) {}
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template<>
+struct StepTask<void>::promise_type : StepPromiseBase<void> {
+    StepTask get_return_object() {
+        return StepTask(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    void return_void() {}
+};
+
+template<typename T>
+struct StepResult<StepTask<T>> {
+    using type = T;
+    static constexpr bool kIsStep = true;
+};
+
+//在 worker 线程等待 Completion，结果到达前运行步骤挂起，不阻塞 worker 线程
+template<typename T>
+class CompletionAwaiter {
+  public:
+    explicit CompletionAwaiter(Completion<T> completion) :completion_(std::move(completion)) {}
+
+    bool await_ready() const {
+        return completion_.Ready();
+    }
+
+    template<typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> handle) {
+        auto suspender = StepSuspender::Current();
+        if (suspender == nullptr) {
+            throw std::logic_error("co_await in a handler must run on the state machine worker thread.");
+        }
+        auto step = suspender->SuspendStep([handle]() { handle.resume(); }, [handle]() { handle.destroy(); });
+        handle.promise().detached_ = true;
+        if (!completion_.OnReady([step]() { step->Resume(); })) {
+            step->Resume(); //设置回调之前结果已经到达
+        }
+    }
+
+    T await_resume() {
+        return completion_.Get();
+    }
+
+  private:
+    Completion<T> completion_;
+};
+
+template<typename T>
+CompletionAwaiter<T> operator co_await(Completion<T> completion) {
+    return CompletionAwaiter<T>(std::move(completion));
+}
+
+#endif
+
+//设置当前线程的挂起接口，嵌套调用时恢复原来的值
+struct SuspenderScope {
+    explicit SuspenderScope(StepSuspender* suspender) :saved_(StepSuspender::Current()) { StepSuspender::Current() = suspender; }
+    ~SuspenderScope() { StepSuspender::Current() = saved_; }
+    StepSuspender* saved_;
+};
+
+//挂起的运行步骤，结果到达时由生产者线程调用 Resume，用 post 向 worker 线程投递恢复任务
+class StepSuspension : public SuspendedStep, public std::enable_shared_from_this<StepSuspension> {
+  public:
+    //post 在队列满时抛出异常，稍后重试
+    using Post = std::function<void(const std::shared_ptr<SuspendedStep>& step)>;
+
+    StepSuspension(Post post, std::function<void()> resume, std::function<void()> destroy)
+        :post_(std::move(post)), resume_(std::move(resume)), destroy_(std::move(destroy)) {}
+
+    void Resume() override {
+        while (true) {
+            std::unique_lock<std::mutex> lck(mtx_);
+            if (abandoned_ || posted_) {
+                return;
+            }
+            try {
+                post_(shared_from_this());
+                posted_ = true;
+                return;
+            }
+            catch (const std::exception&) {
+                //队列已满，释放锁让停止的线程可以放弃挂起的步骤，稍后重试
+            }
+            lck.unlock();
+            std::this_thread::yield();
+        }
+    }
+
+    //状态机停止，之后的 Resume 什么都不做，销毁协程
+    void Abandon() {
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            abandoned_ = true;
+        }
+        destroy_();
+    }
+
+    //在 worker 线程继续执行协程
+    void Continue() {
+        resume_();
+    }
+
+  private:
+    std::mutex mtx_;
+    bool abandoned_ = false;
+    bool posted_ = false;
+    Post post_;
+    std::function<void()> resume_;
+    std::function<void()> destroy_;
+};
+
+//一个状态机挂起中的运行步骤，除了 Count 只在 worker 线程访问
+class SuspendedSteps {
+  public:
+    std::shared_ptr<SuspendedStep> Add(StepSuspension::Post post, std::function<void()> resume, std::function<void()> destroy) {
+        auto suspension = std::make_shared<StepSuspension>(std::move(post), std::move(resume), std::move(destroy));
+        steps_.push_back(suspension);
+        count_.store(steps_.size(), std::memory_order_relaxed);
+        return suspension;
+    }
+
+    //恢复挂起的运行步骤，返回协程在恢复后抛出的异常；已经放弃的步骤什么都不做
+    std::exception_ptr Continue(const std::shared_ptr<SuspendedStep>& step) {
+        auto found = std::find(steps_.begin(), steps_.end(), step);
+        if (found == steps_.end()) {
+            return nullptr;
+        }
+        auto suspension = std::move(*found);
+        steps_.erase(found);
+        count_.store(steps_.size(), std::memory_order_relaxed);
+        suspension->Continue();
+#if defined(HELPER_STEP_TASK)
+        return std::exchange(PendingStepError(), nullptr);
+#else
+        return nullptr;
+#endif
+    }
+
+    //停止后销毁没有恢复的协程
+    void AbandonAll() {
+        auto steps = std::move(steps_);
+        steps_.clear();
+        count_.store(0, std::memory_order_relaxed);
+        for (auto& suspension : steps) {
+            suspension->Abandon();
+        }
+    }
+
+    bool Empty() const {
+        return steps_.empty();
+    }
+
+    //可以在任意线程读取
+    size_t Count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::vector<std::shared_ptr<StepSuspension>> steps_;
+    std::atomic<size_t> count_{ 0 };
+};
+
+}//end namespace helper
@@ -0,0 +1,52 @@
+#include "batch_engine.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using helper::BatchChart;
+using helper::BatchEngine;
+using helper::Location;
+
+using Open = std::function<void(const Location&, uint32_t)>;
+using Close = std::function<void(const Location&, uint32_t)>;
+using Alarm = std::function<void(const Location&, uint32_t)>;
+
+//alarm 状态有 onentry，进入时需要逐个处理
+struct DoorChart : BatchChart {
+    DoorChart() :BatchChart("closed") {
+        match + EVENT_TO(Open, "open");
+        match + EVENT_TO(Alarm, "alarm");
+        (*this)["open"].match + EVENT_TO(Close, "closed");
+        (*this)["alarm"].onentry + [this]() { ++alarms_; };
+        (*this)["alarm"].match + EVENT_TO(Close, "closed");
+    }
+    uint64_t alarms_ = 0;
+};
+
+//随机实例、随机事件，alarm_every 个事件中有一个 Alarm（0 表示没有），返回每秒处理的事件数（百万）
+static double run(size_t instances, size_t events, size_t alarm_every, int rounds) {
+    DoorChart chart;
+    BatchEngine engine(chart, instances);
+    uint32_t ids[] = { BATCH_EVENT_ID(Open), BATCH_EVENT_ID(Close) };
+    uint32_t alarm = BATCH_EVENT_ID(Alarm);
+    std::mt19937 random(1);
+    std::vector<uint32_t> targets(events);
+    std::vector<uint32_t> event_ids(events);
+    for (size_t i = 0; i < events; ++i) {
+        targets[i] = static_cast<uint32_t>(random() % instances);
+        event_ids[i] = (alarm_every != 0 && i % alarm_every == 0) ? alarm : ids[random() % 2];
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        BATCH_APPLY(engine, targets.data(), event_ids.data(), events);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(events) * rounds / elapsed.count() / 1e6;
+}
+
+int main() {
+    std::printf("64k instances:                %.1f M events/s\n", run(64 * 1024, 1 << 20, 0, 20));
+    std::printf("1M instances, alarm every 7:  %.1f M events/s\n", run(1 << 20, 1 << 20, 7, 20));
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "batch_engine.h"
+#include "test_helper.h"
+#include <stdexcept>
+#include <vector>
+
+using helper::BatchChart;
+using helper::BatchEngine;
+using helper::Location;
+
+using Open = std::function<void(const Location&, uint32_t)>;
+using Close = std::function<void(const Location&, uint32_t)>;
+
+struct DoorChart : BatchChart {
+    DoorChart() :BatchChart("closed") {
+        match + EVENT_TO(Open, "open");
+        (*this)["open"].match + EVENT_TO(Close, "closed");
+    }
+};
+
+//向量路径和逐个处理的结果相同
+static void appliesTransitions() {
+    DoorChart chart;
+    BatchEngine engine(chart, 64);
+    uint32_t open = BATCH_EVENT_ID(Open);
+    uint32_t close = BATCH_EVENT_ID(Close);
+    std::vector<uint32_t> instances(64);
+    std::vector<uint32_t> events(64, open);
+    for (uint32_t i = 0; i < 64; ++i) {
+        instances[i] = i;
+        if (i % 3 == 0) {
+            events[i] = close;
+        }
+    }
+    auto matched = BATCH_APPLY(engine, instances.data(), events.data(), instances.size());
+    CHECK(matched == 42); //关闭状态下的 Close 没有匹配
+    CHECK(engine.GetStateId(0) == "closed");
+    CHECK(engine.GetStateId(1) == "open");
+    CHECK(engine.GetUnmatchedCount() == 22);
+}
+
+//没有实例时向量路径同样抛出异常，不写填充字节
+static void emptyEngineThrows() {
+    DoorChart chart;
+    BatchEngine engine(chart, 0);
+    std::vector<uint32_t> instances(8, 0);
+    std::vector<uint32_t> events(8, BATCH_EVENT_ID(Open));
+    instances[7] = 1;
+    CHECK_THROWS(BATCH_APPLY(engine, instances.data(), events.data(), instances.size()), std::out_of_range);
+    CHECK(engine.States()[0] == 0);
+}
+
+int main() {
+    appliesTransitions();
+    emptyEngineThrows();
+    std::printf("test_batch_engine passed\n");
+    return 0;
+}
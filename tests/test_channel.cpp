@@ -0,0 +1,76 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <mutex>
+#include <vector>
+
+using helper::Location;
+using helper::StateMachine;
+
+using Sample = std::function<void(const Location& loc, int seq)>;
+
+class SinkMachine : public StateMachine {
+public:
+    SinkMachine() :StateMachine("channel_test") {
+        root.match + EVENT_2(Sample, [this](const Location& loc, int seq) {
+            std::lock_guard<std::mutex> lck(mtx_);
+            seen_.push_back(seq);
+        });
+    }
+
+    std::vector<int> Seen() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return seen_;
+    }
+
+private:
+    std::mutex mtx_;
+    std::vector<int> seen_;
+};
+
+//通道满时发送返回 false，不阻塞；轮询时按发送顺序处理
+static void fullChannelRejects() {
+    SinkMachine machine;
+    auto channel = machine.OpenChannel(4);
+    machine.StartPolling(false);
+    size_t capacity = channel->Capacity();
+    for (size_t i = 0; i < capacity; ++i) {
+        CHECK(CHANNEL_EVENT_TASK(channel, Sample, static_cast<int>(i)));
+    }
+    CHECK(!CHANNEL_EVENT_TASK(channel, Sample, -1));
+    CHECK(machine.Poll() == capacity);
+    auto seen = machine.Seen();
+    CHECK(seen.size() == capacity);
+    for (size_t i = 0; i < seen.size(); ++i) {
+        CHECK(seen[i] == static_cast<int>(i));
+    }
+    machine.Stop();
+}
+
+//另一个线程通过通道发送，worker 线程被唤醒并按顺序处理
+static void workerDrainsChannelInOrder() {
+    SinkMachine machine;
+    auto channel = machine.OpenChannel(64);
+    machine.Start();
+    const int total = 20000;
+    std::thread sender([&]() {
+        for (int i = 0; i < total; ++i) {
+            while (!CHANNEL_EVENT_TASK(channel, Sample, i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    sender.join();
+    CHECK(test::WaitUntil([&]() { return machine.Seen().size() == total; }, std::chrono::milliseconds(10000)));
+    auto seen = machine.Seen();
+    for (int i = 0; i < total; ++i) {
+        CHECK(seen[i] == i);
+    }
+    machine.Stop();
+}
+
+int main() {
+    fullChannelRejects();
+    workerDrainsChannelInOrder();
+    std::printf("test_channel passed\n");
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "door_chart.h"
+#include "test_helper.h"
+#include <string>
+
+using Door = charts::DoorChart;
+
+struct DoorImpl {
+    bool unlocked() { return !locked_; }
+    void countOpen() { ++opens_; }
+    void lightOn() { light_ = true; }
+    void lightOff() { light_ = false; }
+
+    bool locked_ = false;
+    bool light_ = false;
+    int opens_ = 0;
+};
+
+//生成的 Runtime 按表执行：条件、转移动作、onentry/onexit，从子孙状态向上匹配
+static void runsGeneratedTables() {
+    DoorImpl impl;
+    Door::Runtime<DoorImpl> door(impl);
+    door.Start();
+    CHECK(door.Current() == Door::State::root);
+    CHECK(door.Dispatch(Door::Event::open));
+    CHECK(door.Current() == Door::State::opened && impl.light_ && impl.opens_ == 1);
+    CHECK(!door.Dispatch(Door::Event::lock));
+    CHECK(door.Dispatch(Door::Event::close));
+    CHECK(door.Current() == Door::State::closed && !impl.light_);
+    CHECK(door.Dispatch(Door::Event::lock));
+    CHECK(door.IsIn(Door::State::closed) && std::string(door.CurrentId()) == "locked");
+    impl.locked_ = true;
+    CHECK(!door.Dispatch(Door::Event::open));
+    impl.locked_ = false;
+    CHECK(door.Dispatch(Door::Event::open));
+    CHECK(door.Current() == Door::State::opened && impl.opens_ == 2);
+}
+
+int main() {
+    runsGeneratedTables();
+    std::printf("test_chart passed\n");
+    return 0;
+}
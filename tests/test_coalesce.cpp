@@ -0,0 +1,105 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <string>
+#include <vector>
+
+using helper::Location;
+using helper::StateMachine;
+
+using Status = std::function<void(const Location& loc, int code)>;
+
+class CallMachine : public StateMachine {
+public:
+    CallMachine() :StateMachine("coalesce_test") {
+        SET_DISCRIMINATOR(Status, [](const Location& loc, int code)->int64_t { return code; });
+        COALESCE_EVENT(Status);
+        root.match + EVENT_KEY(Status, 180, [this](const Location& loc, int code) { seen_.push_back("ringing" + std::to_string(code)); });
+        root.match + EVENT_RANGE(Status, 200, 299, [this](const Location& loc, int code) { seen_.push_back("ok" + std::to_string(code)); });
+    }
+
+    std::vector<std::string> seen_;
+};
+
+//合并后按最新参数的分派键查找处理函数
+static void coalescedTaskUsesNewKey() {
+    CallMachine machine;
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Status, 180);
+    machine.ADD_EVENT_TASK(Status, 200);
+    machine.Poll();
+    CHECK(machine.seen_.size() == 1);
+    CHECK(machine.seen_[0] == "ok200");
+    CHECK(machine.GetCoalescedCount() == 1);
+    machine.Stop();
+}
+
+using Position = std::function<void(const Location& loc, int id, int x)>;
+
+class TrackMachine : public StateMachine {
+public:
+    TrackMachine() :StateMachine("coalesce_by_test") {
+        COALESCE_EVENT_BY(Position, [](const Location& loc, int id, int x)->uint64_t { return id; });
+        root.match + EVENT_2(Position, [this](const Location& loc, int id, int x) {
+            seen_.push_back(std::to_string(id) + ":" + std::to_string(x));
+        });
+    }
+
+    std::vector<std::string> seen_;
+};
+
+//同键的待处理事件只保留最新的参数，位置不变；不同键不合并；出队后到达的事件单独处理
+static void coalesceKeepsLatestPerKey() {
+    TrackMachine machine;
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Position, 1, 10);
+    machine.ADD_EVENT_TASK(Position, 2, 20);
+    machine.ADD_EVENT_TASK(Position, 1, 11);
+    machine.ADD_EVENT_TASK(Position, 1, 12);
+    machine.Poll();
+    CHECK(machine.seen_ == std::vector<std::string>({ "1:12", "2:20" }));
+    CHECK(machine.GetCoalescedCount() == 2);
+    machine.ADD_EVENT_TASK(Position, 1, 13);
+    machine.Poll();
+    CHECK(machine.seen_.size() == 3 && machine.seen_[2] == "1:13");
+    machine.Stop();
+}
+
+//取消的待处理事件不再合并，之后的事件单独处理
+static void cancelledPendingIsNotMerged() {
+    TrackMachine machine;
+    machine.StartPolling(false);
+    auto token = machine.ADD_EVENT_TASK(Position, 1, 10);
+    CHECK(token.Cancel());
+    machine.ADD_EVENT_TASK(Position, 1, 11);
+    machine.ADD_EVENT_TASK(Position, 1, 12);
+    machine.Poll();
+    CHECK(machine.seen_ == std::vector<std::string>({ "1:12" }));
+    CHECK(machine.GetCoalescedCount() == 1);
+    CHECK(machine.GetCancelledCount() == 1);
+    machine.Stop();
+}
+
+//过期的待处理事件不再合并
+static void expiredPendingIsNotMerged() {
+    TrackMachine machine;
+    std::atomic<int64_t> now{ 1000 };
+    machine.SetClock([&now]() { return std::chrono::steady_clock::time_point(std::chrono::milliseconds(now.load())); });
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK_FOR(std::chrono::milliseconds(10), Position, 1, 10);
+    now += 20;
+    machine.ADD_EVENT_TASK(Position, 1, 11);
+    machine.Poll();
+    CHECK(machine.seen_ == std::vector<std::string>({ "1:11" }));
+    CHECK(machine.GetCoalescedCount() == 0);
+    CHECK(machine.GetExpiredCount() == 1);
+    machine.Stop();
+}
+
+int main() {
+    coalescedTaskUsesNewKey();
+    coalesceKeepsLatestPerKey();
+    cancelledPendingIsNotMerged();
+    expiredPendingIsNotMerged();
+    std::printf("test_coalesce passed\n");
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using helper::Location;
+using helper::StateMachine;
+
+//生产者线程写入结果，消费者自旋后在状态字上等待
+static void slotHandsOverValue() {
+    auto completion = helper::MakeCompletion<int>();
+    CHECK(!completion.second.WaitFor(std::chrono::milliseconds(5)));
+    std::thread producer([slot = completion.first]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        slot->SetValue(7);
+    });
+    CHECK(completion.second.Get() == 7);
+    producer.join();
+}
+
+//结果到达时在生产者线程调用一次回调；已经到达时 OnReady 返回 false
+static void continuationRunsOnce() {
+    auto completion = helper::MakeCompletion<void>();
+    std::atomic<int> calls{ 0 };
+    CHECK(completion.second.OnReady([&calls]() { ++calls; }));
+    completion.first->SetException(std::make_exception_ptr(std::runtime_error("failed")));
+    CHECK(calls == 1);
+    CHECK(!completion.second.OnReady([&calls]() { ++calls; }));
+    CHECK(calls == 1);
+    CHECK_THROWS(completion.second.Get(), std::runtime_error);
+}
+
+using Make = std::function<std::unique_ptr<int>(const Location& loc, int value)>;
+using Fail = std::function<int(const Location& loc)>;
+using Missing = std::function<int(const Location& loc)>;
+using Length = std::function<size_t(const Location& loc, std::string text)>;
+
+class RequestMachine : public StateMachine {
+public:
+    RequestMachine() :StateMachine("completion_test") {
+        root.match + REQUEST_2(Make, [](const Location& loc, int value) { return std::make_unique<int>(value); });
+        root.match + REQUEST_2(Fail, [](const Location& loc)->int { throw std::invalid_argument("bad"); });
+        root.match + REQUEST_3(Length, [](const Location& loc, std::string text) { return !text.empty(); },
+            [](const Location& loc, std::string text) { return text.size(); });
+    }
+};
+
+//请求的结果只能移动、处理函数抛出异常、没有匹配的处理函数
+static void requestResults() {
+    RequestMachine machine;
+    machine.Start();
+    auto made = machine.ADD_REQUEST_TASK(Make, 5);
+    CHECK(made && *made == 5);
+    auto async = machine.ASYNC_REQUEST_TASK(Make, 6);
+    CHECK(*async.Get() == 6);
+    CHECK_THROWS(machine.ADD_REQUEST_TASK(Fail), std::invalid_argument);
+    auto missing = machine.ASYNC_REQUEST_TASK(Missing);
+    missing.Wait();
+    CHECK(missing.IsUnmatched());
+    machine.Stop();
+}
+
+//按值传参的条件检查不能移走阻塞请求的参数
+static void condKeepsRequestArgs() {
+    RequestMachine machine;
+    machine.Start();
+    std::string text(37, 'x');
+    CHECK(machine.ADD_REQUEST_TASK(Length, text) == 37);
+    CHECK(machine.ADD_REQUEST_TASK(Length, std::string(37, 'y')) == 37);
+    CHECK(machine.ASYNC_REQUEST_TASK(Length, std::string(37, 'z')).Get() == 37);
+    machine.Stop();
+}
+
+int main() {
+    slotHandsOverValue();
+    continuationRunsOnce();
+    requestResults();
+    condKeepsRequestArgs();
+    std::printf("test_completion passed\n");
+    return 0;
+}
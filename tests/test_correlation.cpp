@@ -0,0 +1,67 @@
+#include "correlation_table.h"
+#include "state_machine.h"
+#include "test_helper.h"
+
+using helper::CorrelationTable;
+using helper::Location;
+using helper::StateMachine;
+using TimePoint = std::chrono::steady_clock::time_point;
+
+//不同的表分配的ID不同，一个表的ID在另一个表中找不到
+static void tablesDoNotShareIds() {
+    CorrelationTable<int> first;
+    CorrelationTable<int> second;
+    uint64_t a = first.Insert(1, TimePoint::max());
+    uint64_t b = second.Insert(2, TimePoint::max());
+    CHECK(a != 0 && b != 0 && a != b);
+    CHECK(second.Find(a) == nullptr);
+    CHECK(first.Find(b) == nullptr);
+    CHECK(*first.Find(a) == 1);
+    uint64_t next = first.Insert(3, TimePoint::max());
+    CHECK(next == a + 1);
+}
+
+using Reply = std::function<void(const Location& loc, uint64_t id)>;
+
+class Caller : public StateMachine {
+public:
+    Caller() :StateMachine("correlation_test") {
+        SET_CORRELATION(Reply, [](const Location& loc, uint64_t id) { return id; });
+        root.match + EVENT_2(Reply, [this](const Location& loc, uint64_t id) { ++unmatched_; });
+    }
+
+    uint64_t Expect() {
+        return EXPECT_RESPONSE(Reply, std::chrono::milliseconds(0),
+                               [this](const Location& loc, uint64_t id) { ++answered_; }, [](const Location&, uint64_t) {});
+    }
+
+    int answered_ = 0;
+    int unmatched_ = 0;
+};
+
+//一个状态机的关联ID投递到另一个状态机时不会完成它等待的请求
+static void responseToWrongMachineIsNotMatched() {
+    Caller first;
+    Caller second;
+    first.StartPolling(false);
+    second.StartPolling(false);
+    uint64_t id = first.Expect();
+    second.Expect();
+    second.ADD_RESPONSE_TASK(Reply, id);
+    second.Poll();
+    CHECK(second.answered_ == 0);
+    CHECK(second.GetOutstandingRequestCount() == 1);
+    first.ADD_RESPONSE_TASK(Reply, id);
+    first.Poll();
+    CHECK(first.answered_ == 1);
+    CHECK(first.GetOutstandingRequestCount() == 0);
+    first.Stop();
+    second.Stop();
+}
+
+int main() {
+    tablesDoNotShareIds();
+    responseToWrongMachineIsNotMatched();
+    std::printf("test_correlation passed\n");
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+using helper::Location;
+using helper::StateMachine;
+
+using Ping = std::function<void(const Location& loc, int seq)>;
+using Go = std::function<void(const Location& loc)>;
+using Ask = std::function<int(const Location& loc)>;
+
+class DeferMachine : public StateMachine {
+public:
+    DeferMachine() :StateMachine("defer_test") {
+        root.defer + DEFER_EVENT(Ping) + DEFER_REQUEST(Ask);
+        root.match + EVENT_2(Go, [this](const Location& loc) { Transition("ready"); });
+        root["ready"].match + EVENT_2(Ping, [this](const Location& loc, int seq) {
+            std::lock_guard<std::mutex> lck(mtx_);
+            seen_.push_back(seq);
+        });
+        root["ready"].match + REQUEST_2(Ask, [](const Location& loc) { return 42; });
+    }
+
+    std::vector<int> Seen() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return seen_;
+    }
+
+private:
+    std::mutex mtx_;
+    std::vector<int> seen_;
+};
+
+//没有处理函数的状态中延迟，转移后按到达顺序处理
+static void deferUntilTransition() {
+    DeferMachine machine;
+    machine.Start();
+    machine.ADD_EVENT_TASK(Ping, 1);
+    machine.ADD_EVENT_TASK(Ping, 2);
+    auto answer = machine.ASYNC_REQUEST_TASK(Ask);
+    machine.ADD_EVENT_TASK(Go);
+    CHECK(test::WaitUntil([&]() { return machine.Seen().size() == 2; }));
+    CHECK(machine.Seen()[0] == 1 && machine.Seen()[1] == 2);
+    CHECK(answer.Get() == 42);
+    machine.Stop();
+}
+
+//停止时仍在延迟的请求以 TaskCancelled 结束，调用方不会一直阻塞
+static void stopCancelsDeferredRequest() {
+    DeferMachine machine;
+    machine.Start();
+    auto answer = machine.ASYNC_REQUEST_TASK(Ask);
+    machine.Stop();
+    bool cancelled = false;
+    CHECK(test::FinishesWithin([&]() {
+        try {
+            answer.Get();
+        }
+        catch (const StateMachine::TaskCancelled&) {
+            cancelled = true;
+        }
+    }));
+    CHECK(cancelled);
+}
+
+static void stopCancelsDeferredSyncRequest() {
+    auto machine = std::make_shared<DeferMachine>();
+    machine->Start();
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    std::thread requester([machine, cancelled]() {
+        try {
+            machine->ADD_REQUEST_TASK(Ask);
+        }
+        catch (const StateMachine::TaskCancelled&) {
+            cancelled->store(true);
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50)); //等请求进入延迟队列
+    CHECK(test::FinishesWithin([machine]() { machine->Stop(); }));
+    requester.join();
+    CHECK(cancelled->load());
+}
+
+int main() {
+    deferUntilTransition();
+    stopCancelsDeferredRequest();
+    stopCancelsDeferredSyncRequest();
+    std::printf("test_defer passed\n");
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <stdexcept>
+#include <string>
+
+using helper::Location;
+using helper::StateMachine;
+
+using Ask = std::function<int(const Location& loc, int value)>;
+using Relay = std::function<int(const Location& loc, int value)>;
+using Note = std::function<void(const Location& loc, int value)>;
+
+//Relay 把请求转给 peer 的 Ask；Ask 在设置了 peer 时再向 peer 请求，形成回环
+class Peer : public StateMachine {
+public:
+    explicit Peer(const std::string& name) :StateMachine(name) {
+        root.match + REQUEST_2(Ask, [this](const Location& loc, int value) {
+            if (call_back_) {
+                return call_back_->ADD_REQUEST_TASK(Ask, value);
+            }
+            return value * 2;
+        });
+        root.match + REQUEST_2(Relay, [this](const Location& loc, int value) {
+            relay_thread_ = std::this_thread::get_id();
+            return peer_->ADD_REQUEST_TASK(Ask, value) + 1;
+        });
+        root.match + EVENT_2(Note, [this](const Location& loc, int value) { note_ = value; });
+    }
+
+    Peer* peer_ = nullptr;
+    Peer* call_back_ = nullptr;
+    std::thread::id relay_thread_;
+    int note_ = 0;
+};
+
+//同一线程轮询的两个状态机，处理函数中向另一个状态机发请求直接执行
+static void requestToMachineOnSameThreadRunsInline() {
+    Peer a("dispatch_a");
+    Peer b("dispatch_b");
+    a.peer_ = &b;
+    a.StartPolling(false);
+    b.StartPolling(false);
+    auto result = a.ADD_REQUEST_TASK(Relay, 20);
+    CHECK(result == 41);
+    CHECK(a.relay_thread_ == std::this_thread::get_id());
+    CHECK(!b.HasPendingTasks());
+    a.Stop();
+    b.Stop();
+}
+
+//回环的请求不能等待，抛出异常而不是死锁
+static void requestCycleOnSameThreadThrows() {
+    Peer a("dispatch_a");
+    Peer b("dispatch_b");
+    a.peer_ = &b;
+    b.call_back_ = &a;
+    a.StartPolling(false);
+    b.StartPolling(false);
+    CHECK_THROWS(a.ADD_REQUEST_TASK(Relay, 1), std::logic_error);
+    a.Stop();
+    b.Stop();
+}
+
+//线程模式下处理函数向自己的状态机发请求抛出异常
+static void selfRequestFromHandlerThrows() {
+    Peer a("dispatch_self");
+    a.peer_ = &a;
+    a.Start();
+    CHECK_THROWS(a.ADD_REQUEST_TASK(Relay, 1), std::logic_error);
+    a.Stop();
+}
+
+//轮询线程上不在运行步骤中时，Dispatch 直接执行
+static void dispatchEventRunsInlineOnPollThread() {
+    Peer a("dispatch_event");
+    a.StartPolling(false);
+    a.DISPATCH_EVENT_TASK(Note, 5);
+    CHECK(a.note_ == 5);
+    a.ADD_EVENT_TASK(Note, 6);
+    CHECK(a.note_ == 5);
+    a.Poll();
+    CHECK(a.note_ == 6);
+    a.Stop();
+}
+
+int main() {
+    requestToMachineOnSameThreadRunsInline();
+    requestCycleOnSameThreadThrows();
+    selfRequestFromHandlerThrows();
+    dispatchEventRunsInlineOnPollThread();
+    std::printf("test_dispatch passed\n");
+    return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+//回归测试的断言：失败时打印位置并以非零状态退出
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+#define CHECK_THROWS(expr, ExceptionType) \
+    do { \
+        bool thrown = false; \
+        try { \
+            expr; \
+        } \
+        catch (const ExceptionType&) { \
+            thrown = true; \
+        } \
+        if (!thrown) { \
+            std::fprintf(stderr, "%s:%d: expected %s from: %s\n", __FILE__, __LINE__, #ExceptionType, #expr); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+namespace test {
+
+//等待条件成立，超时返回 false
+inline bool WaitUntil(const std::function<bool()>& cond, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!cond()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//在单独的线程执行，超时返回 false（线程被分离，测试随后失败退出）
+inline bool FinishesWithin(std::function<void()> body, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000)) {
+    auto done = std::make_shared<std::atomic<bool>>(false);
+    std::thread([body, done]() {
+        body();
+        done->store(true);
+    }).detach();
+    return WaitUntil([done]() { return done->load(); }, timeout);
+}
+
+}//end namespace test
@@ -0,0 +1,55 @@
+#include "state_machine.h"
+#include "test_helper.h"
+
+using helper::Location;
+using helper::StateMachine;
+
+using Ping = std::function<void(const Location& loc, int seq)>;
+
+class SleepyMachine : public StateMachine {
+public:
+    SleepyMachine() :StateMachine("hibernate_test") {
+        root.match + EVENT_2(Ping, [this](const Location& loc, int seq) { ++handled_; });
+    }
+
+    std::atomic<int> handled_{ 0 };
+};
+
+//空闲后休眠，下一个任务唤醒，从原来的状态继续
+static void wakesOnNextTask() {
+    SleepyMachine machine;
+    machine.SetHibernation(std::chrono::milliseconds(1));
+    machine.Start();
+    CHECK(test::WaitUntil([&]() { return machine.GetHibernationStats().hibernating_; }));
+    machine.ADD_EVENT_TASK(Ping, 1);
+    CHECK(test::WaitUntil([&]() { return machine.handled_ == 1; }));
+    CHECK(machine.GetHibernationStats().wakeups_ >= 1);
+    machine.Stop();
+}
+
+//生产者唤醒 worker 线程的同时停止：不死锁、不崩溃
+static void stopRacesWithWakeup() {
+    for (int round = 0; round < 50; ++round) {
+        SleepyMachine machine;
+        machine.SetHibernation(std::chrono::milliseconds(1));
+        machine.Start();
+        std::atomic<bool> done{ false };
+        std::thread producer([&]() {
+            for (int i = 0; !done; ++i) {
+                machine.ADD_EVENT_TASK(Ping, i);
+                std::this_thread::sleep_for(std::chrono::microseconds(300 + round * 20));
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(round % 5));
+        CHECK(test::FinishesWithin([&]() { machine.Stop(); }));
+        done = true;
+        producer.join();
+    }
+}
+
+int main() {
+    wakesOnNextTask();
+    stopRacesWithWakeup();
+    std::printf("test_hibernate passed\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+using helper::Journal;
+using helper::Location;
+using helper::StateMachine;
+
+using Bill = std::function<void(const Location& loc, int amount)>;
+using Go = std::function<void(const Location& loc)>;
+
+static std::string tempPath(const char* name) {
+    std::string path = "/tmp/" + std::string(name) + "_" + std::to_string(getpid());
+    ::unlink(path.c_str());
+    return path;
+}
+
+class BillMachine : public StateMachine {
+public:
+    BillMachine(std::shared_ptr<Journal> journal) :StateMachine("journal_test") {
+        AttachJournal(journal, 1);
+        JOURNAL_CODEC(7, Bill, [](const Location& loc, int amount) { return std::to_string(amount); },
+                      [](const void* data, size_t size) { return std::make_tuple(std::stoi(std::string(static_cast<const char*>(data), size))); });
+        root.defer + DEFER_EVENT(Bill);
+        root.match + EVENT_2(Go, [this](const Location& loc) { Transition("ready"); });
+        root["ready"].match + EVENT_2(Bill, [this](const Location& loc, int amount) { seen_.push_back(amount); });
+    }
+
+    std::vector<int> seen_;
+};
+
+//延迟的事件处理之前不标记为已应用，重启后重新处理
+static void deferredEventSurvivesRestart() {
+    auto path = tempPath("journal_defer");
+    {
+        auto journal = Journal::Open(path);
+        BillMachine machine(journal);
+        machine.StartPolling(false);
+        machine.JOURNAL_EVENT_TASK(Bill, 42).Get();
+        machine.Poll();
+        CHECK(machine.seen_.empty());
+        journal->Sync();
+        CHECK(journal->GetUnappliedCount() == 1);
+        machine.Stop();
+    }
+    {
+        auto journal = Journal::Open(path);
+        CHECK(journal->GetUnappliedCount() == 1);
+        BillMachine machine(journal);
+        machine.StartPolling(false);
+        machine.ADD_EVENT_TASK(Go);
+        machine.Poll();
+        CHECK(machine.seen_ == std::vector<int>({ 42 }));
+        CHECK(journal->GetUnappliedCount() == 0);
+        machine.Stop();
+    }
+    {
+        auto journal = Journal::Open(path);
+        CHECK(journal->GetUnappliedCount() == 0);
+    }
+    ::unlink(path.c_str());
+}
+
+//写入失败时截掉写了一半的记录，之后提交的记录重启后仍然可以读到
+static void failedWriteIsRolledBack() {
+    auto path = tempPath("journal_rollback");
+    std::signal(SIGXFSZ, SIG_IGN);
+    struct rlimit saved;
+    CHECK(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+    {
+        auto journal = Journal::Open(path);
+        std::atomic<int> failures{ 0 };
+        auto count = [&failures](uint64_t, std::exception_ptr error) { failures += error ? 1 : 0; };
+        std::string small(16, 's');
+        journal->Append(1, 0, 1, small.data(), small.size(), count);
+        journal->Sync();
+        struct rlimit limited = saved;
+        limited.rlim_cur = 4096;
+        CHECK(setrlimit(RLIMIT_FSIZE, &limited) == 0);
+        std::string big(8192, 'b');
+        journal->Append(1, 0, 2, big.data(), big.size(), count);
+        journal->Sync();
+        CHECK(failures == 1);
+        CHECK(setrlimit(RLIMIT_FSIZE, &saved) == 0);
+        journal->Append(1, 0, 3, small.data(), small.size(), count);
+        journal->Sync();
+        CHECK(failures == 1);
+        CHECK(journal->GetUnappliedCount() == 2);
+    }
+    {
+        auto journal = Journal::Open(path);
+        auto records = journal->TakeRecovered(1);
+        CHECK(records.size() == 2);
+        CHECK(records[0].wire_id_ == 1 && records[1].wire_id_ == 3);
+    }
+    ::unlink(path.c_str());
+}
+
+//状态机析构时还在提交的记录不再投递给它，Completion 仍然完成，记录留到重启后处理
+static void commitAfterDestroyIsNotDelivered() {
+    auto path = tempPath("journal_destroy");
+    auto journal = Journal::Open(path);
+    std::vector<helper::Completion<void>> committed;
+    {
+        BillMachine machine(journal);
+        machine.StartPolling(false); //在轮询线程析构，析构时不等待提交
+        for (int i = 0; i < 200; ++i) {
+            committed.push_back(machine.JOURNAL_EVENT_TASK(Bill, i));
+        }
+    }
+    journal->Sync();
+    for (auto& completion : committed) {
+        completion.Get();
+    }
+    CHECK(journal->GetUnappliedCount() == 200);
+    ::unlink(path.c_str());
+}
+
+int main() {
+    commitAfterDestroyIsNotDelivered();
+    deferredEventSurvivesRestart();
+    failedWriteIsRolledBack();
+    std::printf("test_journal passed\n");
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "state_machine.h"
+#include "test_helper.h"
+
+using helper::Location;
+using helper::StateMachine;
+
+using Ping = std::function<void(const Location& loc, int seq)>;
+
+//统计分配的内存，转发给默认的 new/delete
+class CountingResource : public std::pmr::memory_resource {
+public:
+    std::atomic<size_t> allocations_{ 0 };
+    std::atomic<int64_t> outstanding_{ 0 };
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        ++allocations_;
+        outstanding_ += static_cast<int64_t>(bytes);
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        outstanding_ -= static_cast<int64_t>(bytes);
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+class PingMachine : public StateMachine {
+public:
+    explicit PingMachine(std::pmr::memory_resource* resource) :StateMachine("memory_resource_test", resource) {
+        root.match + EVENT_2(Ping, [this](const Location& loc, int seq) { ++seen_; });
+        root["a"]["b"].match + EVENT_2(Ping, [this](const Location& loc, int seq) { ++seen_; });
+    }
+
+    std::atomic<int> seen_{ 0 };
+};
+
+//状态树和任务队列从传入的 resource 分配，状态机析构后全部归还
+static void containersUseResource() {
+    CountingResource resource;
+    {
+        PingMachine machine(&resource);
+        CHECK(machine.GetMemoryResource() == &resource);
+        size_t after_build = resource.allocations_;
+        CHECK(after_build > 0);
+        machine.Start();
+        for (int i = 0; i < 100; ++i) {
+            machine.ADD_EVENT_TASK(Ping, i);
+        }
+        CHECK(test::WaitUntil([&]() { return machine.seen_ == 100; }));
+        CHECK(resource.allocations_ > after_build);
+        machine.Stop();
+    }
+    CHECK(resource.outstanding_ == 0);
+}
+
+//没有传入时使用默认的 resource
+static void defaultResource() {
+    PingMachine machine(nullptr);
+    CHECK(machine.GetMemoryResource() == std::pmr::get_default_resource());
+}
+
+int main() {
+    containersUseResource();
+    defaultResource();
+    std::printf("test_memory_resource passed\n");
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "message_buffer.h"
+#include "test_helper.h"
+
+using helper::MessageBuffer;
+using helper::WaitStrategy;
+using Clock = std::chrono::steady_clock;
+
+static int64_t elapsedMs(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+//超时为 0 时不忙等
+static void zeroTimeoutDoesNotSpin() {
+    MessageBuffer<int> buffer;
+    buffer.SetWaitStrategy(WaitStrategy::SPIN_YIELD_PARK, std::chrono::milliseconds(300), std::chrono::milliseconds(300));
+    int value = 0;
+    auto start = Clock::now();
+    CHECK(!buffer.Get(value, 0));
+    CHECK(elapsedMs(start) < 100);
+}
+
+//忙等和让出CPU的时间不超过超时时间
+static void spinIsCappedAtTimeout() {
+    MessageBuffer<int> buffer;
+    buffer.SetWaitStrategy(WaitStrategy::SPIN_YIELD_PARK, std::chrono::milliseconds(500), std::chrono::milliseconds(500));
+    int value = 0;
+    auto start = Clock::now();
+    CHECK(!buffer.Get(value, 20));
+    CHECK(elapsedMs(start) < 300);
+}
+
+//自适应策略在没有到达间隔时也忙等：外部数据源在忙等期间就绪，不需要等到条件变量超时
+static void adaptiveSpinsBeforeFirstArrival() {
+    MessageBuffer<int> buffer;
+    buffer.SetWaitStrategy(WaitStrategy::ADAPTIVE, std::chrono::milliseconds(100), std::chrono::microseconds(0));
+    int value = 0;
+    auto start = Clock::now();
+    auto ready = [start]() { return Clock::now() - start >= std::chrono::milliseconds(5); };
+    CHECK(!buffer.Get(value, 1000, ready));
+    CHECK(elapsedMs(start) < 500);
+}
+
+//消费者等待时修改等待方式
+static void changeStrategyWhileWaiting() {
+    MessageBuffer<int> buffer;
+    std::atomic<bool> done{ false };
+    std::thread consumer([&]() {
+        int value = 0;
+        for (int i = 0; i < 100; ++i) {
+            CHECK(buffer.Get(value, 2000));
+            CHECK(value == i);
+        }
+        done = true;
+    });
+    for (int i = 0; i < 100; ++i) {
+        buffer.SetWaitStrategy(i % 2 ? WaitStrategy::ADAPTIVE : WaitStrategy::SPIN_YIELD_PARK);
+        buffer.Put(i);
+    }
+    consumer.join();
+    CHECK(done.load());
+}
+
+//其他线程 Wakeup 的同时创建 eventfd，之后的 Wakeup 使 eventfd 可读
+static void wakeupWhileEnablingPollFd() {
+    MessageBuffer<int> buffer;
+    std::atomic<bool> stop{ false };
+    std::thread waker([&]() {
+        while (!stop) {
+            buffer.Wakeup();
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    int fd = buffer.EnablePollFd();
+    CHECK(fd >= 0 && buffer.GetPollFd() == fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    stop = true;
+    waker.join();
+    eventfd_t value = 0;
+    CHECK(eventfd_read(fd, &value) == 0 && value > 0);
+}
+
+int main() {
+    zeroTimeoutDoesNotSpin();
+    spinIsCappedAtTimeout();
+    adaptiveSpinsBeforeFirstArrival();
+    changeStrategyWhileWaiting();
+    wakeupWhileEnablingPollFd();
+    std::printf("test_message_buffer passed\n");
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+using helper::Location;
+using helper::StateMachine;
+
+using Enter = std::function<void(const Location& loc)>;
+using Ping = std::function<void(const Location& loc, int seq)>;
+
+class RegionMachine : public StateMachine {
+public:
+    explicit RegionMachine(bool concurrent) :StateMachine("parallel_test") {
+        root.match + EVENT_2(Enter, [this](const Location& loc) { Transition("regions"); });
+        auto& regions = root.parallel["regions"];
+        regions.concurrent = concurrent;
+        regions["left"].match + EVENT_2(Ping, [this](const Location& loc, int seq) { record("left", seq); });
+        regions["right"]["inner"].match + EVENT_2(Ping, [this](const Location& loc, int seq) { record("right", seq); });
+        regions["right"].onentry + [this]() { Transition("inner"); };
+    }
+
+    std::vector<std::string> Seen() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return seen_;
+    }
+
+private:
+    void record(const char* region, int seq) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        seen_.push_back(std::string(region) + std::to_string(seq));
+    }
+
+    std::mutex mtx_;
+    std::vector<std::string> seen_;
+};
+
+//concurrent 为 true 时没有 region executor 也广播到所有分支，嵌套子状态中的处理函数同样收到
+static void concurrentBroadcastsWithoutExecutor() {
+    RegionMachine machine(true);
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Enter);
+    machine.ADD_EVENT_TASK(Ping, 1);
+    machine.Poll();
+    auto seen = machine.Seen();
+    CHECK(seen.size() == 2);
+    CHECK(seen[0] == "left1" && seen[1] == "right1");
+    machine.Stop();
+}
+
+//concurrent 为 false 时从当前状态开始匹配，第一个匹配的分支处理后结束
+static void serialMatchesFirstRegion() {
+    RegionMachine machine(false);
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Enter);
+    machine.ADD_EVENT_TASK(Ping, 1);
+    machine.Poll();
+    auto seen = machine.Seen();
+    CHECK(seen.size() == 1);
+    machine.Stop();
+}
+
+int main() {
+    concurrentBroadcastsWithoutExecutor();
+    serialMatchesFirstRegion();
+    std::printf("test_parallel passed\n");
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <mutex>
+#include <vector>
+
+using helper::Location;
+using helper::StateMachine;
+
+using Ping = std::function<void(const Location& loc, int seq)>;
+using Ask = std::function<int(const Location& loc)>;
+
+class PollMachine : public StateMachine {
+public:
+    PollMachine() :StateMachine("polling_test") {
+        root.match + EVENT_2(Ping, [this](const Location& loc, int seq) {
+            std::lock_guard<std::mutex> lck(mtx_);
+            seen_.push_back(seq);
+            threads_.push_back(std::this_thread::get_id());
+        });
+        root.match + REQUEST_2(Ask, [](const Location& loc) { return 7; });
+    }
+
+    std::vector<int> Seen() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return seen_;
+    }
+
+    std::vector<std::thread::id> Threads() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return threads_;
+    }
+
+private:
+    std::mutex mtx_;
+    std::vector<int> seen_;
+    std::vector<std::thread::id> threads_;
+};
+
+//在轮询线程调用 Stop，剩余的任务在 Stop 中处理
+static void stopOnPollThreadDrains() {
+    PollMachine machine;
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Ping, 1);
+    machine.ADD_EVENT_TASK(Ping, 2);
+    machine.Stop();
+    CHECK(machine.Seen().size() == 2);
+    CHECK(machine.Poll() == 0);
+}
+
+//其他线程调用 Stop 只标记停止，处理函数仍在轮询线程执行
+static void stopFromOtherThreadIsDeferredToPollThread() {
+    PollMachine machine;
+    std::atomic<bool> started{ false };
+    std::atomic<bool> stopped{ false };
+    std::thread::id poll_thread;
+    std::thread loop([&]() {
+        poll_thread = std::this_thread::get_id();
+        machine.StartPolling(false);
+        started = true;
+        while (!stopped) {
+            machine.Poll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    CHECK(test::WaitUntil([&]() { return started.load(); }));
+    machine.ADD_EVENT_TASK(Ping, 1);
+    machine.ADD_EVENT_TASK(Ping, 2);
+    machine.Stop();
+    CHECK(test::WaitUntil([&]() { return machine.Seen().size() == 2; }));
+    CHECK(test::WaitUntil([&]() { return machine.GetWorkerThreadId() == poll_thread && machine.Poll() == 0; }));
+    stopped = true;
+    loop.join();
+    for (auto id : machine.Threads()) {
+        CHECK(id == poll_thread);
+    }
+}
+
+//其他线程不处理剩余任务地停止，等待中的请求以 TaskCancelled 结束
+static void stopWithoutConsumingCancelsRequests() {
+    PollMachine machine;
+    std::atomic<bool> started{ false };
+    std::atomic<bool> go{ false };
+    std::atomic<bool> stopped{ false };
+    std::thread loop([&]() {
+        machine.StartPolling(false);
+        started = true;
+        while (!go) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        while (!stopped) {
+            machine.Poll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    CHECK(test::WaitUntil([&]() { return started.load(); }));
+    auto answer = machine.ASYNC_REQUEST_TASK(Ask);
+    machine.Stop(false);
+    go = true;
+    bool cancelled = false;
+    CHECK(test::FinishesWithin([&]() {
+        try {
+            answer.Get();
+        }
+        catch (const StateMachine::TaskCancelled&) {
+            cancelled = true;
+        }
+    }));
+    CHECK(cancelled);
+    stopped = true;
+    loop.join();
+}
+
+//停止标记之后放入队列的请求在同一批中被取消，不会一直等待
+static void requestBehindStopMarkerIsCancelled() {
+    PollMachine machine;
+    machine.StartPolling(false);
+    std::thread([&machine]() { machine.Stop(); }).join();
+    auto answer = std::make_shared<decltype(machine.ASYNC_REQUEST_TASK(Ask))>();
+    std::thread([&machine, answer]() { *answer = machine.ASYNC_REQUEST_TASK(Ask); }).join();
+    CHECK(machine.Poll() == 0);
+    bool cancelled = false;
+    CHECK(test::FinishesWithin([&]() {
+        try {
+            answer->Get();
+        }
+        catch (const StateMachine::TaskCancelled&) {
+            cancelled = true;
+        }
+    }));
+    CHECK(cancelled);
+    CHECK(machine.GetCancelledCount() == 1);
+}
+
+int main() {
+    stopOnPollThreadDrains();
+    stopFromOtherThreadIsDeferredToPollThread();
+    stopWithoutConsumingCancelsRequests();
+    requestBehindStopMarkerIsCancelled();
+    std::printf("test_polling passed\n");
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <memory>
+#include <vector>
+
+using helper::Location;
+using helper::StateMachine;
+
+using Tick = std::function<void(const Location& loc, const std::vector<int>& values)>;
+
+class TickMachine : public StateMachine {
+public:
+    TickMachine(const std::string& name, const std::string& group) :StateMachine(name) {
+        SetGroup(group);
+        root.match + EVENT_2(Tick, [this](const Location& loc, const std::vector<int>& values) {
+            last_ = &values;
+            ++ticks_;
+        });
+    }
+
+    std::atomic<int> ticks_{ 0 };
+    std::atomic<const std::vector<int>*> last_{ nullptr };
+};
+
+//广播只投递给分组中存活的状态机，所有目标共享同一份参数
+static void broadcastReachesLiveGroupMembers() {
+    std::vector<std::unique_ptr<TickMachine>> group;
+    for (int i = 0; i < 3; ++i) {
+        group.emplace_back(new TickMachine("registry_test_" + std::to_string(i), "registry_test"));
+        group.back()->Start();
+    }
+    TickMachine outsider("registry_test_outsider", "registry_test_other");
+    outsider.Start();
+    auto result = BROADCAST_EVENT_TASK("registry_test", Tick, std::vector<int>{ 1, 2, 3 });
+    CHECK(result.targets_ == 3 && result.delivered_ == 3);
+    for (auto& machine : group) {
+        CHECK(test::WaitUntil([&]() { return machine->ticks_ == 1; }));
+    }
+    CHECK(group[0]->last_.load() == group[1]->last_.load() && group[1]->last_.load() == group[2]->last_.load());
+    CHECK(outsider.ticks_ == 0);
+
+    group[1]->Stop();
+    result = BROADCAST_EVENT_TASK("registry_test", Tick, std::vector<int>{ 4 });
+    CHECK(result.targets_ == 2 && result.delivered_ == 2);
+    CHECK(test::WaitUntil([&]() { return group[0]->ticks_ == 2 && group[2]->ticks_ == 2; }));
+    CHECK(group[1]->ticks_ == 1);
+
+    bool found = StateMachine::MachineRegistry::Instance().Visit("registry_test_2", [](StateMachine& machine) {
+        CHECK(machine.GetGroup() == "registry_test");
+    });
+    CHECK(found);
+    CHECK(!StateMachine::MachineRegistry::Instance().Visit("registry_test_1", [](StateMachine&) {}));
+    for (auto& machine : group) {
+        machine->Stop();
+    }
+    outsider.Stop();
+    CHECK(BROADCAST_EVENT_TASK("registry_test", Tick, std::vector<int>{}).targets_ == 0);
+}
+
+//每个目标有自己的任务记录：一个目标取消广播的事件不影响其他目标处理
+static void broadcastTargetsHaveOwnState() {
+    TickMachine first("registry_state_0", "registry_state");
+    TickMachine second("registry_state_1", "registry_state");
+    first.StartPolling(false);
+    second.StartPolling(false);
+    auto result = BROADCAST_EVENT_TASK("registry_state", Tick, std::vector<int>{ 1 });
+    CHECK(result.delivered_ == 2);
+    first.Stop(false);
+    CHECK(first.GetCancelledCount() == 1);
+    CHECK(second.Poll() == 1);
+    CHECK(second.ticks_ == 1);
+    second.Stop();
+}
+
+int main() {
+    broadcastReachesLiveGroupMembers();
+    broadcastTargetsHaveOwnState();
+    std::printf("test_registry passed\n");
+    return 0;
+}
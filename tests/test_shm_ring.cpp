@@ -0,0 +1,91 @@
+#include "shm_ring.h"
+#include "test_helper.h"
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using helper::ShmRing;
+
+static const uint32_t kMarker = 0xABCDEF12;
+
+//把共享内存整个映射进来，按事件ID找到记录头
+static uint32_t* findRecordSize(void* addr, size_t size) {
+    auto words = static_cast<uint32_t*>(addr);
+    for (size_t i = 1; i < size / sizeof(uint32_t); ++i) {
+        if (words[i] == kMarker && words[i - 1] == 8) {
+            return &words[i - 1];
+        }
+    }
+    return nullptr;
+}
+
+static void roundTrip() {
+    auto ring = ShmRing::CreateAnonymous(4096);
+    uint64_t value = 42;
+    CHECK(ring->Post(3, 7, &value, sizeof(value)));
+    bool read = ring->TryRead([](uint16_t type, uint32_t event_id, const void* data, size_t size) {
+        uint64_t got = 0;
+        std::memcpy(&got, data, sizeof(got));
+        CHECK(type == 3 && event_id == 7 && size == sizeof(got) && got == 42);
+    });
+    CHECK(read);
+    CHECK(ring->Empty());
+    CHECK(ring->GetCorruptCount() == 0);
+}
+
+//记录长度超出缓冲区时计为丢弃，不再读取
+static void corruptRecordStopsReading() {
+    auto ring = ShmRing::CreateAnonymous(4096);
+    uint64_t value = 1;
+    CHECK(ring->Post(1, kMarker, &value, sizeof(value)));
+    CHECK(ring->Post(1, kMarker + 1, &value, sizeof(value)));
+    struct stat st;
+    CHECK(fstat(ring->GetFd(), &st) == 0);
+    void* addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->GetFd(), 0);
+    CHECK(addr != MAP_FAILED);
+    auto size = findRecordSize(addr, st.st_size);
+    CHECK(size != nullptr);
+    *size = 0x00FFFFFF;
+    int calls = 0;
+    CHECK(!ring->TryRead([&calls](uint16_t, uint32_t, const void*, size_t) { ++calls; }));
+    CHECK(calls == 0);
+    CHECK(ring->GetCorruptCount() == 1);
+    CHECK(ring->Empty());
+    CHECK(!ring->TryRead([&calls](uint16_t, uint32_t, const void*, size_t) { ++calls; }));
+    CHECK(ring->GetCorruptCount() == 1);
+    munmap(addr, st.st_size);
+}
+
+//写入位置超出读取位置一个容量以上时同样停止
+static void corruptTailStopsReading() {
+    auto ring = ShmRing::CreateAnonymous(4096);
+    auto other = ShmRing::Open(dup(ring->GetFd()));
+    uint64_t value = 1;
+    CHECK(other->Post(1, 2, &value, sizeof(value)));
+    struct stat st;
+    CHECK(fstat(ring->GetFd(), &st) == 0);
+    void* addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->GetFd(), 0);
+    CHECK(addr != MAP_FAILED);
+    //尾部位置是头部中唯一等于一条 8 字节记录长度（32）的 64 位字
+    auto words = static_cast<uint64_t*>(addr);
+    bool patched = false;
+    for (size_t i = 0; i < 256 / sizeof(uint64_t); ++i) {
+        if (words[i] == 32) {
+            words[i] = 1ull << 40;
+            patched = true;
+            break;
+        }
+    }
+    CHECK(patched);
+    CHECK(!ring->TryRead([](uint16_t, uint32_t, const void*, size_t) {}));
+    CHECK(ring->GetCorruptCount() == 1);
+    munmap(addr, st.st_size);
+}
+
+int main() {
+    roundTrip();
+    corruptRecordStopsReading();
+    corruptTailStopsReading();
+    std::printf("test_shm_ring passed\n");
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "sim_executor.h"
+#include "test_helper.h"
+#include <set>
+#include <string>
+#include <vector>
+
+using helper::Location;
+using helper::SimExecutor;
+using helper::StateMachine;
+
+using Ping = std::function<void(const Location& loc, int seq)>;
+
+class TraceMachine : public StateMachine {
+public:
+    TraceMachine(const std::string& name, std::vector<std::string>& trace) :StateMachine(name), trace_(trace) {
+        root.match + EVENT_2(Ping, [this](const Location& loc, int seq) { trace_.push_back(GetName() + std::to_string(seq)); });
+    }
+
+private:
+    std::vector<std::string>& trace_;
+};
+
+static std::vector<std::string> runWithSeed(uint64_t seed) {
+    std::vector<std::string> trace;
+    SimExecutor sim(seed);
+    TraceMachine a("a", trace);
+    TraceMachine b("b", trace);
+    sim.Add(a);
+    sim.Add(b);
+    for (int i = 0; i < 5; ++i) {
+        a.ADD_EVENT_TASK(Ping, i);
+        b.ADD_EVENT_TASK(Ping, i);
+    }
+    CHECK(sim.Run());
+    CHECK(sim.GetProcessedCount() == 10);
+    a.Stop();
+    b.Stop();
+    return trace;
+}
+
+//相同的种子得到相同的交错顺序，不同的种子可以得到不同的顺序
+static void sameSeedSameOrder() {
+    CHECK(runWithSeed(7) == runWithSeed(7));
+    std::set<std::vector<std::string>> orders;
+    for (uint64_t seed = 0; seed < 20; ++seed) {
+        orders.insert(runWithSeed(seed));
+    }
+    CHECK(orders.size() > 1);
+}
+
+//定时器只在推进虚拟时间时到期，同一时间的定时器按加入顺序执行
+static void virtualTimeDrivesTimers() {
+    std::vector<std::string> trace;
+    SimExecutor sim(1);
+    TraceMachine a("a", trace);
+    sim.Add(a);
+    auto start = sim.Now();
+    sim.After(std::chrono::milliseconds(100), [&a]() { a.ADD_EVENT_TASK(Ping, 1); });
+    sim.AdvanceBy(std::chrono::milliseconds(50));
+    CHECK(trace.empty());
+    sim.AdvanceBy(std::chrono::milliseconds(60));
+    CHECK(trace == std::vector<std::string>({ "a1" }));
+    CHECK(sim.Now() - start == std::chrono::milliseconds(110));
+
+    sim.After(std::chrono::milliseconds(30), [&a]() { a.ADD_EVENT_TASK(Ping, 2); });
+    sim.After(std::chrono::milliseconds(30), [&a]() { a.ADD_EVENT_TASK(Ping, 3); });
+    CHECK(sim.Run());
+    CHECK(trace == std::vector<std::string>({ "a1", "a2", "a3" }));
+    CHECK(sim.Now() - start == std::chrono::milliseconds(140));
+    a.Stop();
+}
+
+int main() {
+    sameSeedSameOrder();
+    virtualTimeDrivesTimers();
+    std::printf("test_sim_executor passed\n");
+    return 0;
+}
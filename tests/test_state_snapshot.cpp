@@ -0,0 +1,52 @@
+#include "state_machine.h"
+#include "test_helper.h"
+
+using helper::Location;
+using helper::StateMachine;
+
+using Flip = std::function<void(const Location& loc)>;
+
+class FlipMachine : public StateMachine {
+public:
+    FlipMachine() :StateMachine("snapshot_test") {
+        root.onentry + [this]() { Transition("a"); };
+        root["a"].match + EVENT_2(Flip, [this](const Location& loc) { Transition("b"); });
+        root["b"].match + EVENT_2(Flip, [this](const Location& loc) { Transition("a"); });
+    }
+};
+
+//其他线程读到的当前状态和活动配置来自同一次发布：a、b 恰好一个在配置中，且就是当前状态
+static void configurationIsConsistent() {
+    FlipMachine machine;
+    machine.Start();
+    StateMachine::StateHandle handles[] = { machine.GetStateHandle("a"), machine.GetStateHandle("b") };
+    CHECK(handles[0] != StateMachine::kInvalidState && handles[1] != StateMachine::kInvalidState);
+    //Start 返回时根状态的 onentry 可能还没有转移到 a
+    CHECK(machine.WaitForState(handles[0], std::chrono::milliseconds(1000)));
+    std::atomic<bool> done{ false };
+    std::thread producer([&]() {
+        for (int i = 0; i < 20000; ++i) {
+            machine.ADD_EVENT_TASK(Flip);
+        }
+        done = true;
+    });
+    uint64_t reads = 0;
+    uint32_t last_version = 0;
+    while (!done || reads < 1000) {
+        bool active[2];
+        auto snapshot = machine.ReadConfiguration(handles, active, 2);
+        CHECK(active[0] != active[1]);
+        CHECK(snapshot.state_ == (active[0] ? handles[0] : handles[1]));
+        CHECK(snapshot.version_ >= last_version);
+        last_version = snapshot.version_;
+        ++reads;
+    }
+    producer.join();
+    machine.Stop();
+}
+
+int main() {
+    configurationIsConsistent();
+    std::printf("test_state_snapshot passed\n");
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if !defined(HELPER_STEP_TASK)
+#error "test_step_task must be built with C++20 coroutines"
+#endif
+
+using helper::Journal;
+using helper::Location;
+using helper::StateMachine;
+using helper::StepTask;
+
+using Fetch = std::function<StepTask<int>(const Location& loc, int offset)>;
+using Note = std::function<void(const Location& loc, int seq)>;
+
+class FetchMachine : public StateMachine {
+public:
+    explicit FetchMachine(SuspendPolicy policy) :StateMachine("step_task_test") {
+        auto source = helper::MakeCompletion<int>();
+        slot_ = source.first;
+        source_ = source.second;
+        SetSuspendPolicy(policy);
+        root.match + REQUEST_2(Fetch, [this](const Location& loc, int offset)->StepTask<int> {
+            record(-1);
+            int value = co_await source_;
+            record(-2);
+            co_return value + offset;
+        });
+        root.match + EVENT_2(Note, [this](const Location& loc, int seq) { record(seq); });
+    }
+
+    std::vector<int> Seen() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return seen_;
+    }
+
+    std::shared_ptr<helper::OneShot<int>> slot_;
+    helper::Completion<int> source_;
+
+private:
+    void record(int value) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        seen_.push_back(value);
+    }
+
+    std::mutex mtx_;
+    std::vector<int> seen_;
+};
+
+//BUFFER：挂起期间的事件在运行步骤结束后处理，请求得到协程的返回值
+static void bufferHoldsTasksWhileSuspended() {
+    FetchMachine machine(StateMachine::SuspendPolicy::BUFFER);
+    machine.Start();
+    auto result = machine.ASYNC_REQUEST_TASK(Fetch, 1);
+    CHECK(test::WaitUntil([&]() { return machine.GetSuspendedStepCount() == 1; }));
+    machine.ADD_EVENT_TASK(Note, 7);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(machine.Seen() == std::vector<int>({ -1 }));
+    machine.slot_->SetValue(41);
+    CHECK(result.Get() == 42);
+    CHECK(test::WaitUntil([&]() { return machine.Seen().size() == 3; }));
+    CHECK(machine.Seen() == std::vector<int>({ -1, -2, 7 }));
+    CHECK(machine.GetSuspendedStepCount() == 0);
+    machine.Stop();
+}
+
+//INTERLEAVE：挂起期间 worker 线程继续处理事件
+static void interleaveKeepsWorkerRunning() {
+    FetchMachine machine(StateMachine::SuspendPolicy::INTERLEAVE);
+    machine.Start();
+    auto result = machine.ASYNC_REQUEST_TASK(Fetch, 2);
+    CHECK(test::WaitUntil([&]() { return machine.GetSuspendedStepCount() == 1; }));
+    machine.ADD_EVENT_TASK(Note, 7);
+    CHECK(test::WaitUntil([&]() { return machine.Seen().size() == 2; }));
+    machine.slot_->SetValue(40);
+    CHECK(result.Get() == 42);
+    CHECK(machine.Seen() == std::vector<int>({ -1, 7, -2 }));
+    machine.Stop();
+}
+
+//停止时销毁没有恢复的协程，请求以 TaskCancelled 结束
+static void stopCancelsSuspendedStep() {
+    FetchMachine machine(StateMachine::SuspendPolicy::BUFFER);
+    machine.Start();
+    auto result = machine.ASYNC_REQUEST_TASK(Fetch, 1);
+    CHECK(test::WaitUntil([&]() { return machine.GetSuspendedStepCount() == 1; }));
+    machine.Stop();
+    CHECK_THROWS(result.Get(), StateMachine::TaskCancelled);
+    CHECK(machine.GetSuspendedStepCount() == 0);
+}
+
+using Charge = std::function<StepTask<>(const Location& loc, int amount)>;
+
+class ChargeMachine : public StateMachine {
+public:
+    explicit ChargeMachine(std::shared_ptr<Journal> journal) :StateMachine("step_journal_test") {
+        auto source = helper::MakeCompletion<int>();
+        slot_ = source.first;
+        source_ = source.second;
+        AttachJournal(journal, 1);
+        JOURNAL_CODEC(3, Charge, [](const Location& loc, int amount) { return std::to_string(amount); },
+                      [](const void* data, size_t size) { return std::make_tuple(std::stoi(std::string(static_cast<const char*>(data), size))); });
+        root.match + EVENT_2(Charge, [this](const Location& loc, int amount)->StepTask<> {
+            total_ += co_await source_ + amount;
+        });
+    }
+
+    std::shared_ptr<helper::OneShot<int>> slot_;
+    helper::Completion<int> source_;
+    int total_ = 0;
+};
+
+//挂起的协程在结束时才把日志记录标记为已应用
+static void journalMarkedWhenStepFinishes() {
+    std::string path = "/tmp/step_journal_" + std::to_string(getpid());
+    ::unlink(path.c_str());
+    auto journal = Journal::Open(path);
+    {
+        ChargeMachine machine(journal);
+        machine.StartPolling(false);
+        machine.JOURNAL_EVENT_TASK(Charge, 5).Get();
+        machine.Poll();
+        CHECK(machine.GetSuspendedStepCount() == 1);
+        journal->Sync();
+        CHECK(journal->GetUnappliedCount() == 1);
+        machine.slot_->SetValue(1);
+        machine.Poll();
+        CHECK(machine.GetSuspendedStepCount() == 0);
+        CHECK(machine.total_ == 6);
+        CHECK(journal->GetUnappliedCount() == 0);
+        machine.Stop();
+    }
+    ::unlink(path.c_str());
+}
+
+using Label = std::function<StepTask<>(const Location& loc, const std::string& text)>;
+
+class LabelMachine : public StateMachine {
+public:
+    LabelMachine() :StateMachine("step_task_label") {
+        auto source = helper::MakeCompletion<int>();
+        slot_ = source.first;
+        source_ = source.second;
+        root.match + EVENT_2(Label, [this](const Location& loc, const std::string& text)->StepTask<> {
+            co_await source_;
+            label_ = text;
+            line_ = loc.line_number();
+        });
+    }
+
+    std::shared_ptr<helper::OneShot<int>> slot_;
+    helper::Completion<int> source_;
+    std::string label_;
+    int line_ = 0;
+};
+
+//协程的引用形参在恢复后仍然有效：事件的参数和位置保留到协程结束
+static void referenceArgsOutliveSuspension() {
+    LabelMachine machine;
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Label, std::string(64, 'x'));
+    CHECK(machine.Poll() == 1);
+    CHECK(machine.GetSuspendedStepCount() == 1);
+    machine.slot_->SetValue(1);
+    machine.Poll();
+    CHECK(machine.GetSuspendedStepCount() == 0);
+    CHECK(machine.label_ == std::string(64, 'x'));
+    CHECK(machine.line_ > 0);
+    machine.Stop();
+}
+
+int main() {
+    referenceArgsOutliveSuspension();
+    bufferHoldsTasksWhileSuspended();
+    interleaveKeepsWorkerRunning();
+    stopCancelsSuspendedStep();
+    journalMarkedWhenStepFinishes();
+    std::printf("test_step_task passed\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <memory>
+#include <vector>
+
+using helper::Location;
+using helper::StateMachine;
+using Clock = std::chrono::steady_clock;
+
+using Work = std::function<void(const Location& loc, int ms)>;
+using Ask = std::function<int(const Location& loc)>;
+
+class WorkMachine : public StateMachine {
+public:
+    explicit WorkMachine(const std::string& group) :StateMachine("stop_all_test") {
+        SetGroup(group);
+        root.match + EVENT_2(Work, [this](const Location& loc, int ms) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+            ++done_;
+        });
+        root.match + REQUEST_2(Ask, [](const Location& loc) { return 42; });
+    }
+
+    std::atomic<int> done_{ 0 };
+};
+
+//各状态机并行处理剩余的任务，期限之前都处理完
+static void drainsInParallel() {
+    std::vector<std::unique_ptr<WorkMachine>> machines;
+    std::vector<StateMachine*> targets;
+    for (int i = 0; i < 4; ++i) {
+        machines.emplace_back(new WorkMachine("stop_all_parallel"));
+        machines.back()->Start();
+        targets.push_back(machines.back().get());
+        for (int n = 0; n < 20; ++n) {
+            machines.back()->ADD_EVENT_TASK(Work, 20);
+        }
+    }
+    auto start = Clock::now();
+    StateMachine::StopAll(targets, Clock::now() + std::chrono::seconds(10));
+    auto elapsed = Clock::now() - start;
+    for (auto& machine : machines) {
+        CHECK(machine->done_ == 20);
+    }
+    CHECK(elapsed < std::chrono::milliseconds(1200)); //逐个停止需要 1600ms
+}
+
+//超过期限后剩余的任务被取消，请求以 TaskCancelled 结束
+static void deadlineCancelsRemaining() {
+    WorkMachine machine("stop_all_deadline");
+    machine.Start();
+    for (int n = 0; n < 100; ++n) {
+        machine.ADD_EVENT_TASK(Work, 20);
+    }
+    auto answer = machine.ASYNC_REQUEST_TASK(Ask);
+    auto start = Clock::now();
+    StateMachine::StopAll("stop_all_deadline", std::chrono::milliseconds(50));
+    CHECK(Clock::now() - start < std::chrono::milliseconds(1000));
+    CHECK(machine.done_ < 100);
+    CHECK(machine.GetCancelledCount() > 0);
+    CHECK_THROWS(answer.Get(), StateMachine::TaskCancelled);
+}
+
+//与 StopAll 并发以及之后放入的阻塞请求都会结束：处理完成或以 TaskCancelled 结束
+static void concurrentRequestsFinish() {
+    for (int round = 0; round < 20; ++round) {
+        auto machine = std::make_shared<WorkMachine>("stop_all_concurrent");
+        machine->Start();
+        auto stopped = std::make_shared<std::atomic<bool>>(false);
+        auto answered = std::make_shared<std::atomic<int>>(0);
+        auto cancelled = std::make_shared<std::atomic<int>>(0);
+        auto ask = [machine, answered, cancelled]() {
+            try {
+                CHECK(machine->ADD_REQUEST_TASK(Ask) == 42);
+                ++*answered;
+            }
+            catch (const StateMachine::TaskCancelled&) {
+                ++*cancelled;
+            }
+        };
+        CHECK(test::FinishesWithin([ask, stopped]() {
+            std::thread producer([ask, stopped]() {
+                while (!*stopped) {
+                    ask();
+                }
+                ask();
+            });
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            StateMachine::StopAll("stop_all_concurrent", std::chrono::milliseconds(100));
+            *stopped = true;
+            producer.join();
+        }));
+        CHECK(*cancelled >= 1); //停止之后放入的请求被取消
+        CHECK(*answered + *cancelled > 1);
+    }
+}
+
+int main() {
+    drainsInParallel();
+    deadlineCancelsRemaining();
+    concurrentRequestsFinish();
+    std::printf("test_stop_all passed\n");
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include "thread_pool.h"
+#include "test_helper.h"
+#include <string>
+#include <vector>
+
+using helper::ThreadPool;
+
+static void runsTasks() {
+    ThreadPool pool(2, "test_pool");
+    auto result = pool.Submit([]() { return 6 * 7; });
+    CHECK(result.get() == 42);
+    CHECK(pool.GetPlacementFailures() == 0);
+}
+
+//绑定到不存在的核失败时报告错误，线程仍然可以执行任务
+static void reportsPlacementFailures() {
+    std::atomic<int> errors{ 0 };
+    ThreadPool pool(2, "test_pool", { 100000 }, 0, [&errors](const std::exception* e) {
+        CHECK(std::string(e->what()).find("affinity") != std::string::npos);
+        ++errors;
+    });
+    CHECK(pool.GetPlacementFailures() == 2);
+    CHECK(errors == 2);
+    auto result = pool.Submit([]() { return 1; });
+    CHECK(result.get() == 1);
+}
+
+int main() {
+    runsTasks();
+    reportsPlacementFailures();
+    std::printf("test_thread_pool passed\n");
+    return 0;
+}
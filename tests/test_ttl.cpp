@@ -0,0 +1,95 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <vector>
+
+using helper::Location;
+using helper::StateMachine;
+using Clock = std::chrono::steady_clock;
+
+using Ping = std::function<void(const Location& loc, int seq)>;
+using Ask = std::function<int(const Location& loc)>;
+
+class TtlMachine : public StateMachine {
+public:
+    TtlMachine() :StateMachine("ttl_test") {
+        SetClock([this]() {
+            int64_t now = now_.load() + (IsInWorkerThread() ? worker_ahead_.load() : 0);
+            return Clock::time_point(std::chrono::milliseconds(now));
+        });
+        root.match + EVENT_2(Ping, [this](const Location& loc, int seq) { seen_.push_back(seq); });
+        root.match + REQUEST_2(Ask, [](const Location& loc) { return 42; });
+    }
+
+    std::atomic<int64_t> now_{ 1000 }; //虚拟时间，毫秒
+    std::atomic<int64_t> worker_ahead_{ 0 }; //worker 线程看到的时间超前的量
+    std::vector<int> seen_;
+};
+
+//在队列中超过存活时间的事件出队时丢弃，没有过期的照常处理
+static void expiredEventIsDropped() {
+    TtlMachine machine;
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK_FOR(std::chrono::milliseconds(10), Ping, 1);
+    machine.ADD_EVENT_TASK_FOR(std::chrono::milliseconds(100), Ping, 2);
+    machine.ADD_EVENT_TASK(Ping, 3);
+    machine.now_ += 50;
+    machine.Poll();
+    CHECK(machine.seen_ == std::vector<int>({ 2, 3 }));
+    CHECK(machine.GetExpiredCount() == 1);
+    machine.Stop();
+}
+
+//SetTaskTtl 是默认存活时间
+static void defaultTtlApplies() {
+    TtlMachine machine;
+    machine.SetTaskTtl(std::chrono::milliseconds(10));
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Ping, 1);
+    machine.now_ += 20;
+    machine.ADD_EVENT_TASK(Ping, 2);
+    machine.Poll();
+    CHECK(machine.seen_ == std::vector<int>({ 2 }));
+    CHECK(machine.GetExpiredCount() == 1);
+    machine.Stop();
+}
+
+//取消还没有处理的任务；已经处理的任务不能再取消
+static void cancelBeforeDequeue() {
+    TtlMachine machine;
+    machine.StartPolling(false);
+    auto first = machine.ADD_EVENT_TASK(Ping, 1);
+    auto second = machine.ADD_EVENT_TASK(Ping, 2);
+    CHECK(first.Cancel());
+    CHECK(!first.Cancel());
+    machine.Poll();
+    CHECK(machine.seen_ == std::vector<int>({ 2 }));
+    CHECK(machine.GetCancelledCount() == 1);
+    CHECK(!second.Cancel());
+    machine.Stop();
+}
+
+//过期的请求以 TaskTimeout 结束，调用方不会一直等待
+static void expiredRequestThrows() {
+    TtlMachine machine;
+    machine.worker_ahead_ = 50; //请求在投递时计算期限，worker 线程出队时已经过期
+    machine.Start();
+    bool timed_out = false;
+    try {
+        machine.ADD_REQUEST_TASK_FOR(std::chrono::milliseconds(10), Ask);
+    }
+    catch (const StateMachine::TaskTimeout&) {
+        timed_out = true;
+    }
+    CHECK(timed_out);
+    CHECK(machine.GetExpiredCount() == 1);
+    machine.Stop();
+}
+
+int main() {
+    expiredEventIsDropped();
+    defaultTtlApplies();
+    cancelBeforeDequeue();
+    expiredRequestThrows();
+    std::printf("test_ttl passed\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using helper::Location;
+using helper::StateMachine;
+
+using Ping = std::function<void(const Location& loc, int seq)>;
+using Pong = std::function<void(const Location& loc, int seq)>; //同一函数类型的另一个名字
+using Lost = std::function<void(const Location& loc)>;
+
+//任务记录的签名仍是字符串，可以由签名直接构造
+static_assert(std::is_same<decltype(StateMachine::TaskData::signature_), std::string>::value, "signature_ must stay a std::string");
+
+class UnmatchedMachine : public StateMachine {
+public:
+    UnmatchedMachine() :StateMachine("unmatched_test") {
+        root.match + EVENT_2(Ping, [this](const Location& loc, int seq) { record("ping", seq); });
+        root.match + EVENT_2(Pong, [this](const Location& loc, int seq) { record("pong", seq); });
+    }
+
+    std::vector<std::string> Seen() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return seen_;
+    }
+
+private:
+    void record(const char* name, int seq) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        seen_.push_back(std::string(name) + std::to_string(seq));
+    }
+
+    std::mutex mtx_;
+    std::vector<std::string> seen_;
+};
+
+//同一函数类型用不同的名字投递，按各自的签名匹配
+static void aliasesKeepTheirOwnSignature() {
+    UnmatchedMachine machine;
+    machine.Start();
+    for (int i = 0; i < 3; ++i) {
+        machine.ADD_EVENT_TASK(Ping, i);
+        machine.ADD_EVENT_TASK(Pong, i);
+    }
+    CHECK(test::WaitUntil([&]() { return machine.Seen().size() == 6; }));
+    auto seen = machine.Seen();
+    CHECK(seen[0] == "ping0" && seen[1] == "pong0" && seen[4] == "ping2" && seen[5] == "pong2");
+    machine.Stop();
+}
+
+//未匹配任务的异常描述在 what() 中生成，包含签名
+static void unmatchedTaskDescribesSignature() {
+    UnmatchedMachine machine;
+    std::mutex mtx;
+    std::vector<std::string> messages;
+    std::vector<std::string> signatures;
+    machine.SetExceptionHandler([&](const std::exception* e) {
+        auto unmatched = dynamic_cast<const StateMachine::UnmatchedTask*>(e);
+        if (unmatched) {
+            std::lock_guard<std::mutex> lck(mtx);
+            messages.push_back(unmatched->what());
+            signatures.push_back(unmatched->GetSignature());
+        }
+    });
+    machine.Start();
+    machine.ADD_EVENT_TASK(Lost);
+    machine.ADD_EVENT_TASK(Lost);
+    CHECK(test::WaitUntil([&]() { std::lock_guard<std::mutex> lck(mtx); return messages.size() == 2; }));
+    machine.Stop();
+    CHECK(messages[0].find("Unmatched Task") == 0);
+    CHECK(messages[0].find("Lost") != std::string::npos);
+    CHECK(signatures[0] == signatures[1]);
+    CHECK(signatures[0].find("Lost") != std::string::npos);
+}
+
+//由签名构造的任务记录驻留签名，ID与签名一致
+static void taskDataFromSignature() {
+    StateMachine::TaskData task_data(Location(), StateMachine::MessageType::EVENT, std::string("custom signature"));
+    CHECK(task_data.signature_ == "custom signature");
+    CHECK(helper::EventIdRegistry::Name(task_data.event_id_) == "custom signature");
+    StateMachine::TaskData by_id(Location(), StateMachine::MessageType::EVENT, task_data.event_id_);
+    CHECK(by_id.signature_.empty());
+    CHECK(by_id.GetSignature() == "custom signature");
+}
+
+//没有设置通知时也按签名ID计数，可以在其他线程读取
+static void unmatchedCountsBySignature() {
+    UnmatchedMachine machine;
+    machine.Start();
+    machine.ADD_EVENT_TASK(Lost);
+    machine.ADD_EVENT_TASK(Lost);
+    machine.ADD_EVENT_TASK(Ping, 1);
+    CHECK(test::WaitUntil([&]() { return machine.GetUnmatchedCount() == 2 && machine.Seen().size() == 1; }));
+    auto counts = machine.GetUnmatchedCounts();
+    CHECK(counts.size() == 1);
+    CHECK(counts.begin()->second == 2);
+    CHECK(helper::EventIdRegistry::Name(counts.begin()->first).find("Lost") != std::string::npos);
+    machine.Stop();
+}
+
+int main() {
+    aliasesKeepTheirOwnSignature();
+    unmatchedTaskDescribesSignature();
+    taskDataFromSignature();
+    unmatchedCountsBySignature();
+    std::printf("test_unmatched passed\n");
+    return 0;
+}
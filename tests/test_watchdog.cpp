@@ -0,0 +1,90 @@
+#include "state_machine.h"
+#include "test_helper.h"
+#include <stdexcept>
+
+using helper::Location;
+using helper::StateMachine;
+
+using Slow = std::function<void(const Location& loc, int ms)>;
+using Fail = std::function<void(const Location& loc, int ms)>;
+
+class SlowMachine : public StateMachine {
+public:
+    SlowMachine() :StateMachine("watchdog_test") {
+        root.match + EVENT_2(Slow, [](const Location& loc, int ms) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        });
+        root.match + EVENT_3(Fail, [](const Location& loc, int ms)->bool {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+            throw std::runtime_error("guard failed");
+        }, [](const Location& loc, int ms) {});
+    }
+};
+
+//条件函数抛出异常时也结束计时并通知超时
+static void throwingGuardEndsWatch() {
+    SlowMachine machine;
+    std::atomic<int> notices{ 0 };
+    machine.EnableWatchdog([&](const StateMachine::SlowHandlerNotice&) { ++notices; }, std::chrono::milliseconds(5));
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Fail, 20);
+    CHECK_THROWS(machine.Poll(), std::runtime_error);
+    CHECK(notices == 1);
+    CHECK(machine.GetSlowHandlerCount() == 1);
+    machine.ADD_EVENT_TASK(Slow, 0);
+    machine.Poll();
+    CHECK(machine.GetSlowHandlerCount() == 1);
+    machine.Stop();
+}
+
+//没有配置时间上限时不计时
+static void noBudgetSkipsWatch() {
+    SlowMachine machine;
+    std::atomic<int> notices{ 0 };
+    machine.EnableWatchdog([&](const StateMachine::SlowHandlerNotice&) { ++notices; }, std::chrono::milliseconds(0));
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Slow, 10);
+    machine.Poll();
+    CHECK(notices == 0);
+    machine.Stop();
+}
+
+//处理函数的时间上限覆盖默认值
+static void handlerBudgetApplies() {
+    SlowMachine machine;
+    std::atomic<int> notices{ 0 };
+    machine.EnableWatchdog([&](const StateMachine::SlowHandlerNotice&) { ++notices; }, std::chrono::milliseconds(0));
+    machine.SET_HANDLER_BUDGET(Slow, std::chrono::milliseconds(2));
+    machine.StartPolling(false);
+    machine.ADD_EVENT_TASK(Slow, 10);
+    machine.Poll();
+    CHECK(notices == 1);
+    machine.Stop();
+}
+
+//看门狗线程在注册表的锁外通知，处理函数中可以停止状态机
+static void handlerMayStopMachine() {
+    SlowMachine machine;
+    std::atomic<bool> stopping{ false };
+    std::atomic<bool> stopped{ false };
+    machine.EnableWatchdog([&](const StateMachine::SlowHandlerNotice&) {
+        if (!stopping.exchange(true)) {
+            machine.Stop();
+            stopped = true;
+        }
+    }, std::chrono::milliseconds(5));
+    StateMachine::StartWatchdog(std::chrono::milliseconds(5));
+    machine.Start();
+    machine.ADD_EVENT_TASK(Slow, 100);
+    CHECK(test::WaitUntil([&stopped]() { return stopped.load(); }));
+    StateMachine::StopWatchdog();
+}
+
+int main() {
+    throwingGuardEndsWatch();
+    noBudgetSkipsWatch();
+    handlerBudgetApplies();
+    handlerMayStopMachine();
+    std::printf("test_watchdog passed\n");
+    return 0;
+}
@@ -1,6 +1,8 @@
 #pragma once
 // clang-format off
 #include <string>
+#include <vector>
+#include <atomic>
 #if defined(WIN32)
 #include <windows.h>
 #include <processthreadsapi.h>
@@ -8,11 +10,19 @@
 #include "coding_helper.h"
 #elif defined(__LINUX__)
 #include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <cstdlib>
+#include <cstring>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 #include <unistd.h> 
 #elif defined(__ANDROID__)
 #include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <cstdlib>
+#include <cstring>
 #include <sys/prctl.h>
 #include <unistd.h>
 #if defined(__MACH__) || defined(__APPLE__)
@@ -47,6 +57,17 @@ namespace helper {
 #endif
   }
 
+  // 忙等循环中让出流水线，降低功耗和对超线程兄弟核的影响
+  static inline void CpuRelax() {
+#if defined(WIN32)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+  }
+
   static inline void SetCurrentThreadName(const std::string& name) {
 #if defined(WIN32)
     typedef HRESULT(WINAPI* RTC_SetThreadDescription)(HANDLE hThread, PCWSTR lpThreadDescription);
@@ -64,5 +85,125 @@ namespace helper {
     pthread_setname_np(name.c_str());
 #endif
   }
+
+  // 把当前线程绑定到 cpus 中的核，成功返回 true
+  static inline bool SetCurrentThreadAffinity(const std::vector<int>& cpus) {
+    if (cpus.empty()) {
+      return false;
+    }
+#if defined(WIN32)
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus) {
+      if (cpu >= 0 && cpu < static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+        mask |= static_cast<DWORD_PTR>(1) << cpu;
+      }
+    }
+    return mask != 0 && SetThreadAffinityMask(::GetCurrentThread(), mask) != 0;
+#elif defined(__LINUX__) || defined(__ANDROID__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  // 当前线程使用实时调度（Linux 为 SCHED_FIFO），priority 为 1-99，通常需要 CAP_SYS_NICE，成功返回 true
+  static inline bool SetCurrentThreadRealtime(int priority) {
+#if defined(WIN32)
+    return SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#elif defined(__LINUX__) || defined(__ANDROID__) || defined(__MACH__) || defined(__APPLE__)
+    struct sched_param param;
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+    return false;
+#endif
+  }
+
+  // 当前线程的栈大小（预留的地址空间，不是实际占用的内存），未知时返回 0
+  static inline size_t CurrentThreadStackSize() {
+#if defined(WIN32)
+    ULONG_PTR low = 0;
+    ULONG_PTR high = 0;
+    GetCurrentThreadStackLimits(&low, &high);
+    return static_cast<size_t>(high - low);
+#elif defined(__LINUX__) || defined(__ANDROID__)
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+      return 0;
+    }
+    size_t size = 0;
+    pthread_attr_getstacksize(&attr, &size);
+    pthread_attr_destroy(&attr);
+    return size;
+#else
+    return 0;
+#endif
+  }
+
+  // 当前线程所在的核，未知时返回 -1
+  static inline int CurrentCpu() {
+#if defined(WIN32)
+    return static_cast<int>(GetCurrentProcessorNumber());
+#elif defined(__LINUX__) || defined(__ANDROID__)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+  }
+
+  // 核所在的 NUMA 节点，未知时返回 0
+  static inline int NumaNodeOfCpu(int cpu) {
+    if (cpu < 0) {
+      return 0;
+    }
+#if defined(WIN32)
+    UCHAR node = 0;
+    return GetNumaProcessorNode(static_cast<UCHAR>(cpu), &node) ? node : 0;
+#elif defined(__LINUX__) || defined(__ANDROID__)
+    // sysfs 中 cpuN 目录下有指向所属节点的 nodeM 链接
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+      return 0;
+    }
+    int node = 0;
+    while (struct dirent* entry = readdir(dir)) {
+      if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+        node = atoi(entry->d_name + 4);
+        break;
+      }
+    }
+    closedir(dir);
+    return node;
+#else
+    return 0;
+#endif
+  }
+
+  // 当前线程所在核的 NUMA 节点，每个核只查询一次
+  static inline int CurrentNumaNode() {
+    int cpu = CurrentCpu();
+    if (cpu < 0) {
+      return 0;
+    }
+    static const int kMaxCachedCpu = 1024;
+    static std::atomic<int> nodes[kMaxCachedCpu] = {};  // 节点加一，0 表示未查询
+    if (cpu >= kMaxCachedCpu) {
+      return NumaNodeOfCpu(cpu);
+    }
+    int node = nodes[cpu].load(std::memory_order_relaxed);
+    if (node == 0) {
+      node = NumaNodeOfCpu(cpu) + 1;
+      nodes[cpu].store(node, std::memory_order_relaxed);
+    }
+    return node - 1;
+  }
 }  // end namespace helper
 // clang-format on
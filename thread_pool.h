@@ -0,0 +1,133 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "message_buffer.h"
+#include "thread_helper.h"
+
+namespace helper {
+
+// 固定线程数的任务执行器，任务按提交顺序由空闲线程取出执行
+class ThreadPool {
+  public:
+    explicit ThreadPool(size_t threads, const std::string& name = "thread_pool") :name_(name) {
+        start(threads);
+    }
+
+    /*
+        第 i 个线程绑定到 cpus[i % cpus.size()]，realtime_priority 大于 0 时使用实时调度。
+        绑定或设置调度策略失败（例如没有权限）时线程继续运行，在线程中调用 on_error，并计入 GetPlacementFailures。
+        构造函数等所有线程设置完成后才返回。
+    */
+    ThreadPool(size_t threads, const std::string& name, const std::vector<int>& cpus, int realtime_priority = 0,
+               std::function<void(const std::exception*)> on_error = nullptr)
+        :name_(name), cpus_(cpus), realtime_priority_(realtime_priority), on_error_(std::move(on_error)) {
+        start(threads);
+        std::unique_lock<std::mutex> lck(placed_mtx_);
+        placed_cv_.wait(lck, [this]() { return placed_ == threads_.size(); });
+    }
+
+    virtual ~ThreadPool() {
+        for (size_t i = 0; i < threads_.size(); ++i) {
+            tasks_.Put(nullptr); //每个线程取到一个空任务后退出
+        }
+        for (auto& thread : threads_) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+    // 提交不需要返回值的任务
+    void Post(std::function<void()> task) {
+        tasks_.Put(std::move(task));
+    }
+
+    // 提交任务，通过 future 获取返回值
+    template<typename F>
+    auto Submit(F&& func) -> std::future<decltype(func())> {
+        using RetType = decltype(func());
+        auto taskPack = std::make_shared<std::packaged_task<RetType()>>(std::forward<F>(func));
+        auto future = taskPack->get_future();
+        tasks_.Put([taskPack]() { (*taskPack)(); });
+        return future;
+    }
+
+    size_t Size() const {
+        return threads_.size();
+    }
+
+    // 绑定核或设置实时调度失败的次数
+    size_t GetPlacementFailures() const {
+        return placement_failures_.load(std::memory_order_relaxed);
+    }
+
+    void SetWaitStrategy(WaitStrategy strategy,
+                         std::chrono::microseconds spin = std::chrono::microseconds(50),
+                         std::chrono::microseconds yield = std::chrono::microseconds(50)) {
+        tasks_.SetWaitStrategy(strategy, spin, yield);
+    }
+
+  private:
+    void start(size_t threads) {
+        if (threads == 0) {
+            threads = 1;
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            threads_.emplace_back(&ThreadPool::Run, this, i);
+        }
+    }
+
+    void Run(size_t index) {
+        helper::SetCurrentThreadName(name_);
+        if (!cpus_.empty() && !helper::SetCurrentThreadAffinity({ cpus_[index % cpus_.size()] })) {
+            placementFailed("Failed to set thread pool affinity.");
+        }
+        if (realtime_priority_ > 0 && !helper::SetCurrentThreadRealtime(realtime_priority_)) {
+            placementFailed("Failed to set thread pool realtime scheduling.");
+        }
+        {
+            std::unique_lock<std::mutex> lck(placed_mtx_);
+            ++placed_;
+            placed_cv_.notify_all();
+        }
+        while (true) {
+            std::function<void()> task;
+            if (!tasks_.Get(task)) {
+                continue;
+            }
+            if (!task) {
+                break;
+            }
+            task();
+        }
+    }
+
+    void placementFailed(const char* what) {
+        placement_failures_.fetch_add(1, std::memory_order_relaxed);
+        if (on_error_) {
+            std::runtime_error e(what);
+            on_error_(&e);
+        }
+    }
+
+    std::string name_;
+    std::vector<int> cpus_;
+    int realtime_priority_ = 0;
+    std::function<void(const std::exception*)> on_error_;
+    std::atomic<size_t> placement_failures_{ 0 };
+    std::mutex placed_mtx_;
+    std::condition_variable placed_cv_;
+    size_t placed_ = 0;
+    MessageBuffer<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+};
+
+}//end namespace helper
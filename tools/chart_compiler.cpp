@@ -0,0 +1,897 @@
+/*
+    离线状态图编译器：读取 SCXML 描述的状态图，生成只包含 constexpr 表的 C++ 头文件，启动时不再构建 map 和 std::function。
+
+    用法：chart_compiler [-n namespace] [-Werror] input.scxml output.h
+
+    支持的 SCXML 子集：
+        <scxml name="Door">           图的名字，生成 DoorChart；scxml 本身是根状态，下面可以直接写 transition/onentry/onexit
+        <state id="...">              可以嵌套
+        <final id="...">              没有子状态和转移
+        <transition event="a b" target="x" cond="guardName">
+        <onentry>/<onexit>
+        <script>actionName</script>   在 transition/onentry/onexit 中，按名字绑定到用户类的成员函数
+
+    语义与 StateMachine 相同：从根状态开始，当前状态可以是任意状态，进入复合状态时不进入它的子状态；
+    从当前状态向根状态找第一个匹配的转移；转移时先执行转移的动作，再离开到当前状态和目标状态的最近公共祖先，
+    然后进入目标状态，转移到当前状态或祖先状态时不重新进入。没有 target 的转移只执行动作。
+    parallel、history、datamodel 等不支持，遇到时报错。
+
+    生成的头文件中：
+        状态和事件的枚举、父状态、深度、最近公共祖先表；
+        按（当前状态，事件）索引的候选转移表，已经展开了祖先状态的转移，离开和进入的状态列表已经算好；
+        template<class Impl> class Runtime，动作调用 impl.name()，条件调用 bool impl.name()，名字写错时编译失败。
+        Runtime 是独立的执行器，StateMachine 不使用这些表，也不能加载生成的头文件；两者只是语义相同。
+
+    还会报告从根状态无法到达的状态，以及永远不会被选中的转移（被同一状态中更早的无条件转移，
+    或被所有可到达的子孙状态中的转移遮蔽），它们只会增加表的大小。
+*/
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// 只支持编译器需要的 XML：元素、属性、文本、注释和声明
+struct XmlNode {
+    std::string name;
+    std::map<std::string, std::string> attrs;
+    std::vector<XmlNode> children;
+    std::string text;
+    int line = 0;
+};
+
+class XmlReader {
+  public:
+    explicit XmlReader(const std::string& text) :text_(text) {}
+
+    XmlNode Parse() {
+        skipMisc();
+        if (peek() != '<') {
+            fail("expected root element");
+        }
+        XmlNode root = element();
+        skipMisc();
+        if (pos_ < text_.size()) {
+            fail("unexpected content after root element");
+        }
+        return root;
+    }
+
+  private:
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error("line " + std::to_string(line_) + ": " + message);
+    }
+
+    char peek() const {
+        return pos_ < text_.size() ? text_[pos_] : '\0';
+    }
+
+    bool startsWith(const char* prefix) const {
+        return text_.compare(pos_, strlen(prefix), prefix) == 0;
+    }
+
+    void advance(size_t count = 1) {
+        for (size_t i = 0; i < count && pos_ < text_.size(); ++i) {
+            if (text_[pos_++] == '\n') {
+                ++line_;
+            }
+        }
+    }
+
+    void skipUntil(const char* end) {
+        size_t found = text_.find(end, pos_);
+        if (found == std::string::npos) {
+            fail(std::string("missing ") + end);
+        }
+        advance(found + strlen(end) - pos_);
+    }
+
+    void skipSpace() {
+        while (isspace(static_cast<unsigned char>(peek()))) {
+            advance();
+        }
+    }
+
+    // 跳过空白、注释、<?xml ...?> 和 <!DOCTYPE ...>
+    void skipMisc() {
+        while (true) {
+            skipSpace();
+            if (startsWith("<!--")) {
+                skipUntil("-->");
+            }
+            else if (startsWith("<?")) {
+                skipUntil("?>");
+            }
+            else if (startsWith("<!")) {
+                skipUntil(">");
+            }
+            else {
+                return;
+            }
+        }
+    }
+
+    std::string name() {
+        size_t start = pos_;
+        while (isalnum(static_cast<unsigned char>(peek())) || strchr("_-.:", peek()) != nullptr) {
+            advance();
+        }
+        if (start == pos_) {
+            fail("expected name");
+        }
+        std::string result = text_.substr(start, pos_ - start);
+        size_t colon = result.find(':');
+        return colon == std::string::npos ? result : result.substr(colon + 1); //忽略命名空间前缀
+    }
+
+    std::string unescape(const std::string& raw) {
+        static const std::pair<const char*, char> entities[] = {
+            { "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&quot;", '"' }, { "&apos;", '\'' } };
+        std::string result;
+        for (size_t i = 0; i < raw.size();) {
+            bool replaced = false;
+            if (raw[i] == '&') {
+                for (const auto& entity : entities) {
+                    if (raw.compare(i, strlen(entity.first), entity.first) == 0) {
+                        result += entity.second;
+                        i += strlen(entity.first);
+                        replaced = true;
+                        break;
+                    }
+                }
+                if (!replaced) {
+                    fail("unsupported entity");
+                }
+                continue;
+            }
+            result += raw[i++];
+        }
+        return result;
+    }
+
+    XmlNode element() {
+        XmlNode node;
+        node.line = line_;
+        advance(); // '<'
+        node.name = name();
+        while (true) {
+            skipSpace();
+            if (startsWith("/>")) {
+                advance(2);
+                return node;
+            }
+            if (peek() == '>') {
+                advance();
+                break;
+            }
+            std::string key = name();
+            skipSpace();
+            if (peek() != '=') {
+                fail("expected '=' after attribute " + key);
+            }
+            advance();
+            skipSpace();
+            char quote = peek();
+            if (quote != '"' && quote != '\'') {
+                fail("expected quoted value for attribute " + key);
+            }
+            advance();
+            size_t end = text_.find(quote, pos_);
+            if (end == std::string::npos) {
+                fail("unterminated attribute " + key);
+            }
+            std::string value = text_.substr(pos_, end - pos_);
+            advance(end + 1 - pos_);
+            node.attrs[key] = unescape(value);
+        }
+        while (true) {
+            if (pos_ >= text_.size()) {
+                fail("missing </" + node.name + ">");
+            }
+            if (startsWith("<!--")) {
+                skipUntil("-->");
+            }
+            else if (startsWith("<![CDATA[")) {
+                advance(9);
+                size_t end = text_.find("]]>", pos_);
+                if (end == std::string::npos) {
+                    fail("unterminated CDATA");
+                }
+                node.text += text_.substr(pos_, end - pos_);
+                advance(end + 3 - pos_);
+            }
+            else if (startsWith("</")) {
+                advance(2);
+                if (name() != node.name) {
+                    fail("mismatched </...> for <" + node.name + ">");
+                }
+                skipSpace();
+                if (peek() != '>') {
+                    fail("expected '>'");
+                }
+                advance();
+                return node;
+            }
+            else if (peek() == '<') {
+                node.children.push_back(element());
+            }
+            else {
+                size_t end = text_.find('<', pos_);
+                if (end == std::string::npos) {
+                    end = text_.size();
+                }
+                node.text += unescape(text_.substr(pos_, end - pos_));
+                advance(end - pos_);
+            }
+        }
+    }
+
+    const std::string& text_;
+    size_t pos_ = 0;
+    int line_ = 1;
+};
+
+struct ChartState {
+    std::string id;
+    std::string ident;          //枚举名
+    int parent = -1;
+    int depth = 0;
+    bool final = false;
+    int line = 0;
+    std::vector<int> onentry;   //动作编号
+    std::vector<int> onexit;
+    std::vector<int> transitions;
+};
+
+struct ChartTransition {
+    int source = 0;
+    int event = 0;
+    int target = -1;            //-1 表示没有 target，只执行动作
+    int guard = -1;
+    std::vector<int> actions;
+    int line = 0;
+    bool selected = false;      //至少在一个可到达状态的候选列表中
+};
+
+// 某个当前状态下选中一个转移后的完整步骤
+struct Step {
+    int transition = 0;
+    int target = 0;
+    std::vector<int> exits;
+    std::vector<int> entries;
+};
+
+bool isKeyword(const std::string& word) {
+    static const std::set<std::string> keywords = {
+        "alignas", "alignof", "and", "asm", "auto", "bool", "break", "case", "catch", "char", "class", "const",
+        "constexpr", "continue", "default", "delete", "do", "double", "else", "enum", "explicit", "export", "extern",
+        "false", "float", "for", "friend", "goto", "if", "inline", "int", "long", "mutable", "namespace", "new",
+        "noexcept", "not", "nullptr", "operator", "or", "private", "protected", "public", "register", "return",
+        "short", "signed", "sizeof", "static", "struct", "switch", "template", "this", "throw", "true", "try",
+        "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile", "while" };
+    return keywords.count(word) != 0;
+}
+
+bool isIdentifier(const std::string& word) {
+    if (word.empty() || isdigit(static_cast<unsigned char>(word[0])) || isKeyword(word)) {
+        return false;
+    }
+    return std::all_of(word.begin(), word.end(), [](char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; });
+}
+
+// 把 ID 转为可以作为枚举名的标识符
+std::string toIdentifier(const std::string& id, const char* prefix) {
+    std::string result;
+    for (char c : id) {
+        result += isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    }
+    if (result.empty() || isdigit(static_cast<unsigned char>(result[0])) || isKeyword(result)) {
+        result = prefix + result;
+    }
+    return result;
+}
+
+std::string quote(const std::string& text) {
+    std::string result = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result + "\"";
+}
+
+class ChartCompiler {
+  public:
+    void Load(const XmlNode& root, const std::string& file) {
+        file_ = file;
+        if (root.name != "scxml") {
+            throw std::runtime_error("root element must be <scxml>");
+        }
+        auto name = root.attrs.find("name");
+        if (name == root.attrs.end() || !isIdentifier(name->second)) {
+            throw std::runtime_error("<scxml> needs a name attribute that is a C++ identifier");
+        }
+        name_ = name->second;
+        ChartState state;
+        state.id = "root";
+        state.ident = "root";
+        state.line = root.line;
+        states_.push_back(state);
+        loadState(root, 0);
+        resolveTargets();
+    }
+
+    // 展开每个（状态，事件）的候选转移，计算离开和进入的状态
+    void Build() {
+        size_t count = states_.size();
+        lca_.assign(count, std::vector<int>(count, 0));
+        for (size_t a = 0; a < count; ++a) {
+            for (size_t b = 0; b < count; ++b) {
+                lca_[a][b] = lca(static_cast<int>(a), static_cast<int>(b));
+            }
+        }
+        reachable_ = reachableStates();
+        candidates_.assign(count, std::vector<std::vector<Step>>(events_.size()));
+        for (size_t s = 0; s < count; ++s) {
+            for (size_t e = 0; e < events_.size(); ++e) {
+                auto& list = candidates_[s][e];
+                bool closed = false; //已经有无条件的转移，之后的都不会被选中
+                for (int state = static_cast<int>(s); state >= 0 && !closed; state = states_[state].parent) {
+                    for (int t : states_[state].transitions) {
+                        if (transitions_[t].event != static_cast<int>(e)) {
+                            continue;
+                        }
+                        list.push_back(stepFor(static_cast<int>(s), t));
+                        if (reachable_[s]) {
+                            transitions_[t].selected = true;
+                        }
+                        if (transitions_[t].guard < 0) {
+                            closed = true;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // 返回警告数量
+    int Report() const {
+        int warnings = 0;
+        for (size_t s = 0; s < states_.size(); ++s) {
+            if (!reachable_[s]) {
+                std::cerr << file_ << ":" << states_[s].line << ": warning: state '" << states_[s].id
+                          << "' is unreachable from the root state" << std::endl;
+                ++warnings;
+            }
+        }
+        for (const auto& t : transitions_) {
+            if (!t.selected && reachable_[t.source]) {
+                std::cerr << file_ << ":" << t.line << ": warning: transition on '" << events_[t.event] << "' in state '"
+                          << states_[t.source].id << "' is never selected, it is shadowed by earlier or descendant transitions"
+                          << std::endl;
+                ++warnings;
+            }
+        }
+        return warnings;
+    }
+
+    std::string Emit(const std::string& ns) const {
+        std::ostringstream out;
+        std::string chart = name_ + "Chart";
+        out << "// Generated by chart_compiler from " << file_ << ". Do not edit.\n";
+        out << "#pragma once\n#include <cstdint>\n\n";
+        out << "namespace " << ns << " {\n\n";
+        out << "struct " << chart << " {\n";
+        out << "    enum class State : uint16_t {";
+        for (size_t s = 0; s < states_.size(); ++s) {
+            out << (s ? ", " : " ") << states_[s].ident;
+        }
+        out << " };\n";
+        out << "    enum class Event : uint16_t {";
+        for (size_t e = 0; e < events_.size(); ++e) {
+            out << (e ? ", " : " ") << event_idents_[e];
+        }
+        out << " };\n\n";
+        out << "    static constexpr uint16_t kStateCount = " << states_.size() << ";\n";
+        out << "    static constexpr uint16_t kEventCount = " << events_.size() << ";\n\n";
+
+        out << "    static constexpr const char* kStateIds[kStateCount] = {";
+        for (size_t s = 0; s < states_.size(); ++s) {
+            out << (s ? ", " : " ") << quote(states_[s].id);
+        }
+        out << " };\n";
+        out << "    static constexpr const char* kEventNames[" << std::max<size_t>(events_.size(), 1) << "] = {";
+        for (size_t e = 0; e < events_.size(); ++e) {
+            out << (e ? ", " : " ") << quote(events_[e]);
+        }
+        out << (events_.empty() ? " nullptr" : "") << " };\n";
+        emitArray(out, "int16_t", "kParent", [this](size_t s) { return states_[s].parent; }, states_.size());
+        emitArray(out, "uint16_t", "kDepth", [this](size_t s) { return states_[s].depth; }, states_.size());
+        emitArray(out, "bool", "kFinal", [this](size_t s) { return states_[s].final ? 1 : 0; }, states_.size());
+        out << "    static constexpr uint16_t kLca[kStateCount][kStateCount] = {\n";
+        for (size_t a = 0; a < states_.size(); ++a) {
+            out << "        {";
+            for (size_t b = 0; b < states_.size(); ++b) {
+                out << (b ? ", " : " ") << lca_[a][b];
+            }
+            out << " },\n";
+        }
+        out << "    };\n\n";
+
+        //动作和条件
+        std::vector<int> action_list;
+        std::vector<std::pair<size_t, size_t>> entry_ranges;
+        std::vector<std::pair<size_t, size_t>> exit_ranges;
+        for (const auto& state : states_) {
+            entry_ranges.push_back(appendRange(action_list, state.onentry));
+            exit_ranges.push_back(appendRange(action_list, state.onexit));
+        }
+        std::vector<std::pair<size_t, size_t>> transition_actions;
+        for (const auto& t : transitions_) {
+            transition_actions.push_back(appendRange(action_list, t.actions));
+        }
+
+        out << "    struct Range {\n        uint16_t begin_;\n        uint16_t count_;\n    };\n";
+        out << "    struct Transition {\n        uint16_t source_;\n        uint16_t event_;\n        int16_t target_;"
+               "  //-1 表示只执行动作\n        int16_t guard_;\n        Range actions_;\n    };\n";
+        out << "    struct Step {\n        uint16_t transition_;\n        uint16_t target_;\n"
+               "        Range exits_;   //按顺序离开的状态\n        Range entries_; //按顺序进入的状态\n    };\n\n";
+
+        emitArray(out, "uint16_t", "kActions", [&action_list](size_t i) { return action_list[i]; }, action_list.size());
+        emitRanges(out, "kEntryActions", entry_ranges);
+        emitRanges(out, "kExitActions", exit_ranges);
+        out << "    static constexpr Transition kTransitions[" << std::max<size_t>(transitions_.size(), 1) << "] = {\n";
+        for (size_t t = 0; t < transitions_.size(); ++t) {
+            const auto& tr = transitions_[t];
+            out << "        { " << tr.source << ", " << tr.event << ", " << tr.target << ", " << tr.guard << ", { "
+                << transition_actions[t].first << ", " << transition_actions[t].second << " } },\n";
+        }
+        if (transitions_.empty()) {
+            out << "        { 0, 0, -1, -1, { 0, 0 } },\n";
+        }
+        out << "    };\n";
+
+        //步骤、候选列表和按（状态，事件）索引的分派表
+        std::vector<int> path;
+        std::vector<std::string> steps;
+        std::vector<int> candidate_list;
+        std::vector<std::vector<std::pair<size_t, size_t>>> dispatch(states_.size());
+        for (size_t s = 0; s < states_.size(); ++s) {
+            for (size_t e = 0; e < events_.size(); ++e) {
+                size_t begin = candidate_list.size();
+                for (const auto& step : candidates_[s][e]) {
+                    auto exits = appendRange(path, step.exits);
+                    auto entries = appendRange(path, step.entries);
+                    candidate_list.push_back(static_cast<int>(steps.size()));
+                    steps.push_back("{ " + std::to_string(step.transition) + ", " + std::to_string(step.target) + ", { "
+                                    + std::to_string(exits.first) + ", " + std::to_string(exits.second) + " }, { "
+                                    + std::to_string(entries.first) + ", " + std::to_string(entries.second) + " } }");
+                }
+                dispatch[s].push_back({ begin, candidate_list.size() - begin });
+            }
+        }
+        emitArray(out, "uint16_t", "kPath", [&path](size_t i) { return path[i]; }, path.size());
+        out << "    static constexpr Step kSteps[" << std::max<size_t>(steps.size(), 1) << "] = {\n";
+        for (const auto& step : steps) {
+            out << "        " << step << ",\n";
+        }
+        if (steps.empty()) {
+            out << "        { 0, 0, { 0, 0 }, { 0, 0 } },\n";
+        }
+        out << "    };\n";
+        emitArray(out, "uint16_t", "kCandidates", [&candidate_list](size_t i) { return candidate_list[i]; }, candidate_list.size());
+        out << "    static constexpr Range kDispatch[kStateCount][" << std::max<size_t>(events_.size(), 1) << "] = {\n";
+        for (size_t s = 0; s < states_.size(); ++s) {
+            out << "        {";
+            for (size_t e = 0; e < events_.size(); ++e) {
+                out << (e ? ", " : " ") << "{ " << dispatch[s][e].first << ", " << dispatch[s][e].second << " }";
+            }
+            out << (events_.empty() ? " { 0, 0 }" : "") << " },\n";
+        }
+        out << "    };\n\n";
+
+        emitRuntime(out);
+        out << "};\n\n}  // namespace " << ns << "\n";
+        return out.str();
+    }
+
+  private:
+    void loadState(const XmlNode& node, int index) {
+        for (const auto& child : node.children) {
+            if (child.name == "state" || child.name == "final") {
+                auto id = child.attrs.find("id");
+                if (id == child.attrs.end() || id->second.empty()) {
+                    fail(child, "<" + child.name + "> needs an id");
+                }
+                if (ids_.count(id->second) || id->second == "root") {
+                    fail(child, "duplicate state id '" + id->second + "'");
+                }
+                ChartState state;
+                state.id = id->second;
+                state.ident = toIdentifier(id->second, "s_");
+                state.parent = index;
+                state.depth = states_[index].depth + 1;
+                state.final = child.name == "final";
+                state.line = child.line;
+                for (const auto& other : states_) {
+                    if (other.ident == state.ident) {
+                        fail(child, "state id '" + state.id + "' maps to the same identifier as '" + other.id + "'");
+                    }
+                }
+                int child_index = static_cast<int>(states_.size());
+                ids_[state.id] = child_index;
+                states_.push_back(state);
+                if (state.final) {
+                    for (const auto& grandchild : child.children) {
+                        if (grandchild.name != "onentry" && grandchild.name != "onexit") {
+                            fail(grandchild, "<final> can only contain <onentry> and <onexit>");
+                        }
+                    }
+                }
+                loadState(child, child_index);
+            }
+            else if (child.name == "transition") {
+                loadTransition(child, index);
+            }
+            else if (child.name == "onentry" || child.name == "onexit") {
+                auto actions = loadActions(child);
+                auto& list = child.name == "onentry" ? states_[index].onentry : states_[index].onexit;
+                list.insert(list.end(), actions.begin(), actions.end());
+            }
+            else {
+                fail(child, "<" + child.name + "> is not supported");
+            }
+        }
+    }
+
+    void loadTransition(const XmlNode& node, int source) {
+        auto event = node.attrs.find("event");
+        if (event == node.attrs.end()) {
+            fail(node, "<transition> needs an event, eventless transitions are not supported");
+        }
+        std::istringstream names(event->second);
+        std::string name;
+        std::vector<int> events;
+        while (names >> name) {
+            if (name.find('*') != std::string::npos) {
+                fail(node, "wildcard events are not supported");
+            }
+            events.push_back(eventIndex(name, node));
+        }
+        if (events.empty()) {
+            fail(node, "<transition> needs an event");
+        }
+        int guard = -1;
+        auto cond = node.attrs.find("cond");
+        if (cond != node.attrs.end()) {
+            if (!isIdentifier(cond->second)) {
+                fail(node, "cond must name a member function, got '" + cond->second + "'");
+            }
+            guard = nameIndex(guards_, cond->second);
+        }
+        auto actions = loadActions(node);
+        auto target = node.attrs.find("target");
+        for (int e : events) {
+            ChartTransition t;
+            t.source = source;
+            t.event = e;
+            t.guard = guard;
+            t.actions = actions;
+            t.line = node.line;
+            if (target != node.attrs.end()) {
+                pending_targets_.push_back({ static_cast<int>(transitions_.size()), target->second });
+            }
+            states_[source].transitions.push_back(static_cast<int>(transitions_.size()));
+            transitions_.push_back(t);
+        }
+    }
+
+    std::vector<int> loadActions(const XmlNode& node) {
+        std::vector<int> actions;
+        for (const auto& child : node.children) {
+            if (child.name != "script") {
+                fail(child, "<" + child.name + "> is not supported, use <script>memberFunction</script>");
+            }
+            std::string name = child.text;
+            name.erase(0, name.find_first_not_of(" \t\r\n"));
+            name.erase(name.find_last_not_of(" \t\r\n") + 1);
+            if (!isIdentifier(name)) {
+                fail(child, "<script> must contain a member function name, got '" + name + "'");
+            }
+            actions.push_back(nameIndex(actions_, name));
+        }
+        return actions;
+    }
+
+    void resolveTargets() {
+        for (const auto& pending : pending_targets_) {
+            auto& t = transitions_[pending.first];
+            if (pending.second.find(' ') != std::string::npos) {
+                throw std::runtime_error(file_ + ":" + std::to_string(t.line) + ": multiple targets are not supported");
+            }
+            if (pending.second == "root") {
+                t.target = 0;
+                continue;
+            }
+            auto id = ids_.find(pending.second);
+            if (id == ids_.end()) {
+                throw std::runtime_error(file_ + ":" + std::to_string(t.line) + ": unknown target '" + pending.second + "'");
+            }
+            t.target = id->second;
+        }
+        for (const auto& t : transitions_) {
+            if (states_[t.source].final) {
+                throw std::runtime_error(file_ + ":" + std::to_string(t.line) + ": <final> cannot have transitions");
+            }
+        }
+    }
+
+    int eventIndex(const std::string& name, const XmlNode& node) {
+        for (size_t e = 0; e < events_.size(); ++e) {
+            if (events_[e] == name) {
+                return static_cast<int>(e);
+            }
+        }
+        std::string ident = toIdentifier(name, "e_");
+        if (std::find(event_idents_.begin(), event_idents_.end(), ident) != event_idents_.end()) {
+            fail(node, "event '" + name + "' maps to an identifier that is already used");
+        }
+        events_.push_back(name);
+        event_idents_.push_back(ident);
+        return static_cast<int>(events_.size() - 1);
+    }
+
+    static int nameIndex(std::vector<std::string>& names, const std::string& name) {
+        auto it = std::find(names.begin(), names.end(), name);
+        if (it != names.end()) {
+            return static_cast<int>(it - names.begin());
+        }
+        names.push_back(name);
+        return static_cast<int>(names.size() - 1);
+    }
+
+    [[noreturn]] void fail(const XmlNode& node, const std::string& message) const {
+        throw std::runtime_error(file_ + ":" + std::to_string(node.line) + ": " + message);
+    }
+
+    int lca(int a, int b) const {
+        while (states_[a].depth > states_[b].depth) {
+            a = states_[a].parent;
+        }
+        while (states_[b].depth > states_[a].depth) {
+            b = states_[b].parent;
+        }
+        while (a != b) {
+            a = states_[a].parent;
+            b = states_[b].parent;
+        }
+        return a;
+    }
+
+    // 与 StateMachine::Transition 相同：离开到最近公共祖先（不包括），再进入到目标状态
+    Step stepFor(int current, int t) const {
+        Step step;
+        step.transition = t;
+        int target = transitions_[t].target;
+        if (target < 0) {
+            step.target = current;
+            return step;
+        }
+        step.target = target;
+        int common = lca_[current][target];
+        for (int s = current; s != common; s = states_[s].parent) {
+            step.exits.push_back(s);
+        }
+        for (int s = target; s != common; s = states_[s].parent) {
+            step.entries.push_back(s);
+        }
+        std::reverse(step.entries.begin(), step.entries.end());
+        return step;
+    }
+
+    // 从根状态出发，当前状态为 s 时可以选中 s 和所有祖先的转移
+    std::vector<bool> reachableStates() const {
+        std::vector<bool> reachable(states_.size(), false);
+        std::vector<int> pending = { 0 };
+        reachable[0] = true;
+        while (!pending.empty()) {
+            int s = pending.back();
+            pending.pop_back();
+            for (int state = s; state >= 0; state = states_[state].parent) {
+                for (int t : states_[state].transitions) {
+                    int target = transitions_[t].target;
+                    if (target >= 0 && !reachable[target]) {
+                        reachable[target] = true;
+                        pending.push_back(target);
+                    }
+                }
+            }
+        }
+        return reachable;
+    }
+
+    static std::pair<size_t, size_t> appendRange(std::vector<int>& list, const std::vector<int>& items) {
+        size_t begin = list.size();
+        list.insert(list.end(), items.begin(), items.end());
+        return { items.empty() ? 0 : begin, items.size() };
+    }
+
+    template<typename F>
+    static void emitArray(std::ostringstream& out, const char* type, const char* name, F&& value, size_t count) {
+        out << "    static constexpr " << type << " " << name << "[" << std::max<size_t>(count, 1) << "] = {";
+        for (size_t i = 0; i < count; ++i) {
+            out << (i ? ", " : " ") << value(i);
+        }
+        out << (count == 0 ? " 0" : "") << " };\n";
+    }
+
+    void emitRanges(std::ostringstream& out, const char* name, const std::vector<std::pair<size_t, size_t>>& ranges) const {
+        out << "    static constexpr Range " << name << "[kStateCount] = {";
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            out << (i ? ", " : " ") << "{ " << ranges[i].first << ", " << ranges[i].second << " }";
+        }
+        out << " };\n";
+    }
+
+    void emitRuntime(std::ostringstream& out) const {
+        out << "    /*\n"
+               "        按生成的表执行状态图，动作和条件按名字调用 Impl 的成员函数，不是线程安全的。\n"
+               "        Impl 需要提供：";
+        for (size_t a = 0; a < actions_.size(); ++a) {
+            out << (a ? ", " : "") << "void " << actions_[a] << "()";
+        }
+        for (size_t g = 0; g < guards_.size(); ++g) {
+            out << (g || !actions_.empty() ? ", " : "") << "bool " << guards_[g] << "()";
+        }
+        if (actions_.empty() && guards_.empty()) {
+            out << "无";
+        }
+        out << "\n    */\n";
+        out << "    template<class Impl>\n    class Runtime {\n      public:\n";
+        out << "        explicit Runtime(Impl& impl) :impl_(impl) {}\n\n";
+        out << "        // 进入根状态，执行根状态的 onentry\n";
+        out << "        void Start() {\n            current_ = 0;\n            runActions(kEntryActions[0]);\n        }\n\n";
+        out << "        // 处理一个事件，匹配时返回 true\n";
+        out << "        bool Dispatch(Event event) {\n";
+        out << "            const Range& range = kDispatch[current_][static_cast<uint16_t>(event)];\n";
+        out << "            for (uint16_t i = 0; i < range.count_; ++i) {\n";
+        out << "                const Step& step = kSteps[kCandidates[range.begin_ + i]];\n";
+        out << "                const Transition& transition = kTransitions[step.transition_];\n";
+        out << "                if (transition.guard_ >= 0 && !test(transition.guard_)) {\n                    continue;\n                }\n";
+        out << "                runActions(transition.actions_);\n";
+        out << "                for (uint16_t j = 0; j < step.exits_.count_; ++j) {\n";
+        out << "                    runActions(kExitActions[kPath[step.exits_.begin_ + j]]);\n                }\n";
+        out << "                current_ = step.target_;\n";
+        out << "                for (uint16_t j = 0; j < step.entries_.count_; ++j) {\n";
+        out << "                    runActions(kEntryActions[kPath[step.entries_.begin_ + j]]);\n                }\n";
+        out << "                return true;\n            }\n            return false;\n        }\n\n";
+        out << "        State Current() const {\n            return static_cast<State>(current_);\n        }\n\n";
+        out << "        const char* CurrentId() const {\n            return kStateIds[current_];\n        }\n\n";
+        out << "        // 当前状态是 state 或它的子孙状态\n";
+        out << "        bool IsIn(State state) const {\n";
+        out << "            return kLca[current_][static_cast<uint16_t>(state)] == static_cast<uint16_t>(state);\n        }\n\n";
+        out << "      private:\n";
+        out << "        void runActions(const Range& range) {\n";
+        out << "            for (uint16_t i = 0; i < range.count_; ++i) {\n";
+        out << "                call(kActions[range.begin_ + i]);\n            }\n        }\n\n";
+        out << "        void call(uint16_t action) {\n";
+        if (actions_.empty()) {
+            out << "            (void)action;\n";
+        }
+        else {
+            out << "            switch (action) {\n";
+            for (size_t a = 0; a < actions_.size(); ++a) {
+                out << "            case " << a << ":\n                impl_." << actions_[a] << "();\n                break;\n";
+            }
+            out << "            default:\n                break;\n            }\n";
+        }
+        out << "        }\n\n";
+        out << "        bool test(int16_t guard) {\n";
+        if (guards_.empty()) {
+            out << "            (void)guard;\n            return true;\n";
+        }
+        else {
+            out << "            switch (guard) {\n";
+            for (size_t g = 0; g < guards_.size(); ++g) {
+                out << "            case " << g << ":\n                return impl_." << guards_[g] << "();\n";
+            }
+            out << "            default:\n                return true;\n            }\n";
+        }
+        out << "        }\n\n";
+        out << "        Impl& impl_;\n        uint16_t current_ = 0;\n    };\n";
+    }
+
+    std::string file_;
+    std::string name_;
+    std::vector<ChartState> states_;
+    std::map<std::string, int> ids_;
+    std::vector<ChartTransition> transitions_;
+    std::vector<std::pair<int, std::string>> pending_targets_;
+    std::vector<std::string> events_;
+    std::vector<std::string> event_idents_;
+    std::vector<std::string> actions_;
+    std::vector<std::string> guards_;
+    std::vector<std::vector<int>> lca_;
+    std::vector<bool> reachable_;
+    std::vector<std::vector<std::vector<Step>>> candidates_;
+};
+
+int usage() {
+    std::cerr << "usage: chart_compiler [-n namespace] [-Werror] input.scxml output.h" << std::endl;
+    return 2;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string ns = "charts";
+    bool werror = false;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            ns = argv[++i];
+        }
+        else if (arg == "-Werror") {
+            werror = true;
+        }
+        else if (!arg.empty() && arg[0] == '-') {
+            return usage();
+        }
+        else {
+            files.push_back(arg);
+        }
+    }
+    if (files.size() != 2) {
+        return usage();
+    }
+    try {
+        std::ifstream input(files[0], std::ios::binary);
+        if (!input) {
+            throw std::runtime_error("cannot open " + files[0]);
+        }
+        std::string text((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        XmlNode root;
+        try {
+            root = XmlReader(text).Parse();
+        }
+        catch (const std::exception& e) {
+            throw std::runtime_error(files[0] + ": " + e.what());
+        }
+        ChartCompiler compiler;
+        compiler.Load(root, files[0]);
+        compiler.Build();
+        int warnings = compiler.Report();
+        if (werror && warnings > 0) {
+            return 1;
+        }
+        std::string header = compiler.Emit(ns);
+        //内容没有变化时不改写，避免触发重新编译
+        std::ifstream old(files[1], std::ios::binary);
+        std::string existing((std::istreambuf_iterator<char>(old)), std::istreambuf_iterator<char>());
+        if (existing != header) {
+            std::ofstream output(files[1], std::ios::binary);
+            output << header;
+            if (!output) {
+                throw std::runtime_error("cannot write " + files[1]);
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,230 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "event_id.h"
+#include "location.h"
+#include "thread_helper.h"
+
+namespace helper {
+
+//处理函数超时通知，IsRunning 为 true 表示由看门狗线程发现，处理函数还在执行
+class SlowHandlerNotice {
+  public:
+    SlowHandlerNotice(uint32_t event_id, const Location& loc, std::chrono::nanoseconds elapsed,
+                      std::chrono::nanoseconds budget, bool running, uint64_t count)
+        :event_id_(event_id), loc_(loc), elapsed_(elapsed), budget_(budget), running_(running), count_(count) {}
+
+    uint32_t GetEventId() const { return event_id_; }
+    const std::string& GetSignature() const { return EventIdRegistry::Name(event_id_); }
+    const Location& GetLocation() const { return loc_; }
+    std::chrono::nanoseconds GetElapsed() const { return elapsed_; }
+    std::chrono::nanoseconds GetBudget() const { return budget_; }
+    bool IsRunning() const { return running_; }
+    //此签名累计超时的次数，看门狗线程的通知中为 0
+    uint64_t GetCount() const { return count_; }
+
+    std::string Message() const {
+        Location loc = loc_;
+        return std::string(running_ ? "Slow handler still running: " : "Slow handler: ") + "signature=" + GetSignature()
+            + ", location=" + loc.ToString() + ", elapsed=" + std::to_string(elapsed_.count() / 1000) + "us"
+            + ", budget=" + std::to_string(budget_.count() / 1000) + "us";
+    }
+  private:
+    uint32_t event_id_;
+    Location loc_;
+    std::chrono::nanoseconds elapsed_;
+    std::chrono::nanoseconds budget_;
+    bool running_;
+    uint64_t count_;
+};
+
+/*
+    一个状态机的运行步骤计时：worker 线程在运行步骤开始和结束时调用 Begin/End，
+    看门狗线程调用 Check 发现还在执行的超时处理函数。时间上限由状态机按状态和处理函数决定。
+*/
+class HandlerWatch {
+  public:
+    using Handler = std::function<void(const SlowHandlerNotice&)>;
+
+    //看门狗线程复制出的通知，在注册表的锁外调用
+    struct Alert {
+        Handler handler_;
+        SlowHandlerNotice notice_;
+    };
+
+    //在 Start 之前调用
+    void SetHandler(Handler handler) {
+        handler_ = handler;
+    }
+
+    bool HasHandler() const {
+        return static_cast<bool>(handler_);
+    }
+
+    //记录任务信息供看门狗线程读取，开始时间最后写入
+    void Begin(uint32_t event_id, const Location& loc, std::chrono::nanoseconds budget) {
+        budget_.store(budget.count(), std::memory_order_relaxed);
+        event_id_.store(event_id, std::memory_order_relaxed);
+        function_.store(loc.function_name(), std::memory_order_relaxed);
+        file_.store(loc.file_name(), std::memory_order_relaxed);
+        line_.store(loc.line_number(), std::memory_order_relaxed);
+        reported_.store(false, std::memory_order_relaxed);
+        start_.store(Now(), std::memory_order_release);
+    }
+
+    //运行步骤结束（包括处理函数抛出异常），超时时在 worker 线程通知
+    void End() {
+        int64_t start = start_.exchange(0, std::memory_order_acq_rel);
+        if (start == 0) {
+            return;
+        }
+        int64_t budget = budget_.load(std::memory_order_relaxed);
+        int64_t elapsed = Now() - start;
+        if (budget <= 0 || elapsed <= budget) {
+            return;
+        }
+        uint32_t event_id = event_id_.load(std::memory_order_relaxed);
+        uint64_t count = 0;
+        {
+            std::unique_lock<std::mutex> lck(slow_mtx_);
+            count = ++slow_counters_[event_id];
+        }
+        slow_total_.fetch_add(1, std::memory_order_relaxed);
+        SlowHandlerNotice notice(event_id, location(), std::chrono::nanoseconds(elapsed), std::chrono::nanoseconds(budget), false, count);
+        handler_(notice);
+    }
+
+    //在处理函数中停止时运行步骤不再结束计时
+    void Reset() {
+        start_.store(0, std::memory_order_relaxed);
+    }
+
+    //在看门狗线程调用，正在执行的运行步骤超时时把通知和处理函数复制到 alerts，每个运行步骤只通知一次
+    void Check(std::vector<Alert>& alerts) {
+        if (!handler_) {
+            return;
+        }
+        int64_t start = start_.load(std::memory_order_acquire);
+        int64_t budget = budget_.load(std::memory_order_relaxed);
+        int64_t elapsed = Now() - start;
+        if (start == 0 || budget <= 0 || elapsed <= budget) {
+            return;
+        }
+        uint32_t event_id = event_id_.load(std::memory_order_relaxed);
+        Location loc = location();
+        //读取期间开始了新的运行步骤，信息可能不一致，下次再检查
+        if (start_.load(std::memory_order_acquire) != start || reported_.exchange(true, std::memory_order_relaxed)) {
+            return;
+        }
+        alerts.push_back({ handler_, SlowHandlerNotice(event_id, loc, std::chrono::nanoseconds(elapsed), std::chrono::nanoseconds(budget), true, 0) });
+    }
+
+    //超时的处理次数，可以在任意线程读取
+    uint64_t GetSlowCount() const {
+        return slow_total_.load(std::memory_order_relaxed);
+    }
+
+    //按签名ID统计的超时次数
+    std::unordered_map<uint32_t, uint64_t> GetSlowCounts() {
+        std::unique_lock<std::mutex> lck(slow_mtx_);
+        return slow_counters_;
+    }
+
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+  private:
+    Location location() const {
+        return Location(function_.load(std::memory_order_relaxed), file_.load(std::memory_order_relaxed),
+                        line_.load(std::memory_order_relaxed));
+    }
+
+    Handler handler_ = nullptr;
+    std::atomic<int64_t> start_{ 0 }; //正在执行的运行步骤的开始时间（纳秒），0 表示空闲
+    std::atomic<int64_t> budget_{ 0 };
+    std::atomic<uint32_t> event_id_{ 0 };
+    std::atomic<const char*> function_{ nullptr };
+    std::atomic<const char*> file_{ nullptr };
+    std::atomic<int> line_{ -1 };
+    std::atomic<bool> reported_{ false };
+    std::mutex slow_mtx_;
+    std::unordered_map<uint32_t, uint64_t> slow_counters_;
+    std::atomic<uint64_t> slow_total_{ 0 };
+};
+
+/*
+    全局看门狗线程：每隔 interval 调用 collect 收集还在执行的超时处理函数，
+    collect 返回后（不再持有注册表的锁）才调用处理函数，处理函数可以耗时或停止状态机。
+*/
+class WatchdogThread {
+  public:
+    using Collect = std::function<void(std::vector<HandlerWatch::Alert>& alerts)>;
+
+    static WatchdogThread& Instance() {
+        static WatchdogThread watchdog;
+        return watchdog;
+    }
+
+    void Start(std::chrono::milliseconds interval, Collect collect) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        interval_ = interval;
+        collect_ = collect;
+        if (thread_.joinable()) {
+            return;
+        }
+        stop_ = false;
+        thread_ = std::thread(&WatchdogThread::Run, this);
+    }
+
+    void Stop() {
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    ~WatchdogThread() {
+        Stop();
+    }
+
+  private:
+    WatchdogThread() = default;
+
+    void Run() {
+        helper::SetCurrentThreadName("watchdog");
+        std::unique_lock<std::mutex> lck(mtx_);
+        std::vector<HandlerWatch::Alert> alerts;
+        while (!cv_.wait_for(lck, interval_, [this]() { return stop_; })) {
+            auto collect = collect_;
+            lck.unlock();
+            collect(alerts);
+            for (auto& alert : alerts) {
+                alert.handler_(alert.notice_);
+            }
+            alerts.clear();
+            lck.lock();
+        }
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    std::chrono::milliseconds interval_{ 100 };
+    Collect collect_;
+    bool stop_ = false;
+};
+
+}//end namespace helper